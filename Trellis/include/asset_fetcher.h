@@ -0,0 +1,64 @@
+#ifndef ASSET_FETCHER_H
+#define ASSET_FETCHER_H
+
+#include "texture.h"
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Keeps track of the images that pieces are waiting on. Each image is requested once, however
+// many pieces use it, and pieces are indexed by the image they wait on, so an arriving image only
+// touches the pieces that need it.
+class AssetFetcher {
+public:
+    AssetFetcher(AssetFetcher const &) = delete; // Disallow copying
+    void operator=(AssetFetcher const &) = delete;
+
+    static AssetFetcher &GetInstance();
+
+    // A page uid and a piece uid
+    using piece_ref = std::pair<uint64_t, uint64_t>;
+
+    // Drawn in place of a sprite until its image arrives
+    std::shared_ptr<Texture2D> Placeholder();
+
+    // Note that a piece is waiting on an image, and ask for the image if nobody has yet
+    void Request(uint64_t sprite_uid, uint64_t page_uid, uint64_t piece_uid);
+
+    // Stop tracking an image that has arrived, and return the pieces that were waiting on it.
+    // Some of them may have been deleted since.
+    std::vector<piece_ref> Arrived(uint64_t sprite_uid);
+
+    // The pieces still waiting on an image, without giving up on it
+    const std::vector<piece_ref> &Waiting(uint64_t sprite_uid) const;
+
+    // Part of an image has arrived, so the request got through and needn't be sent again yet
+    void Progress(uint64_t sprite_uid);
+
+    // Ask again for images that have stopped arriving for too long
+    void Update();
+
+private:
+    AssetFetcher() = default;
+
+    ~AssetFetcher() = default;
+
+    static constexpr std::chrono::seconds RetryInterval{10};
+
+    class fetch {
+    public:
+        std::vector<piece_ref>                Waiting;
+        std::chrono::steady_clock::time_point Requested;
+    };
+
+    void send_request(uint64_t sprite_uid, fetch &f);
+
+    std::unordered_map<uint64_t, fetch> in_flight;
+    std::shared_ptr<Texture2D>          placeholder;
+};
+
+#endif
@@ -44,7 +44,9 @@ private:
     glm::ivec2                                                 MousePos;
     int                                                        ScrollDirection;
     ClickType                                                  LeftClick, RightClick, MiddleClick;
+    bool                                                       ShiftClick = false;
     Page::MouseHoverType                                       CurrentHoverType;
+    std::vector<CoreGameObject>                                Clipboard;
 
     void init_shaders();
     void init_objects();
@@ -59,7 +61,13 @@ private:
     void handle_page_delete_piece(Data::NetworkData &&q);
     void handle_page_move_piece(Data::NetworkData &&q);
     void handle_page_resize_piece(Data::NetworkData &&q);
+    void handle_piece_properties(Data::NetworkData &&q);
+    void handle_page_add_pieces(Data::NetworkData &&q);
+    void handle_page_delete_pieces(Data::NetworkData &&q);
+    void handle_page_transform_pieces(Data::NetworkData &&q, glm::vec2 Transform::*field);
+    void handle_page_restack_pieces(Data::NetworkData &&q, bool to_front);
     void handle_new_image(Data::NetworkData &&q);
+    void handle_image_preview(Data::NetworkData &&q);
     void handle_client_join(Data::NetworkData &&q);
     void handle_add_page(Data::NetworkData &&q);
 
@@ -78,13 +86,15 @@ private:
     void esc_callback();
 
     void arrow_press(int key);
-    void left_click_press();
+    void left_click_press(int mods);
     void left_click_release();
     void right_click_press();
     void right_click_release();
     void middle_click_press();
     void middle_click_release();
     void delete_press();
+    void copy_press(int mods);
+    void paste_press(int mods);
 
     void SetScreenDims(int width, int height);
 };
@@ -2,10 +2,18 @@
 #define CLIENT_SERVER_H
 
 #include "data.h"
+#include "game_object.h"
 #include "network_manager.h"
 
+#include <bitset>
+#include <chrono>
+#include <deque>
+#include <map>
 #include <memory>
+#include <optional>
 #include <queue>
+#include <set>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
@@ -23,8 +31,9 @@ public:
 
     template<class T>
     void ChannelPublish(std::string name, uint64_t uid, const T &data, uint64_t target_uid = 0) {
+        if (Spectator && name != "IMAGE_REQUEST" && name != "SPECTATE_DONE") { return; }
         if (pub_queues.find(name) == pub_queues.end()) {
-            pub_queues[name] = NetworkManager::NetworkQueue::Subscribe(name);
+            pub_queues[name] = NetworkManager::NetworkQueue::Publisher(name);
         }
         Data::NetworkData nd(data, uid, this->uid);
         changes.push(std::make_pair(name, std::make_pair(nd, target_uid)));
@@ -32,6 +41,21 @@ public:
 
     void ChannelSubscribe(const std::string &channel_name, queue_handler_f cb);
 
+    // Take or renew the leases on pieces before moving them, false and nothing taken if someone
+    // else is holding any of them
+    virtual bool AcquireLeases(const std::vector<uint64_t> &piece_uids) = 0;
+
+    virtual void ReleaseLeases(const std::vector<uint64_t> &piece_uids) = 0;
+
+    // Only the host keeps track of who may see which piece, these do nothing on clients
+    virtual void TrackPiece(
+        [[maybe_unused]] uint64_t              page_uid,
+        [[maybe_unused]] const CoreGameObject &piece) {}
+
+    virtual void SetPieceVisibility(
+        [[maybe_unused]] uint64_t              page_uid,
+        [[maybe_unused]] const CoreGameObject &piece) {}
+
     int                                  ClientCount() const;
     const std::vector<Data::ClientInfo> &getConnectedClients() const;
 
@@ -39,23 +63,34 @@ public:
 
     std::string Name;
 
+    // Spectators only watch, nothing they do is published apart from fetching images
+    bool Spectator = false;
+
 protected:
     virtual void handle_image_request(Data::NetworkData &&q) = 0;
 
+    // Every subscriber sees the same answer for a message, so this must not depend on the order
+    // they are called in
+    virtual bool accept(const std::string &channel, const Data::NetworkData &d);
+
+    virtual void
+    publish(const std::string &channel, const Data::NetworkData &d, uint64_t target_uid);
+
     class NetworkQueueCallback {
     public:
         NetworkQueueCallback(std::string channel_name, queue_handler_f cb);
 
-        void operator()() {
+        void operator()(ClientServer &owner) {
             auto q = queue->Query<Data::NetworkData>();
             while (!q.empty()) {
                 auto nd = q.front();
                 q.pop();
-                callback(std::move(nd));
+                if (owner.accept(channel, nd)) { callback(std::move(nd)); }
             }
         }
 
     private:
+        std::string                                   channel;
         std::shared_ptr<NetworkManager::NetworkQueue> queue;
         queue_handler_f                               callback;
     };
@@ -81,6 +116,10 @@ public:
 
     void Update() override;
 
+    bool AcquireLeases(const std::vector<uint64_t> &piece_uids) override;
+
+    void ReleaseLeases(const std::vector<uint64_t> &piece_uids) override;
+
 private:
     friend class ClientServer;
 
@@ -88,9 +127,29 @@ private:
 
     void handle_image_request(Data::NetworkData &&q) override;
 
+    void handle_lease(Data::NetworkData &&q);
+
     void handle_client_add(Data::NetworkData &&q);
 
     void handle_client_delete(Data::NetworkData &&q);
+
+    void handle_chunk_request(Data::NetworkData &&q);
+
+    void handle_image_chunk(Data::NetworkData &&q);
+
+    // An image that is being assembled from chunks sent by the server and other peers
+    class PartialImage {
+    public:
+        size_t                     Hash{};
+        std::vector<unsigned char> Data;
+        std::vector<bool>          Received;
+        uint32_t                   Remaining{};
+    };
+
+    std::unordered_map<uint64_t, PartialImage> partial_images;
+
+    // Who the server says holds each leased piece
+    std::unordered_map<uint64_t, uint64_t> leases;
 };
 
 class Server : public ClientServer {
@@ -104,23 +163,166 @@ public:
 
     void Update() override;
 
+    bool AcquireLeases(const std::vector<uint64_t> &piece_uids) override;
+
+    void ReleaseLeases(const std::vector<uint64_t> &piece_uids) override;
+
+    void TrackPiece(uint64_t page_uid, const CoreGameObject &piece) override;
+
+    void SetPieceVisibility(uint64_t page_uid, const CoreGameObject &piece) override;
+
 private:
     friend class ClientServer;
 
     Server() = default;
 
+    bool accept(const std::string &channel, const Data::NetworkData &d) override;
+
+    void publish(const std::string &channel, const Data::NetworkData &d, uint64_t target_uid)
+        override;
+
+    // Moves, resizes and deletes of several pieces at once, under the same rules as one piece
+    bool accept_group(const std::string &channel, const Data::NetworkData &d);
+
+    // Each recipient of a batch gets only the entries for pieces they can see
+    void publish_group(const std::string &channel, const Data::NetworkData &d, uint64_t target_uid);
+
+    void handle_lease_release(Data::NetworkData &&q);
+
+    // Each of these tells everyone with one message for the whole group
+    void grant_leases(const std::vector<uint64_t> &piece_uids, uint64_t holder);
+
+    void release_leases(const std::vector<uint64_t> &piece_uids);
+
+    // Deleted pieces are nobody's to hold anymore
+    void release_deleted(const std::vector<uint64_t> &piece_uids);
+
+    void expire_leases();
+
+    void resync_lease_losers();
+
+    static const size_t MaxViewers = 64;
+    using viewer_set               = std::bitset<MaxViewers>;
+
+    // Who may see a piece, worked out ahead of time so filtering a message is a bit test
+    class PieceVisibility {
+    public:
+        uint64_t                   PageUid;
+        uint64_t                   SpriteUid;
+        CoreGameObject::Visibility Visible;
+        std::vector<uint64_t>      Owners;
+        viewer_set                 Viewers;
+    };
+
+    bool can_see(uint64_t client_uid, uint64_t piece_uid) const;
+
+    bool can_see_image(uint64_t client_uid, uint64_t img_id) const;
+
+    viewer_set viewers_of(const PieceVisibility &v) const;
+
+    void assign_viewer_slot(uint64_t client_uid);
+
+    void release_viewer_slot(uint64_t client_uid);
+
+    // Every client gets a bit in the viewer sets, anyone past MaxViewers only sees public pieces
+    std::unordered_map<uint64_t, size_t>          viewer_slots;
+    viewer_set                                    used_viewer_slots;
+    std::unordered_map<uint64_t, PieceVisibility> piece_visibility;
+    // Forgotten once the delete has been sent, so it still reaches the same clients
+    std::vector<uint64_t> deleted_pieces;
+
     void handle_client_join(Data::NetworkData d);
 
     void handle_client_disconnect(Data::NetworkData &&q);
 
+    void handle_spectator_join(Data::NetworkData &&q);
+
     void handle_forward_data(const std::string &channel, const Data::NetworkData &d);
 
     void handle_image_request(Data::NetworkData &&q) override;
 
     void handle_new_image(Data::NetworkData &&q);
 
+    void handle_image_have(Data::NetworkData &&q);
+
+    void handle_image_chunk(Data::NetworkData &&q);
+
+    // Split an image into chunks and queue them for the peers that already hold them, the host only
+    // sends chunks nobody else has. Peer chunks are still relayed over the host's connection to the
+    // requester, so this spreads the reading and serving of images, not the bytes the host sends.
+    void schedule_image_transfer(uint64_t img_id, uint64_t requester);
+
+    void send_new_previews();
+
+    // Hand queued chunks to the least busy holders with a free slot, forgets finished transfers
+    void fill_transfer(uint64_t img_id, uint64_t requester);
+
+    void fill_transfers();
+
+    // A peer finished a chunk, give it another one it holds
+    void refill_peer(uint64_t peer);
+
+    void assign_chunk(uint64_t img_id, uint32_t index, uint64_t requester, uint64_t peer);
+
+    void expire_chunk_assignments();
+
+    // Peers known to hold each chunk of an image, keyed by the image content hash
+    class ImageSwarm {
+    public:
+        std::vector<std::set<uint64_t>> ChunkHolders;
+    };
+
+    class ChunkAssignment {
+    public:
+        uint64_t                              ImageUid;
+        uint32_t                              Index;
+        uint64_t                              Requester;
+        uint64_t                              Peer;
+        std::chrono::steady_clock::time_point Deadline;
+    };
+
+    // Chunks of an image one client asked for that are waiting for a holder to have a free slot
+    class ImageTransfer {
+    public:
+        std::deque<uint32_t> Queued;
+        uint32_t             InFlight{};
+    };
+
+    void release_chunk(const ChunkAssignment &a);
+
+    static const uint32_t                MaxChunksPerPeer = 8;
+    static constexpr std::chrono::seconds ChunkTimeout{5};
+
+    std::unordered_map<size_t, ImageSwarm> swarms;
+    std::vector<ChunkAssignment>           chunk_assignments;
+    // Keyed by image uid and requester
+    std::map<std::pair<uint64_t, uint64_t>, ImageTransfer> image_transfers;
+    // Chunks each peer has been asked for and not yet delivered
+    std::unordered_map<uint64_t, uint32_t> peer_load;
+    // Clients to send an image's preview to once it has been made
+    std::unordered_map<uint64_t, std::set<uint64_t>> preview_waiters;
+
     std::vector<std::pair<uint64_t, uint64_t>> pending_image_requests;
 
+    // Only the holder of a lease may move or resize the piece. The last update accepted from them
+    // is kept so anyone who lost the race can be put back in sync.
+    class Lease {
+    public:
+        uint64_t                              Holder;
+        std::chrono::steady_clock::time_point Expiry;
+        std::optional<Data::NetworkData>      Move;
+        std::optional<Data::NetworkData>      Resize;
+    };
+
+    static constexpr std::chrono::seconds LeaseTimeout{3};
+
+    std::unordered_map<uint64_t, Lease> leases;
+    // Clients whose updates were rejected, and the piece they were fighting over
+    std::set<std::pair<uint64_t, uint64_t>> lease_losers;
+
+    // Spectators and relays get every update but aren't players
+    std::set<uint64_t> spectators;
+
     int port_num{};
 };
 
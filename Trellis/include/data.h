@@ -4,6 +4,7 @@
 #include "util.h"
 #include <chrono>
 #include <ctime>
+#include <glm/glm.hpp>
 #include <utility>
 
 namespace Data {
@@ -23,8 +24,39 @@ private:
     static ClientInfo deserialize_impl(const std::vector<std::byte> &vec);
 };
 
+// A fixed size slice of an ImageData, used to spread image transfers across peers. A chunk with
+// no Data is a request for that chunk to be sent to Recipient.
+class ImageChunk : public Util::Serializable<ImageChunk> {
+public:
+    uint64_t                   ImageUid{};
+    uint64_t                   Recipient{};
+    uint64_t                   TotalSize{};
+    size_t                     Hash{};
+    uint32_t                   Index{};
+    uint32_t                   Count{};
+    std::vector<unsigned char> Data;
+
+    ImageChunk() = default;
+    ImageChunk(uint64_t image_uid, uint64_t recipient, uint32_t index);
+
+    // Whether the sizes and counts agree with each other, checked before anything is allocated
+    // for the image
+    bool Consistent() const;
+
+    std::vector<std::byte> Serialize() const override;
+
+private:
+    friend Serializable<ImageChunk>;
+
+    static ImageChunk deserialize_impl(const std::vector<std::byte> &vec);
+};
+
 class ImageData : public Util::Serializable<ImageData> {
 public:
+    static const size_t ChunkSize = 64 * 1024;
+    // Anything claiming to be bigger than this is refused
+    static const uint64_t MaxSize = 128 * 1024 * 1024;
+
     size_t                     Hash{};
     std::vector<unsigned char> Data;
 
@@ -32,6 +64,9 @@ public:
     explicit ImageData(const std::vector<unsigned char> &data);
     ImageData(const ImageData &other);
 
+    uint32_t   ChunkCount() const;
+    ImageChunk Chunk(uint64_t image_uid, uint64_t recipient, uint32_t index) const;
+
     std::vector<std::byte> Serialize() const override;
 
 private:
@@ -40,6 +75,30 @@ private:
     static ImageData deserialize_impl(const std::vector<std::byte> &vec);
 };
 
+// A small, already decoded RGBA copy of an image. It is sent ahead of the image itself, so pieces
+// have something recognisable to draw while the rest downloads.
+class ImagePreview : public Util::Serializable<ImagePreview> {
+public:
+    static const uint32_t MaxSize = 64;
+
+    uint32_t                   Width{};
+    uint32_t                   Height{};
+    std::vector<unsigned char> Pixels;
+
+    ImagePreview() = default;
+    // Box filters decoded pixels with any number of channels down to at most MaxSize a side
+    ImagePreview(const unsigned char *pixels, int width, int height, int channels);
+
+    bool Empty() const;
+
+    std::vector<std::byte> Serialize() const override;
+
+private:
+    friend Serializable<ImagePreview>;
+
+    static ImagePreview deserialize_impl(const std::vector<std::byte> &vec);
+};
+
 class NetworkData : public Util::Serializable<NetworkData> {
 public:
     std::vector<std::byte> Data;
@@ -69,6 +128,21 @@ private:
     static NetworkData deserialize_impl(const std::vector<std::byte> &vec);
 };
 
+// Pieces changed together by a group operation, sent as one message. Values holds a position or
+// size for each piece, and is empty when only the uids matter.
+class PieceGroup : public Util::Serializable<PieceGroup> {
+public:
+    std::vector<uint64_t>  Uids;
+    std::vector<glm::vec2> Values;
+
+    std::vector<std::byte> Serialize() const override;
+
+private:
+    friend Serializable<PieceGroup>;
+
+    static PieceGroup deserialize_impl(const std::vector<std::byte> &vec);
+};
+
 class ChatMessage : public Util::Serializable<ChatMessage> {
 public:
     enum MsgTypeEnum { CHAT, SYSTEM, JOIN, INFO, INVISIBLE };
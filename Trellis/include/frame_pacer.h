@@ -0,0 +1,47 @@
+#ifndef FRAME_PACER_H
+#define FRAME_PACER_H
+
+#include <atomic>
+
+// Decides when the next frame starts. Nothing on the board changes by itself, so once input,
+// network traffic and loading have been quiet for a few frames the main loop sleeps in the event
+// wait rather than redrawing the same picture.
+class FramePacer {
+public:
+    FramePacer(FramePacer const &) = delete; // Disallow copying
+    void operator=(FramePacer const &) = delete;
+
+    static FramePacer &GetInstance();
+
+    // Only draw when something may have changed, otherwise every frame is drawn
+    bool RedrawOnDemand = true;
+
+    // Frames per second at most, 0 for no limit
+    int FrameCap = 60;
+
+    // Something needs a frame drawn. Safe to call from any thread, the main loop is woken if it is
+    // waiting.
+    void Wake();
+
+    // Handles pending events, sleeping first if nothing needs drawing or the cap hasn't passed
+    void WaitForNextFrame();
+
+private:
+    // Frames still drawn after the last wake, so whatever it started gets to finish
+    static const int SettleFrames = 3;
+    // Even idle, a frame is drawn this often, for timers and hover tooltips
+    static constexpr double IdleTimeout = 0.5;
+    // How often a minimised window handles events
+    static constexpr double MinimisedInterval = 0.25;
+
+    FramePacer() = default;
+
+    ~FramePacer() = default;
+
+    std::atomic<bool> woken{true};
+    std::atomic<bool> waiting{false};
+    int               settle     = SettleFrames;
+    double            last_frame = 0;
+};
+
+#endif
@@ -1,8 +1,10 @@
 #ifndef GAME_OBJECT_H
 #define GAME_OBJECT_H
 
-#include "renderer.h"
+#include "piece_properties.h"
+#include "sprite_batch.h"
 #include "texture.h"
+#include "texture_atlas.h"
 #include "transform.h"
 #include "util.h"
 #include "sqlite_handler.h"
@@ -10,14 +12,21 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <memory>
+#include <vector>
 
 class CoreGameObject : public Util::Serializable<CoreGameObject> {
 public:
-    Transform transform;
-    glm::vec3 Color{};
-    uint64_t  Uid{};
-    uint64_t  SpriteUid{};
-    bool      Clickable{};
+    // Who the server sends the piece to, the host always sees everything
+    enum class Visibility : uint8_t { EVERYONE, OWNERS, GM_ONLY };
+
+    Transform             transform;
+    glm::vec3             Color{};
+    uint64_t              Uid{};
+    uint64_t              SpriteUid{};
+    bool                  Clickable{};
+    Visibility            Visible = Visibility::EVERYONE;
+    std::vector<uint64_t> Owners;
+    PieceProperties       Properties;
 
     CoreGameObject() = default;
     CoreGameObject(
@@ -35,9 +44,21 @@ private:
     static CoreGameObject deserialize_impl(const std::vector<std::byte> &vec);
 };
 
+// Several pieces added by one group operation, like a paste
+class PieceList : public Util::Serializable<PieceList> {
+public:
+    std::vector<CoreGameObject> Pieces;
+
+    std::vector<std::byte> Serialize() const override;
+
+private:
+    friend Serializable<PieceList>;
+    static PieceList deserialize_impl(const std::vector<std::byte> &vec);
+};
+
 class GameObject : public CoreGameObject {
 public:
-    GameObject(const CoreGameObject &other, glm::mat4 &View);
+    explicit GameObject(const CoreGameObject &other);
     GameObject(const GameObject &) = delete;
     GameObject &operator=(const GameObject &) = delete;
 
@@ -46,18 +67,23 @@ public:
 
     GameObject &operator=(const CoreGameObject &other);
 
-    void Draw(int border_pixel_width);
+    // Queue the sprite, the batch is drawn once every piece on the page has been added
+    void Draw(SpriteBatch &batch, bool selected) const;
     void WriteToDB(const SQLite::Database &db, uint64_t page_id) const;
 
     void UpdateSprite(uint64_t sprite_uid);
 
+    // Draw the preview of the sprite's image until the image itself arrives
+    void PreviewSprite(uint64_t sprite_uid);
+
+    // True while a placeholder or preview is drawn because the sprite's image hasn't arrived
+    bool SpritePending() const;
+
     void swap(GameObject &other);
 
 private:
-    explicit GameObject(const CoreGameObject &other);
-
-    std::shared_ptr<Texture2D> Sprite;
-    std::unique_ptr<Renderer>  renderer;
+    SpriteRegion Sprite;
+    bool         sprite_pending = false;
 };
 
 void swap(GameObject &a, GameObject &b);
@@ -0,0 +1,73 @@
+#ifndef GL_STATE_H
+#define GL_STATE_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <glad/glad.h>
+
+// Remembers the GL state that changes between draws, so setting what is already set never reaches
+// the driver. The ImGui backend saves and restores everything it changes, so the cache is still
+// valid once it returns.
+class GLState {
+public:
+    GLState(GLState const &) = delete; // Disallow copying
+    void operator=(GLState const &) = delete;
+
+    static GLState &GetInstance();
+
+    static const int TextureUnits = 16;
+
+    void UseProgram(GLuint program);
+
+    // Takes GL_TEXTURE0 + n, like glActiveTexture
+    void ActiveTexture(GLenum unit);
+
+    // Binds a 2D texture to the active unit
+    void BindTexture(GLuint texture);
+
+    void BindVertexArray(GLuint vertex_array);
+
+    void SetBlend(bool enabled);
+    void BlendFunc(GLenum src, GLenum dst);
+
+    // Deleting an object unbinds it, so these forget it as well
+    void DeleteProgram(GLuint program);
+    void DeleteTexture(GLuint texture);
+    void DeleteVertexArray(GLuint vertex_array);
+
+    // Forget everything, after state has been changed without going through here
+    void Invalidate();
+
+    // Changes passed on to the driver, and those skipped because nothing would have changed
+    uint64_t Issued  = 0;
+    uint64_t Skipped = 0;
+
+private:
+    // Never a valid name or enum, so the first change always goes through
+    static const GLuint Unknown = ~0u;
+
+    GLState();
+
+    ~GLState() = default;
+
+    template<class T>
+    bool change(T &cached, T value) {
+        if (cached == value) {
+            Skipped++;
+            return false;
+        }
+        cached = value;
+        Issued++;
+        return true;
+    }
+
+    GLuint                           program;
+    GLenum                           active_unit;
+    std::array<GLuint, TextureUnits> textures;
+    GLuint                           vertex_array;
+    GLuint                           blend;
+    std::array<GLenum, 2>            blend_func;
+};
+
+#endif
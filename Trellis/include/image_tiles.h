@@ -0,0 +1,59 @@
+#ifndef IMAGE_TILES_H
+#define IMAGE_TILES_H
+
+#include "sqlite_handler.h"
+
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <mutex>
+#include <vector>
+
+// Layout of a huge image split into a pyramid of tiles, so only the part that is on screen, at the
+// detail the zoom needs, ever has to be decoded or uploaded. Level 0 is the full image, every level
+// above is half the size of the one below, up to the first that fits in a single tile. Tiles are
+// stored RGBA in the ImageTiles table, compressed as QOI and keyed by the image's hash, so every
+// game and every peer with the same image shares them.
+class ImageTiles {
+public:
+    static const int TileSize = 512;
+    // Images larger than this on either side are tiled, and so is anything GL can't hold at once
+    static const int MinTiledSize = 8192;
+
+    int Width{};
+    int Height{};
+    int Levels{};
+
+    ImageTiles() = default;
+    ImageTiles(int width, int height);
+
+    glm::ivec2 LevelSize(int level) const;
+
+    // Number of tiles across and down a level
+    glm::ivec2 TileCount(int level) const;
+
+    // In pixels, tiles on the right and bottom edges are cut short
+    glm::ivec2 TileExtent(int level, int x, int y) const;
+
+    // The part of the image a tile covers, as the offset and size of its rect in 0..1
+    glm::vec4 TileRect(int level, int x, int y) const;
+
+    // Unique for every tile of an image
+    static uint64_t Key(int level, int x, int y);
+
+    // Split decoded pixels with any number of channels into tiles at every level. Each row of
+    // tiles is written in a transaction of its own, with db_mtx held, so nothing waits on the
+    // database for long. The single top tile goes last, an image is only stored once it is there.
+    // Throws if the database does.
+    void Build(
+        const SQLite::Database &db,
+        std::mutex &            db_mtx,
+        uint64_t                hash,
+        const unsigned char *   pixels,
+        int                     channels) const;
+
+    // RGBA pixels of a stored tile, nothing if it isn't stored or doesn't decode
+    std::vector<unsigned char>
+    ReadTile(const SQLite::Database &db, uint64_t hash, int level, int x, int y) const;
+};
+
+#endif
@@ -29,7 +29,8 @@ private:
 
     std::string client_name_buf;
     std::string host_name_buf;
-    int         port_buf = 5005;
+    int         port_buf     = 5005;
+    bool        spectate_buf = false;
 };
 
 #endif
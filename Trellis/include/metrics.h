@@ -0,0 +1,79 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <limits>
+#include <mutex>
+#include <string>
+
+// Process wide counters and gauges, exported in the Prometheus text format by the metrics
+// endpoint. Everything that is recorded from the networking or render loop is a preallocated
+// atomic, so recording never allocates or locks.
+class Metrics {
+public:
+    Metrics(Metrics const &) = delete; // Disallow copying
+    void operator=(Metrics const &) = delete;
+
+    static Metrics &GetInstance();
+
+    static const int    DefaultPort = 9464;
+    static const size_t MaxChannels = 64;
+
+    enum Direction { IN, OUT };
+
+    // Hosts only open the endpoint when started with --metrics
+    bool Serve = false;
+
+    // Only registered channels are counted, so peers can't use up the slots by sending messages
+    // on made up channels
+    void RegisterChannel(const std::string &channel);
+
+    void RecordMessage(const std::string &channel, Direction dir, size_t bytes);
+
+    void RecordDbSave(std::chrono::steady_clock::duration duration);
+
+    // True if the endpoint has been scraped recently. Gauges that have to be sampled from the
+    // main thread are only refreshed while this is set.
+    bool Scraping() const;
+
+    // Render all metrics in the Prometheus text exposition format
+    std::string Render();
+
+    std::atomic<int64_t>  ConnectedClients{0};
+    std::atomic<int64_t>  WriteQueueDepth{0};
+    std::atomic<int64_t>  ReadQueueDepth{0};
+    std::atomic<int64_t>  ImageCacheBytes{0};
+    std::atomic<int64_t>  ImageCacheCount{0};
+    std::atomic<int64_t>  TextureResidentBytes{0};
+    std::atomic<int64_t>  TextureEvictedBytes{0};
+    std::atomic<int64_t>  FrameMicros{0};
+    std::atomic<uint64_t> GLStateChanges{0};
+    std::atomic<uint64_t> GLStateChangesSkipped{0};
+    std::atomic<uint64_t> DbSaves{0};
+    std::atomic<uint64_t> DbSaveMicrosTotal{0};
+    std::atomic<int64_t>  DbSaveMicrosLast{0};
+
+private:
+    Metrics() = default;
+
+    ~Metrics() = default;
+
+    class ChannelCounters {
+    public:
+        std::array<std::atomic<uint64_t>, 2> Messages{};
+        std::array<std::atomic<uint64_t>, 2> Bytes{};
+    };
+
+    // Returns the slot of a registered channel, or -1
+    int channel_slot(const std::string &channel) const;
+
+    std::array<std::string, MaxChannels>     channel_names;
+    std::array<ChannelCounters, MaxChannels> channels;
+    std::atomic<size_t>                      channel_count{0};
+    std::mutex                               register_mtx;
+    std::atomic<int64_t>                     last_scrape{std::numeric_limits<int64_t>::min() / 2};
+};
+
+#endif
@@ -0,0 +1,80 @@
+#ifndef NETWORK_CONDITIONER_H
+#define NETWORK_CONDITIONER_H
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <string>
+#include <utility>
+
+// Shapes the traffic of a connection to look like a real world link so that latency and bandwidth
+// sensitive code can be measured over loopback. Connections are keyed by the uid of the other end,
+// which is always 0 (the server) when running as a client.
+class NetworkConditioner {
+public:
+    using clock = std::chrono::steady_clock;
+
+    NetworkConditioner(NetworkConditioner const &) = delete; // Disallow copying
+    void operator=(NetworkConditioner const &) = delete;
+
+    static NetworkConditioner &GetInstance();
+
+    static constexpr const char *ConfigFile = "network_conditioner.json";
+
+    // Used for any connection without a profile of its own
+    static const uint64_t DefaultProfile = ~0ULL;
+
+    enum Direction { IN, OUT };
+
+    class Profile {
+    public:
+        int LatencyMs     = 0;
+        int JitterMs      = 0;
+        int BandwidthKbps = 0; // 0 is unlimited
+
+        bool Active() const;
+    };
+
+    bool LoadConfig(const std::string &path = ConfigFile);
+
+    bool SaveConfig(const std::string &path = ConfigFile);
+
+    Profile GetProfile(uint64_t uid);
+
+    void SetProfile(uint64_t uid, const Profile &profile);
+
+    void ClearProfile(uint64_t uid);
+
+    bool HasProfile(uint64_t uid);
+
+    // Returns the time at which a message of the given size may be handed on, or nothing if the
+    // connection isn't being shaped. Release times never go backwards on a link, but several can
+    // be equal, so callers must hand messages on in the order they were scheduled.
+    std::optional<clock::time_point> Schedule(uint64_t uid, Direction dir, size_t bytes);
+
+private:
+    NetworkConditioner();
+
+    ~NetworkConditioner() = default;
+
+    class Link {
+    public:
+        clock::time_point BusyUntil;
+        clock::time_point LastRelease;
+    };
+
+    Profile &profile_for(uint64_t uid);
+
+    void update_enabled();
+
+    std::mutex                                      mtx;
+    std::atomic<bool>                               enabled{false};
+    std::map<uint64_t, Profile>                     profiles;
+    std::map<std::pair<uint64_t, Direction>, Link> links;
+    std::mt19937                                    rng;
+};
+
+#endif
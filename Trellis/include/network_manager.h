@@ -1,19 +1,27 @@
 #ifndef NETWORK_MANAGER_H
 #define NETWORK_MANAGER_H
 
+#include "data.h"
+#include "network_conditioner.h"
+#include "piece_properties.h"
+#include "session_log.h"
+#include "shared_memory.h"
 #include "util.h"
 
 #include <algorithm>
 #include <array>
 #include <asio.hpp>
+#include <chrono>
 #include <deque>
 #include <glm/glm.hpp>
 #include <iostream>
 #include <iterator>
+#include <list>
 #include <map>
 #include <unordered_map>
 #include <memory>
 #include <mutex>
+#include <optional>
 #include <queue>
 #include <set>
 #include <string>
@@ -33,31 +41,62 @@ public:
 
     void StartServer(int port);
 
-    void StartClient(std::string client_name, uint64_t client_uid, std::string hostname, int port);
+    void StartClient(
+        std::string client_name,
+        uint64_t    client_uid,
+        std::string hostname,
+        int         port,
+        bool        spectator = false);
+
+    // Join hostname:port as a spectator and re-broadcast the game to spectators connecting on
+    // listen_port. The upstream can be the host or another relay.
+    void StartRelay(std::string relay_name, std::string hostname, int port, int listen_port);
+
+    // Serve Prometheus metrics over HTTP on the networking io_context. Must be called after the
+    // server or client has been started so that the context is being run.
+    void StartMetrics(std::string address, int port);
 
     void HttpGetRequest(
         std::string                      hostname,
         std::string                      path,
         std::function<void(std::string)> callback);
 
+    // Push data into the local subscribers of a channel as if it had arrived over the network
+    void Dispatch(const std::string &channel, const std::vector<std::byte> &data);
+
+    // True if the connection to uid is on this machine and large messages skip the socket
+    bool IsLocalPeer(uint64_t uid);
+
+    // Log every frame received and sent to path, starting from the next server or client started
+    void RecordSession(std::string path);
+
+    // Play a recorded session back into the subscribers in place of the network, which stays
+    // down. Fast mode skips idle time and replays one frame's worth of messages per Update.
+    // A host's board is rebuilt from the pages and pieces it sent.
+    // Returns the role the session was recorded as, or nothing if the log couldn't be read.
+    std::optional<SessionLog::Role> StartReplay(const std::string &path, bool fast);
+
     class NetworkQueue {
     public:
         static std::shared_ptr<NetworkQueue> Subscribe(std::string cname);
 
+        // A queue for sending only, nothing received on the channel is delivered to it
+        static std::shared_ptr<NetworkQueue> Publisher(std::string cname);
+
         template<class T>
         void Publish(const T &data, uint64_t uid = 0) {
             auto v = Util::serialize_vec<T>(data);
-            nm.net_obj->Write(Message(v, uid, channel_name));
+            nm.send(Message(v, uid, channel_name));
         }
 
         template<>
         void Publish<std::string>(const std::string &data, uint64_t uid) {
-            nm.net_obj->Write(Message(data, uid, channel_name));
+            nm.send(Message(data, uid, channel_name));
         }
 
         template<>
         void Publish<std::vector<std::byte>>(const std::vector<std::byte> &data, uint64_t uid) {
-            nm.net_obj->Write(Message(data, uid, channel_name));
+            nm.send(Message(data, uid, channel_name));
         }
 
         ~NetworkQueue();
@@ -74,6 +113,7 @@ public:
                 }
                 should_clear = true;
                 for (auto &v : byte_ars) { q.push(Util::deserialize<T>(v)); }
+                consumed(byte_ars.size());
                 mtx.unlock();
             }
             return q;
@@ -82,6 +122,8 @@ public:
     private:
         NetworkQueue();
 
+        void consumed(size_t count);
+
         std::string                         channel_name;
         static NetworkManager &             nm;
         bool                                should_clear;
@@ -100,6 +142,10 @@ private:
     ~NetworkManager() = default;
 
     std::map<std::string, std::vector<std::weak_ptr<NetworkQueue>>> queues;
+
+    // Dispatch a frame that came in over the network, logging it if recording
+    void receive(const std::string &channel, const std::vector<std::byte> &data);
+
     class MessageHeader {
     public:
         static const size_t HeaderLength = 32;
@@ -161,11 +207,18 @@ private:
 
         void WriteSocket(const socket_ptr &sock, const Message &msg);
 
+        // Hand a received message to the subscribers of its channel, holding it back first if the
+        // connection it arrived on is being conditioned
+        void deliver(uint64_t peer, const std::string &channel, const std::vector<std::byte> &data);
+
+        // Uid of the connection a message is written to
+        virtual uint64_t peer_of([[maybe_unused]] const Message &msg) const { return 0; }
+
         virtual void Write(Message msg) = 0;
 
         // virtual std::shared_ptr<std::string> Read() = 0;
 
-        virtual void handle_header_action(const socket_ptr &sock) = 0;
+        virtual void handle_header_action([[maybe_unused]] const socket_ptr &sock){};
 
         virtual void
         handle_write(const socket_ptr &sock, const asio::error_code &error, size_t bytes);
@@ -190,29 +243,106 @@ private:
             [[maybe_unused]] Message &               buf,
             [[maybe_unused]] const asio::error_code &error){};
 
+        bool shm_ready(uint64_t peer);
+
         uint64_t   uid;
         std::mutex http_mtx;
         std::unordered_map<std::string, std::pair<std::string, std::function<void(std::string)>>>
             http_get_response;
 
     protected:
-        asio::io_context &  context;
-        std::deque<Message> write_msgs;
-        Message             read_msg;
+        // Messages at least this big go through shared memory to local peers
+        static const size_t ShmThreshold = 16 * 1024;
+
+        // Each side of a local connection owns the ring it writes to and maps the other one
+        class shm_link {
+        public:
+            std::unique_ptr<SharedRing> Out;
+            std::unique_ptr<SharedRing> In;
+            bool                        OutReady = false;
+            std::mutex                  mtx;
+        };
+
+        asio::io_context &                            context;
+        std::deque<Message>                           write_msgs;
+        Message                                       read_msg;
+        std::mutex                                    shm_mtx;
+        std::map<uint64_t, std::shared_ptr<shm_link>> shm_links;
+
+        // Image data waits here until nothing else is queued, so a big transfer never holds up
+        // the game. Messages that went through shared memory stay in order on the main queue.
+        std::deque<Message> bulk_msgs;
+
+        static bool is_bulk(const Message &msg);
+
+        // Queue an encoded message on the lane it belongs to
+        void enqueue(Message &&msg);
+
+        // Make sure something is at the front of the write queue, taking the next bulk message
+        // once everything else has gone. False if there is nothing left to write.
+        bool promote_bulk();
 
         virtual void do_write(const socket_ptr &sock, const Message &msg);
+
+        // Create the outgoing ring for a local peer and tell it where to find it
+        void open_shm_link(const socket_ptr &sock, uint64_t peer);
+
+        void close_shm_link(uint64_t peer);
+
+        // Swap a large message for a doorbell pointing into the peer's ring, if there is room
+        Message shm_encode(uint64_t peer, const Message &msg);
+
+        // Handle the shared memory control channels. Returns false if the frame was consumed,
+        // otherwise doorbells are replaced by the message they point at.
+        bool shm_decode(
+            const socket_ptr &      sock,
+            uint64_t                peer,
+            MessageHeader &         header,
+            std::vector<std::byte> &body);
+
+        std::shared_ptr<shm_link> get_shm_link(uint64_t peer);
+
+        // Messages the conditioner is holding back on one link, in the order they were sent. A
+        // single timer waits on the one at the front, so equal release times can't swap them.
+        class conditioned_link {
+        public:
+            std::unique_ptr<asio::steady_timer> Timer;
+            std::deque<std::pair<NetworkConditioner::clock::time_point, std::function<void()>>>
+                Held;
+        };
+        using link_key = std::pair<uint64_t, NetworkConditioner::Direction>;
+
+        std::mutex                           conditioned_mtx;
+        std::map<link_key, conditioned_link> conditioned_links;
+
+        void hold(
+            const link_key &                     key,
+            NetworkConditioner::clock::time_point release,
+            std::function<void()>                action);
+
+        // Run everything on a link that is due, then wait for the next one
+        void release_held(const link_key &key);
     };
 
-    class server : public network_object {
+    // Receive buffers recycled between server connections. Buffers that had to grow for a large
+    // frame are dropped on release rather than pooled.
+    class buffer_pool {
     public:
-        void handle_header_action(const socket_ptr &sock) override;
+        static const size_t BufferSize = 64 * 1024;
 
-        void handle_read_header_connect(
-            const socket_ptr &      sock,
-            Message &               buf,
-            const asio::error_code &error,
-            size_t                  bytes);
+        std::vector<std::byte> Acquire();
+
+        void Release(std::vector<std::byte> &&buf);
+
+    private:
+        static const size_t MaxPooled = 64;
 
+        std::mutex                          mtx;
+        std::vector<std::vector<std::byte>> free_bufs;
+    };
+
+    class server : public network_object {
+    public:
         server(asio::io_context &con, int port_num);
 
         ~server() override;
@@ -222,26 +352,52 @@ private:
         void
         handle_write(const socket_ptr &sock, const asio::error_code &error, size_t bytes) override;
 
-        void
-        handle_error(const socket_ptr &sock, Message &buf, const asio::error_code &error) override;
+        uint64_t peer_of(const Message &msg) const override { return msg.Header.Uid; }
 
     private:
+        // Consecutive messages to the same client are gathered into a single write
+        static const size_t MaxWriteBatch = 64;
+
+        class connection {
+        public:
+            socket_ptr             Sock;
+            uint64_t               Uid       = 0;
+            bool                   Local     = false;
+            bool                   Spectator = false;
+            std::vector<std::byte> Buffer;
+            size_t                 Filled = 0;
+        };
+        using connection_ptr = std::shared_ptr<connection>;
+
         tcp::acceptor                  acceptor;
         std::map<uint64_t, socket_ptr> socks;
         asio::thread_pool              tp;
         std::mutex                     mtx;
-        std::map<socket_ptr, Message>  read_msgs;
+        buffer_pool                    pool;
+        size_t                         writes_in_flight = 0;
 
         void handle_accept(socket_ptr new_sock, const asio::error_code &error);
 
+        void start_read(const connection_ptr &conn);
+
+        void handle_read(const connection_ptr &conn, const asio::error_code &error, size_t bytes);
+
+        void
+        handle_frame(const connection_ptr &conn, MessageHeader header, std::vector<std::byte> body);
+
+        void close_connection(const connection_ptr &conn, const asio::error_code &error);
+
         void do_write(const socket_ptr &sock, const Message &msg) override;
 
+        void start_write(const socket_ptr &sock);
+
         void listen();
     };
 
     class client : public network_object {
     public:
         std::string ClientName;
+        bool        Spectator;
 
         void handle_header_action(const socket_ptr &sock) override;
 
@@ -250,7 +406,8 @@ private:
             uint64_t          client_uid,
             asio::io_context &con,
             std::string       hostname,
-            int               port_num);
+            int               port_num,
+            bool              spectator);
 
         ~client() override;
 
@@ -264,7 +421,168 @@ private:
         void handle_connect(const asio::error_code &error, const tcp::endpoint &ep);
     };
 
-    std::unique_ptr<network_object> net_obj;
+    // Read-only fan-out for spectators. Joins its upstream (the host or another relay) as a single
+    // spectator and forwards the frames it receives to its own spectators exactly as they were
+    // encoded upstream. A coalesced copy of the game state and images is kept for late joiners.
+    class relay : public network_object {
+    public:
+        relay(
+            std::string       relay_name,
+            asio::io_context &con,
+            std::string       hostname,
+            int               port_num,
+            int               listen_port);
+
+        ~relay() override;
+
+        void Write(Message msg) override;
+
+        void handle_header_action(const socket_ptr &sock) override;
+
+    private:
+        using frame_ptr = std::shared_ptr<const std::vector<std::byte>>;
+
+        // A spectator that can't keep up with this many frames is dropped
+        static const size_t MaxSpectatorBacklog = 4096;
+        static const size_t ChatHistory         = 100;
+        // An image that has sent nothing upstream for this long is asked for again
+        static constexpr std::chrono::seconds ImageRequestTimeout{10};
+
+        class spectator {
+        public:
+            socket_ptr            Sock;
+            uint64_t              Uid    = 0;
+            bool                  Joined = false;
+            Message               ReadMsg;
+            std::deque<frame_ptr> WriteQueue;
+        };
+        using spectator_ptr = std::shared_ptr<spectator>;
+
+        class cached_image {
+        public:
+            size_t                                Hash  = 0;
+            uint32_t                              Count = 0;
+            frame_ptr                             Whole;
+            frame_ptr                             Preview;
+            std::map<uint32_t, frame_ptr>         Chunks;
+            std::set<spectator_ptr>               Waiting;
+            // When it was asked for upstream or last sent anything, zero if it isn't on its way
+            std::chrono::steady_clock::time_point Requested;
+
+            bool Complete() const;
+        };
+
+        // Frames kept in the order they arrived, since pages and pieces are stacked in the order
+        // they are added. Replacing a frame keeps its place.
+        class ordered_frames {
+        public:
+            using entry_list = std::list<std::pair<uint64_t, frame_ptr>>;
+
+            entry_list Entries;
+
+            void Set(uint64_t uid, const frame_ptr &frame);
+            void Erase(uint64_t uid);
+            // Move to where the last or first added frame would be
+            void MoveToEnd(uint64_t uid);
+            void MoveToBegin(uint64_t uid);
+
+        private:
+            std::unordered_map<uint64_t, entry_list::iterator> index;
+        };
+
+        std::string                   name;
+        socket_ptr                    upstream;
+        tcp::resolver                 resolver;
+        tcp::acceptor                 acceptor;
+        std::shared_ptr<asio::thread> relay_thread;
+        std::set<spectator_ptr>       spectators;
+
+        // Latest state, replayed to spectators as they join
+        frame_ptr                        join_accept;
+        frame_ptr                        player_view;
+        std::map<uint64_t, frame_ptr>    clients;
+        ordered_frames                   pages;
+        ordered_frames                   pieces;
+        std::map<uint64_t, frame_ptr>    piece_moves;
+        std::map<uint64_t, frame_ptr>    piece_resizes;
+        std::deque<frame_ptr>            chat;
+        std::map<uint64_t, cached_image> images;
+
+        // Property batches only carry what changed, so the relay keeps the merged result per
+        // piece, along with the page it is on
+        std::map<uint64_t, std::pair<uint64_t, PieceProperties>> piece_properties;
+
+        void handle_connect(const asio::error_code &error);
+
+        void listen();
+
+        void handle_accept(socket_ptr sock, const asio::error_code &error);
+
+        void read_spectator(const spectator_ptr &s);
+
+        void handle_spectator_frame(const spectator_ptr &s);
+
+        void cache_frame(
+            const std::string &           channel,
+            const std::vector<std::byte> &body,
+            const frame_ptr &             frame);
+
+        void handle_image_frame(
+            const std::string &           channel,
+            const std::vector<std::byte> &body,
+            const frame_ptr &             frame);
+
+        void send_snapshot(const spectator_ptr &s);
+
+        // Encodes a message the relay made itself, like the single piece parts of a batch
+        frame_ptr make_frame(const std::string &channel, const Data::NetworkData &nd) const;
+
+        void send(const spectator_ptr &s, const frame_ptr &frame);
+
+        void handle_spectator_write(const spectator_ptr &s, const asio::error_code &error);
+
+        void drop_spectator(const spectator_ptr &s);
+    };
+
+    class metrics_server {
+    public:
+        using socket_ptr = std::shared_ptr<tcp::socket>;
+
+        metrics_server(asio::io_context &con, const std::string &address, int port_num);
+
+    private:
+        asio::io_context &context;
+        tcp::acceptor     acceptor;
+
+        void listen();
+
+        void handle_accept(socket_ptr sock, const asio::error_code &error);
+
+        void handle_request(
+            socket_ptr                       sock,
+            std::shared_ptr<asio::streambuf> buf,
+            const asio::error_code &         error);
+    };
+
+    void send(Message msg);
+
+    void start_recording(SessionLog::Role role);
+
+    void replay_frame();
+
+    // A replay frame covers this much recorded time in fast mode
+    static constexpr std::chrono::microseconds ReplayFrame{16667};
+
+    std::unique_ptr<network_object>  net_obj;
+    std::unique_ptr<metrics_server>  metrics_obj;
+    std::string                      record_path;
+    std::unique_ptr<SessionRecorder> recorder;
+
+    std::unique_ptr<SessionReader>        replay;
+    bool                                  replay_fast = false;
+    int64_t                               replay_clock{};
+    size_t                                replay_frames{};
+    std::chrono::steady_clock::time_point replay_start;
 };
 
 #endif
\ No newline at end of file
@@ -2,10 +2,13 @@
 #define PAGE_H
 
 #include "camera.h"
+#include "data.h"
 #include "game_object.h"
 #include "page_ui.h"
 #include "util.h"
 #include "board_renderer.h"
+#include "spatial_index.h"
+#include "sprite_batch.h"
 #include "sqlite_handler.h"
 
 #include <functional>
@@ -13,6 +16,8 @@
 #include <memory>
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 class CorePage : public Util::Serializable<CorePage> {
 public:
@@ -44,7 +49,7 @@ public:
 
     enum class MouseHoverType { NONE, N, E, S, W, NE, SE, SW, NW, CENTER };
     enum class ArrowkeyType { RIGHT, LEFT, DOWN, UP };
-    enum class MouseHoldType { NONE, PLACING, FOLLOWING, SCALING };
+    enum class MouseHoldType { NONE, PLACING, FOLLOWING, SCALING, SELECTING };
 
     static constexpr float TILE_DIMENSIONS = 100.0f;
 
@@ -53,6 +58,8 @@ public:
     std::unordered_map<uint64_t, std::reference_wrapper<GameObject>> PiecesMap;
 
     std::list<std::unique_ptr<GameObject>>::iterator CurrentSelection = Pieces.end();
+    // Every selected piece, including CurrentSelection, which is the one the mouse is working on
+    std::unordered_set<uint64_t> Selection;
 
     Page(const CorePage &other);
     Page(const SQLite::Database &db, uint64_t uid);
@@ -65,7 +72,8 @@ public:
     Page &operator=(Page &&other) noexcept = delete;
 
     // Mouse event handlers
-    void HandleLeftClickPress(glm::ivec2 mouse_pos);
+    // Additive clicks add or remove a piece from the selection instead of replacing it
+    void HandleLeftClickPress(glm::ivec2 mouse_pos, bool additive = false);
 
     void HandleLeftClickHold(glm::ivec2 mouse_pos);
 
@@ -85,12 +93,24 @@ public:
     // Adds a piece to the pieces list and the map
     GameObject &AddPiece(const CoreGameObject &core_piece);
 
+    // Call after changing a piece's transform from outside the page, so it is found where it is
+    void PieceMoved(const GameObject &piece);
+
     void DeletePiece(uint64_t);
 
+    // Look the sprite up again for the pieces showing any of these, and only for those
+    void SpritesChanged(const std::vector<uint64_t> &sprite_uids);
+
+    // Deletes every selected piece
     void DeleteCurrentSelection();
 
+    std::vector<CoreGameObject> CopySelection() const;
+
+    // Adds copies of the pieces, offset by a tile, and selects them
+    void Paste(const std::vector<CoreGameObject> &pieces);
+
     // Begin placing a piece on board, this locks it to the mouse and doesn't place until clicked.
-    void BeginPlacePiece(const Transform &transform, const std::shared_ptr<Texture2D> &sprite);
+    void BeginPlacePiece(const Transform &transform, uint64_t sprite_uid);
 
     void Update(glm::ivec2 mouse_pos);
 
@@ -107,12 +127,19 @@ public:
     glm::ivec2 getCellDims() const;
     void       setCellDims(glm::ivec2 cellDims);
 
+    // Move the pieces to the top of the stack, or the bottom if to_front is false
+    void Restack(const std::vector<uint64_t> &uids, bool to_front);
+
     void WriteToDB(const SQLite::Database &db, uint64_t game_id) const;
     // Network related functions
     void SendAllPieces(uint64_t target_uid = 0);
 
+    // Move property edits made since the last call into batch, for sending in one message
+    void CollectPropertyChanges(PropertyBatch &batch);
+
 private:
     BoardRenderer             board_renderer;
+    SpriteBatch               sprite_batch;
     glm::ivec2                DragOrigin = glm::ivec2(0);
     MouseHoldType             mouse_hold = MouseHoldType::NONE;
     std::pair<int, int>       ScaleEdges = {0, 0};
@@ -120,17 +147,55 @@ private:
     glm::vec2                 initialPos;
     int                       BorderWidth = 5;
     glm::mat4                 View        = glm::mat4(1.0f);
+    glm::mat4                 InverseView = glm::mat4(1.0f);
     std::unique_ptr<Camera2D> Camera;
     std::unique_ptr<PageUI>   UserInterface;
 
+    SpatialIndex index{TILE_DIMENSIONS * 2};
+
+    // Uids of the pieces showing each sprite
+    std::unordered_map<uint64_t, std::unordered_set<uint64_t>> pieces_by_sprite;
+
+    void forget_piece(const GameObject &piece);
+
+    // Pieces whose properties were edited locally and haven't been sent yet
+    std::unordered_set<uint64_t> dirty_properties;
+
+    // The rest of the selection, which follows CurrentSelection around, and where each piece was
+    // when the edit started. Parallel arrays so a group move is one pass over them.
+    std::vector<GameObject *> group;
+    std::vector<glm::vec2>    group_positions;
+    std::vector<glm::vec2>    group_sizes;
+
+    // Selection box, the corner the drag started at in world space and the mouse in screen space
+    glm::vec2  band_origin = glm::vec2(0);
+    glm::ivec2 band_end    = glm::ivec2(0);
+
     void SnapPieceToGrid(GameObject &piece, int increments);
 
     glm::vec2 ScreenPosToWorldPos(glm::ivec2 pos);
 
+    void set_view(const glm::mat4 &view);
+
     glm::vec2 WorldPosToScreenPos(glm::ivec2 pos);
 
     void MoveCurrentSelection(glm::vec2 mouse_pos);
 
+    void begin_group_edit();
+
+    // Offsets the group by how far CurrentSelection has moved and grown since the edit started, and
+    // reindexes them all
+    void move_group(glm::vec2 moved_by, glm::vec2 resized_by, float min_size);
+
+    void publish_group(const std::string &channel, glm::vec2 Transform::*field);
+
+    // Takes leases on CurrentSelection and the group, false if anyone else holds one of them
+    bool acquire_group();
+
+    void release_group();
+
+    void select_in_band(glm::ivec2 mouse_pos);
+
     void HandleUIEvents();
 };
 
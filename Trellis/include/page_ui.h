@@ -5,19 +5,28 @@
 #include "imgui_impl_glfw.h"
 #include "imgui_impl_opengl3.h"
 #include "imgui_internal.h"
+#include "game_object.h"
 
 class PageUI {
 public:
-    bool ClickMenuActive = false;
-    bool MoveToFront     = false;
-    bool MoveToBack      = false;
+    bool ClickMenuActive  = false;
+    bool MoveToFront      = false;
+    bool MoveToBack       = false;
+    bool SetVisibility    = false;
+    bool PropertiesOpen   = false;
+    bool PropertiesEdited = false;
+
+    CoreGameObject::Visibility NewVisibility = CoreGameObject::Visibility::EVERYONE;
+    uint64_t                   ToggleOwner   = 0;
 
     int ActivePage     = 0;
     int PlayerPageView = 0;
 
     ~PageUI();
     PageUI();
-    void DrawPieceClickMenu();
+    void DrawPieceClickMenu(const CoreGameObject *selection);
+    void DrawPropertiesWindow(CoreGameObject *selection);
+    void DrawSelectionBox(glm::vec2 corner, glm::vec2 opposite_corner);
     void ClearFlags();
 };
 
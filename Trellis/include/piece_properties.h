@@ -0,0 +1,125 @@
+#ifndef PIECE_PROPERTIES_H
+#define PIECE_PROPERTIES_H
+
+#include "sqlite_handler.h"
+#include "util.h"
+
+#include <array>
+#include <bitset>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Game state attached to a piece. Every field has a dirty bit for replication and one for the
+// database, so only fields that changed are sent over the network or written to disk.
+//
+// This is a fixed set of typed fields, not a keyed store: a new property needs a Field, its
+// accessors, a case in the field serialisation and a column in the PieceProperties table, but no
+// new channel or message. One row per piece keeps saves to a single UPDATE of the dirty columns.
+class PieceProperties {
+public:
+    enum Field {
+        HP_FIELD,
+        MAX_HP_FIELD,
+        INITIATIVE_FIELD,
+        LABEL_FIELD,
+        CONDITIONS_FIELD,
+        FIELD_COUNT
+    };
+    using field_mask = std::bitset<FIELD_COUNT>;
+
+    enum Condition {
+        BLINDED,
+        CHARMED,
+        DEAFENED,
+        FRIGHTENED,
+        GRAPPLED,
+        INCAPACITATED,
+        INVISIBLE,
+        PARALYZED,
+        PETRIFIED,
+        POISONED,
+        PRONE,
+        RESTRAINED,
+        STUNNED,
+        UNCONSCIOUS,
+        CONDITION_COUNT
+    };
+
+    static const std::array<const char *, CONDITION_COUNT> ConditionNames;
+
+    static const size_t MaxLabelLength = 255;
+
+    int32_t HP() const;
+    void    SetHP(int32_t hp);
+
+    int32_t MaxHP() const;
+    void    SetMaxHP(int32_t max_hp);
+
+    int32_t Initiative() const;
+    void    SetInitiative(int32_t initiative);
+
+    const std::string &Label() const;
+    void               SetLabel(std::string label);
+
+    bool HasCondition(Condition condition) const;
+    void SetCondition(Condition condition, bool set);
+
+    // Fields changed locally since this was last called, which still need to be sent
+    field_mask TakeReplicateDirty();
+
+    // A mask byte followed by the given fields
+    std::vector<std::byte> SerializeFields(field_mask fields = field_mask().set()) const;
+
+    // Apply fields written by SerializeFields. Returns the number of bytes read, or 0 if the data
+    // is malformed. Applied fields only need to be saved, not sent on again.
+    size_t ApplyFields(const std::byte *data, size_t size);
+
+    // Only writes the fields that changed since the last write
+    void WriteToDB(const SQLite::Database &db, uint64_t piece_uid) const;
+
+    void ReadFromDB(const SQLite::Database &db, uint64_t piece_uid);
+
+    // For copies of a piece, which don't have a row of their own yet
+    void MarkUnsaved();
+
+private:
+    template<class T>
+    void set(Field field, T &member, T value) {
+        if (member == value) { return; }
+        member = std::move(value);
+        replicate_dirty.set(field);
+        persist_dirty.set(field);
+    }
+
+    int32_t     hp{};
+    int32_t     max_hp{};
+    int32_t     initiative{};
+    std::string label;
+    uint32_t    conditions{};
+
+    field_mask replicate_dirty;
+    // Everything starts dirty, so pieces that were never saved get a full row
+    mutable field_mask persist_dirty = field_mask().set();
+};
+
+// A tick's worth of property changes, for any number of pieces
+class PropertyBatch : public Util::Serializable<PropertyBatch> {
+public:
+    class Entry {
+    public:
+        uint64_t               PageUid{};
+        uint64_t               PieceUid{};
+        std::vector<std::byte> Fields;
+    };
+
+    std::vector<Entry> Entries;
+
+    std::vector<std::byte> Serialize() const override;
+
+private:
+    friend Serializable<PropertyBatch>;
+    static PropertyBatch deserialize_impl(const std::vector<std::byte> &vec);
+};
+
+#endif
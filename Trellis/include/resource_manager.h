@@ -2,15 +2,32 @@
 #define RESOURCE_MANAGER_H
 
 #include "data.h"
+#include "image_tiles.h"
 #include "shader.h"
+#include "sqlite_handler.h"
 #include "texture.h"
+#include "texture_atlas.h"
+#include "transform.h"
 
+#include <asio.hpp>
+#include <chrono>
+#include <deque>
+#include <filesystem>
 #include <glad/glad.h>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
+// A texture drawn over part of a piece, rect is the offset and size of that part
+class TileRegion {
+public:
+    std::shared_ptr<Texture2D> Texture;
+    glm::vec4                  Rect;
+};
+
 class ResourceManager {
 public:
     ResourceManager(ResourceManager const &) = delete; // Disallow copying
@@ -21,9 +38,40 @@ public:
     // resource storage
     std::unordered_map<uint64_t, Data::ImageData> Images;
 
+    // Small images are drawn from here rather than textures of their own
+    TextureAtlas Atlas;
+
+    // Only keep the mip levels of very large images that the current zoom needs
+    bool TrimLargeTextures = false;
+
+    // Recompile shaders whose files change, and swap them in for everything that uses them
+    bool WatchShaders = false;
+
+    // GPU memory that images with textures of their own may use. Over it, the least recently
+    // drawn textures that aren't on the active page are swapped for their preview, and reloaded
+    // once they are drawn again. The atlas isn't counted, it has a fixed number of pages.
+    size_t TextureBudget = 512 * 1024 * 1024;
+
+    // GPU memory the tiles of huge images may use. Tiles that were on screen last frame are kept
+    // even over it.
+    size_t TileBudget = 256 * 1024 * 1024;
+
+    // Uploads decoded images and builds mipmaps within a time budget, and applies the residency
+    // and eviction policies
+    void Update();
+
+    // The active page calls this every frame for each image its pieces use, on screen or not, so
+    // scrolling never evicts them
+    void KeepResident(uint64_t uid);
+
+    size_t ResidentTextureBytes() const;
+    // Size the evicted textures had when they were last resident
+    size_t EvictedTextureBytes() const;
+
     // loads (and generates) a sprite_shader program from file loading vertex, fragment (and
     // geometry) sprite_shader's source code. If gShaderFile is not nullptr, it also loads a
-    // geometry sprite_shader
+    // geometry sprite_shader. A name already loaded from the same files is returned as it is.
+    // Linked programs are cached in ShaderCacheDir, for as long as the source and driver match.
     std::shared_ptr<Shader> LoadShader(
         const char *       vShaderFile,
         const char *       fShaderFile,
@@ -33,11 +81,50 @@ public:
     // retrieves a stored sader
     std::shared_ptr<Shader> GetShader(const std::string &name);
 
-    // loads (and generates) a texture from file
-    std::shared_ptr<Texture2D> LoadTexture(const char *file);
+    // Adds an image file to the cache and returns its uid, or the uid of the same image if it is
+    // already cached
+    uint64_t ImportImage(const char *file);
 
+    // Returns at once, the texture stands in as a single clear texel until the image has been
+    // decoded and uploaded
     std::shared_ptr<Texture2D> GetTexture(uint64_t uid);
 
+    // Where to draw a cached image from, its place in the atlas if it is small enough. While the
+    // image is still being decoded this is its preview, if there is one, or no texture at all.
+    SpriteRegion GetSprite(uint64_t uid);
+
+    // Images whose sprite is ready or has moved since the last call, pieces using them should
+    // look their sprite up again
+    std::vector<uint64_t> TakeChangedSprites();
+
+    // Small copy of a cached image. Empty until it has been made on a worker, the first call
+    // starts it and TakeNewPreviews says when it is ready.
+    const Data::ImagePreview &GetPreview(uint64_t uid);
+
+    // Images whose preview was asked for and has been made since the last call
+    std::vector<uint64_t> TakeNewPreviews();
+
+    // Stands a received preview in for an image until the image itself is cached
+    void LoadPreview(uint64_t uid, const Data::ImagePreview &preview);
+
+    // nullptr if no preview is standing in for the image
+    std::shared_ptr<Texture2D> GetPreviewTexture(uint64_t uid);
+
+    // Tiles of huge images are kept in the database at path, which needs an ImageTiles table.
+    // Until it is open huge images are loaded whole like any other.
+    void OpenTileStore(const std::string &path);
+
+    // The tiles of a huge image the current view needs, to draw over a piece with this transform.
+    // Nothing for other images, or when the sprite alone has enough detail. Missing tiles are
+    // loaded, a coarser tile that is loaded stands in for them until then.
+    std::vector<TileRegion> VisibleTiles(uint64_t uid, const Transform &transform);
+
+    // Per-frame state every shader reads from the Globals uniform block
+    void SetProjection(const glm::mat4 &projection);
+    void SetView(const glm::mat4 &view);
+    void SetScreenResolution(const glm::vec2 &resolution);
+
+    // For uniforms outside the Globals block
     void SetGlobalFloat(const char *name, float value);
     void SetGlobalInteger(const char *name, int value);
     void SetGlobalVector2f(const char *name, const glm::vec2 &value);
@@ -49,26 +136,187 @@ public:
     void ReadFromDB(const SQLite::Database &db, uint64_t ImageUID);
 
 private:
+    // Time each frame may spend on uploads and mipmaps
+    static constexpr std::chrono::microseconds FrameBudget{4000};
+    // Uploads go through pixel buffers in bands of about this many bytes
+    static const size_t                        UploadBandSize   = 1024 * 1024;
+    static const unsigned int                  LargeTextureSize = 4096;
+    // How long a large image has to be drawn small before its top levels are dropped
+    static constexpr std::chrono::seconds TrimDelay{2};
+    static constexpr const char *ShaderCacheDir = "shader_cache";
+    static constexpr std::chrono::milliseconds ShaderPollInterval{500};
+    // Tiles being read at once, the rest are asked for again next frame if still on screen
+    static const size_t MaxTileLoads = 8;
+
     // private constructor, that is we do not want any actual resource manager objects. Its members
     // and functions should be publicly available (static).
     ResourceManager() {}
 
     ~ResourceManager();
 
-    // loads and generates a sprite_shader from file
-    std::shared_ptr<Shader> loadShaderFromFile(
-        const char *vShaderFile,
-        const char *fShaderFile,
-        const char *gShaderFile = nullptr);
+    // Where a shader was loaded from. Geometry is empty if it has no geometry stage.
+    class shader_files {
+    public:
+        std::string                     Vertex;
+        std::string                     Fragment;
+        std::string                     Geometry;
+        std::filesystem::file_time_type Modified{};
+
+        std::filesystem::file_time_type LastModified() const;
+    };
+
+    // loads and generates a sprite_shader from file, or from the program cache if it has been
+    // linked before
+    std::shared_ptr<Shader> loadShaderFromFile(const std::string &name, const shader_files &files);
 
-    // loads a single texture from file
-    std::shared_ptr<Texture2D> loadTextureFromFile(const char *file);
+    void reload_changed_shaders();
 
-    // loads a single texture from a cached texture uid
-    std::shared_ptr<Texture2D> loadTextureFromUID(uint64_t uid);
+    // Pixels decoded on a worker thread
+    class decoded {
+    public:
+        uint64_t                   Uid{};
+        int                        Width{};
+        int                        Height{};
+        int                        Channels{};
+        std::vector<unsigned char> Pixels;
+        Data::ImagePreview         Preview;
+        // Only the preview was wanted, the image isn't going anywhere
+        bool PreviewOnly = false;
+    };
+
+    // Contents of the Globals uniform block, in its std140 layout
+    class globals {
+    public:
+        glm::mat4 Projection = glm::mat4(1.0f);
+        glm::mat4 View       = glm::mat4(1.0f);
+        glm::vec2 ScreenRes{};
+        glm::vec2 Padding{};
+    };
+
+    // A decoded image on its way into a texture of its own. It is streamed into Staging a band
+    // at a time, and only swapped into Target once it is complete.
+    class upload {
+    public:
+        decoded                    Image;
+        std::shared_ptr<Texture2D> Target;
+        std::shared_ptr<Texture2D> Staging;
+        int                        Row = 0;
+    };
+
+    class resident_tile {
+    public:
+        std::shared_ptr<Texture2D> Texture;
+        uint64_t                   LastDrawn{};
+    };
+
+    // A huge image, and those of its tiles that are on the GPU or on their way
+    class tiled_image {
+    public:
+        ImageTiles Layout;
+        uint64_t   Hash{};
+        // Its top level has been placed, so every level is in the database
+        bool                                        Ready = false;
+        std::unordered_map<uint64_t, resident_tile> Resident;
+        std::unordered_set<uint64_t>                Loading;
+    };
+
+    class decoded_tile {
+    public:
+        uint64_t                   Uid{};
+        uint64_t                   Key{};
+        glm::ivec2                 Extent{};
+        std::vector<unsigned char> Pixels;
+    };
+
+    // nullptr unless the image is big enough to be tiled
+    tiled_image *find_tiled(uint64_t uid);
+
+    // Decode the top level of a tiled image, building its tiles first if they aren't stored yet
+    void decode_tiled(
+        uint64_t                                          uid,
+        const tiled_image &                               tiled,
+        std::shared_ptr<const std::vector<unsigned char>> bytes,
+        bool                                              make_preview);
+
+    void load_tile(uint64_t uid, tiled_image &tiled, int level, int x, int y);
+
+    void place_tile(decoded_tile &&tile);
+
+    // Drop the least recently drawn tiles over the budget
+    void evict_tiles();
+
+    // Decode an image on a worker thread, once however often it is asked for
+    void decode(uint64_t uid);
+
+    // Decode an image on a worker thread just to make its preview
+    void decode_preview(uint64_t uid);
+
+    // Put a decoded image in the atlas, or queue its upload
+    void place(decoded &&image);
+
+    // Stream the next band of an upload, true once it is complete
+    bool upload_band(upload &job);
 
     std::unordered_map<std::string, std::shared_ptr<Shader>> Shaders;
+    std::unordered_map<std::string, shader_files>            shader_sources;
+    std::chrono::steady_clock::time_point                    last_shader_poll;
     std::unordered_map<uint64_t, std::shared_ptr<Texture2D>> Textures;
+    std::unordered_map<uint64_t, Data::ImagePreview>         Previews;
+    // Dropped as soon as the full texture is loaded
+    std::unordered_map<uint64_t, std::shared_ptr<Texture2D>> PreviewTextures;
+
+    std::deque<std::weak_ptr<Texture2D>>                                mipmap_queue;
+    std::unordered_map<uint64_t, std::chrono::steady_clock::time_point> trim_since;
+    // Frame each texture was last drawn in, and the size of the evicted ones
+    std::unordered_map<uint64_t, uint64_t> last_drawn;
+    // Images on the active page as of the last frame
+    std::unordered_set<uint64_t> active_page, next_active_page;
+    std::unordered_map<uint64_t, size_t>   evicted;
+    uint64_t                               frame          = 0;
+    size_t                                 resident_bytes = 0;
+
+    globals      global_state;
+    unsigned int globals_UBO = 0;
+
+    asio::thread_pool            workers{2};
+    std::mutex                   decoded_mtx;
+    std::vector<decoded>         decoded_images;
+    std::unordered_set<uint64_t> decoding;
+    // Asked for, but nothing better than a stand-in to draw yet
+    std::unordered_set<uint64_t> loading;
+    // Previews asked for that aren't made yet, and those made since TakeNewPreviews
+    std::unordered_set<uint64_t> previewing;
+    std::vector<uint64_t>        new_previews;
+    std::deque<decoded>          ready;
+    std::deque<upload>           uploads;
+    unsigned int                 upload_PBOs[2]{};
+    size_t                       next_PBO = 0;
+    std::vector<uint64_t>        changed;
+
+    // Workers read and write tiles through a connection of their own
+    std::unique_ptr<SQLite::Database>         tile_db;
+    std::mutex                                tile_db_mtx;
+    std::unordered_map<uint64_t, tiled_image> tiled_images;
+    std::vector<decoded_tile>                 decoded_tiles;
+    std::deque<decoded_tile>                  ready_tiles;
+    size_t                                    tile_loads       = 0;
+    size_t                                    tile_bytes       = 0;
+    int                                       max_texture_size = 0;
+
+    // Copy part of the globals to the uniform buffer, creating it the first time
+    void upload_globals(size_t offset, size_t size);
+
+    // Drop textures nothing holds any more, and evict what is over budget
+    void update_cache();
+
+    // Swap a texture's storage for its preview
+    void evict(uint64_t uid, Texture2D &texture);
+
+    void update_residency(
+        uint64_t                              uid,
+        Texture2D &                           texture,
+        float                                 drawn,
+        std::chrono::steady_clock::time_point now);
 };
 
 #endif
@@ -0,0 +1,84 @@
+#ifndef SESSION_LOG_H
+#define SESSION_LOG_H
+
+#include <chrono>
+#include <cstddef>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+// Binary log of the frames a host or client exchanged during a session. The file starts with a
+// magic, a version and the role that recorded it, followed by one record per frame:
+//   int64 micros since start | uint8 direction | uint64 uid | uint8 channel length | channel |
+//   uint32 data length | data
+class SessionLog {
+public:
+    static constexpr char Magic[4] = {'T', 'R', 'L', 'S'};
+    static const uint32_t Version  = 1;
+
+    enum Direction : uint8_t { IN, OUT };
+    enum Role : uint8_t { HOST, CLIENT };
+
+    class Record {
+    public:
+        int64_t                Micros{};
+        Direction              Dir{};
+        uint64_t               Uid{};
+        std::string            Channel;
+        std::vector<std::byte> Data;
+    };
+};
+
+class SessionRecorder {
+public:
+    SessionRecorder(SessionRecorder const &) = delete; // Disallow copying
+    void operator=(SessionRecorder const &) = delete;
+
+    // Returns nullptr if the file couldn't be created
+    static std::unique_ptr<SessionRecorder> Create(const std::string &path, SessionLog::Role role);
+
+    // Safe to call from the networking threads
+    void Write(
+        SessionLog::Direction         dir,
+        uint64_t                      uid,
+        const std::string &           channel,
+        const std::vector<std::byte> &data);
+
+private:
+    SessionRecorder() = default;
+
+    std::ofstream                         out;
+    std::mutex                            mtx;
+    std::chrono::steady_clock::time_point start;
+};
+
+class SessionReader {
+public:
+    SessionReader(SessionReader const &) = delete; // Disallow copying
+    void operator=(SessionReader const &) = delete;
+
+    // Returns nullptr if the file can't be opened or isn't a session log
+    static std::unique_ptr<SessionReader> Open(const std::string &path);
+
+    SessionLog::Role Role() const;
+
+    // The record Next will return, without consuming it
+    const SessionLog::Record *Peek();
+
+    // Nothing once the end of the log, or a truncated record, is reached
+    std::optional<SessionLog::Record> Next();
+
+private:
+    SessionReader() = default;
+
+    std::optional<SessionLog::Record> read_record();
+
+    std::ifstream                     in;
+    SessionLog::Role                  role{};
+    std::optional<SessionLog::Record> peeked;
+};
+
+#endif
@@ -4,18 +4,33 @@
 #include <glad/glad.h>
 #include <glm/glm.hpp>
 #include <glm/gtc/type_ptr.hpp>
-#include <string>
 #include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 // General purpsoe sprite_shader object. Compiles from file, generates
 // compile/link-time error messages and hosts several utility
 // functions for easy management.
 class Shader {
 public:
+    // Binding point of the Globals uniform block, the per-frame state every shader shares
+    static const unsigned int GlobalsBinding = 0;
+
     static std::shared_ptr<Shader> Create(
         const char *vertexSource,
         const char *fragmentSource,
         const char *geometrySource = nullptr);
+
+    // Load a program saved with Binary. nullptr if the driver won't take it, e.g. because it was
+    // updated since.
+    static std::shared_ptr<Shader> CreateFromBinary(
+        unsigned int                      format,
+        const std::vector<unsigned char> &binary);
+
+    // Needs GL 4.1 or ARB_get_program_binary, which most 3.3 drivers have
+    static bool ProgramBinariesSupported();
+
     ~Shader();
     Shader(const Shader &) = delete;
     Shader &operator=(const Shader &) = delete;
@@ -23,6 +38,15 @@ public:
     // sets the current sprite_shader as active
     Shader &Use();
 
+    bool Linked() const;
+
+    // The linked program in the driver's own format. Empty if that isn't supported.
+    std::vector<unsigned char> Binary(unsigned int &format) const;
+
+    // Trade programs with another shader, so a reloaded program replaces this one for everything
+    // that holds it
+    void Swap(Shader &other);
+
     // utility functions
     void SetFloat(const char *name, float value);
 
@@ -46,7 +70,11 @@ public:
 
 private:
     // state
-    unsigned int ID;
+    unsigned int ID{};
+    // Locations of the program's uniforms outside blocks, read once it is linked
+    std::unordered_map<std::string, int> uniforms;
+
+    Shader() = default;
 
     Shader(
         const char *vertexSource,
@@ -54,6 +82,11 @@ private:
         const char *geometrySource = nullptr);
     // checks if compilation or linking failed and if so, print the error logs
     void checkCompileErrors(unsigned int object, std::string type);
+
+    void reflect();
+
+    // -1 if the program has no such uniform, which glUniform ignores
+    int location(const char *name) const;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,76 @@
+#ifndef SHARED_MEMORY_H
+#define SHARED_MEMORY_H
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+// A named block of memory that can be mapped by other processes on the same machine
+class SharedSegment {
+public:
+    SharedSegment(SharedSegment const &) = delete; // Disallow copying
+    void operator=(SharedSegment const &) = delete;
+
+    ~SharedSegment();
+
+    // Both return nullptr if the segment couldn't be created or mapped
+    static std::unique_ptr<SharedSegment> Create(const std::string &name, size_t size);
+
+    static std::unique_ptr<SharedSegment> Open(const std::string &name);
+
+    std::byte *Data() const;
+
+    size_t Size() const;
+
+private:
+    SharedSegment() = default;
+
+    std::string name;
+    std::byte * data  = nullptr;
+    size_t      size  = 0;
+    bool        owner = false;
+#ifdef _WIN32
+    void *handle = nullptr;
+#endif
+};
+
+// Single producer, single consumer byte ring in a shared segment. Records are written whole and
+// contiguous, and their position is passed to the reader out of band, so the ring only has to
+// track how far the reader has got.
+class SharedRing {
+public:
+    static const size_t DefaultCapacity = 64 * 1024 * 1024;
+
+    static std::unique_ptr<SharedRing>
+    Create(const std::string &name, size_t capacity = DefaultCapacity);
+
+    static std::unique_ptr<SharedRing> Open(const std::string &name);
+
+    // Copy a record into the ring, returning its position or nothing if there is no room
+    std::optional<uint64_t> Write(const std::byte *bytes, size_t len);
+
+    // Copy out the record at pos and release it, along with everything written before it
+    std::optional<std::vector<std::byte>> Read(uint64_t pos, size_t len);
+
+    const std::string &Name() const;
+
+private:
+    class Control {
+    public:
+        std::atomic<uint64_t> Tail;
+        uint64_t              Capacity;
+    };
+
+    SharedRing(std::string name, std::unique_ptr<SharedSegment> segment);
+
+    std::string                    name;
+    std::unique_ptr<SharedSegment> segment;
+    Control *                      control;
+    std::byte *                    ring;
+    uint64_t                       head = 0;
+};
+
+#endif
@@ -0,0 +1,72 @@
+#ifndef SPATIAL_INDEX_H
+#define SPATIAL_INDEX_H
+
+#include "game_object.h"
+#include "transform.h"
+
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <list>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+// Uniform grid over a page's pieces, so finding the ones under the mouse or on screen only looks
+// at the pieces nearby. It also keeps their stacking order, results come out topmost first.
+class SpatialIndex {
+public:
+    using piece_it = std::list<std::unique_ptr<GameObject>>::iterator;
+
+    // Pieces covering more cells than this are kept apart and checked by every query
+    static const int MaxCellsPerPiece = 256;
+
+    explicit SpatialIndex(float cell_size);
+
+    SpatialIndex(const SpatialIndex &) = delete;
+    SpatialIndex &operator=(const SpatialIndex &) = delete;
+
+    // The piece goes on top of everything else
+    void Insert(piece_it piece);
+
+    // Call after the piece's transform changes
+    void Update(const GameObject &piece);
+
+    void Remove(uint64_t uid);
+
+    // Restack pieces above or below everything else, keeping their order among themselves. The
+    // first uid is the topmost.
+    void Raise(const std::vector<uint64_t> &uids);
+    void Lower(const std::vector<uint64_t> &uids);
+
+    // Pieces whose bounds overlap the rect, topmost first
+    std::vector<piece_it> Query(glm::vec2 min, glm::vec2 max) const;
+
+private:
+    class entry {
+    public:
+        piece_it   Piece;
+        glm::ivec4 Cells{}; // <first cell, last cell>
+        int64_t    Depth{};
+        // Last query that saw the entry, so pieces spanning cells are only reported once
+        mutable uint64_t Stamp{};
+    };
+
+    glm::ivec2 cell(glm::vec2 pos) const;
+    glm::ivec4 cells_of(const Transform &transform) const;
+
+    static bool     is_large(const glm::ivec4 &cells);
+    static uint64_t key(int x, int y);
+
+    void link(entry &e);
+    void unlink(entry &e);
+
+    float                                              cell_size;
+    std::unordered_map<uint64_t, entry>                entries;
+    std::unordered_map<uint64_t, std::vector<entry *>> cells;
+    std::vector<entry *>                               large;
+    int64_t                                            top    = 0;
+    int64_t                                            bottom = 0;
+    mutable uint64_t                                   stamp  = 0;
+};
+
+#endif
@@ -0,0 +1,75 @@
+#ifndef SPRITE_BATCH_H
+#define SPRITE_BATCH_H
+
+#include "shader.h"
+#include "texture.h"
+#include "transform.h"
+
+#include <glm/glm.hpp>
+#include <memory>
+#include <vector>
+
+// Draws a page's sprites with as few GL calls as possible. Sprites are queued in draw order every
+// frame, and each run of consecutive sprites sharing a texture goes out as one instanced draw.
+class SpriteBatch {
+public:
+    SpriteBatch();
+
+    ~SpriteBatch();
+
+    SpriteBatch(const SpriteBatch &) = delete;
+    SpriteBatch &operator=(const SpriteBatch &) = delete;
+
+    // uv_rect is the offset and size of the part of the texture to draw
+    void Add(
+        const std::shared_ptr<Texture2D> &texture,
+        const Transform &                 transform,
+        bool                              border,
+        const glm::vec3 &                 tint    = glm::vec3(1),
+        const glm::vec4 &                 uv_rect = glm::vec4(0, 0, 1, 1));
+
+    // Draw a whole texture over part of a sprite, rect is the offset and size of that part
+    void AddPart(
+        const std::shared_ptr<Texture2D> &texture,
+        const Transform &                 transform,
+        const glm::vec4 &                 rect);
+
+    // Just the border of a sprite, over whatever was drawn inside it
+    void AddOutline(const Transform &transform);
+
+    // Draw everything added since the last flush, and start over
+    void Flush(const glm::mat4 &view, int border_width);
+
+private:
+    // Matches the per instance attributes in sprite.vert
+    class instance {
+    public:
+        glm::mat4 Model;
+        glm::vec4 UVRect;
+        // Tint in rgb, 1 in w for a border, 2 for only the border
+        glm::vec4 TintBorder;
+    };
+
+    class run {
+    public:
+        std::shared_ptr<Texture2D> Texture;
+        size_t                     Count;
+        // Largest side of any sprite in the run, in world units
+        float Extent;
+    };
+
+    void push(const std::shared_ptr<Texture2D> &texture, const instance &sprite, float extent);
+
+    // Point the per instance attributes at the instance buffer, starting from first
+    void point_instances(size_t first);
+
+    std::shared_ptr<Shader> shader;
+    std::vector<instance>   instances;
+    std::vector<run>        runs;
+    size_t                  capacity = 0;
+    unsigned int            quad_VAO{};
+    unsigned int            quad_VBO{};
+    unsigned int            instance_VBO{};
+};
+
+#endif // SPRITE_BATCH_H
@@ -4,6 +4,7 @@
 #include <cstdint>
 #include <glad/glad.h>
 #include <memory>
+#include <vector>
 
 #include "sqlite_handler.h"
 
@@ -36,10 +37,45 @@ public:
     unsigned int Wrap_T;     // wrapping mode on T axis
     unsigned int Filter_Min; // filtering mode if texture pixels < screen pixels
     unsigned int Filter_Max; // filtering mode if texture pixels > screen pixels
+    unsigned int Max_Level;  // smallest mip level to generate, atlases stop before tiles blend
 
     // binds the texture as the current active GL_TEXTURE_2D texture object
     void Bind() const;
 
+    // Sample the edge texels past the border rather than wrapping around, for textures that are
+    // drawn side by side
+    void ClampToEdge();
+
+    // Replace part of the texture, data is in Image_Format
+    void Update(int x, int y, int width, int height, const unsigned char *data);
+
+    // Copy the whole texture back out of the GPU, in Image_Format
+    std::vector<unsigned char> Read() const;
+
+    // Build the mip chain and switch to trilinear filtering. Until then only level 0 is sampled.
+    void GenerateMipmaps();
+    bool Mipmapped() const;
+
+    // Number of mip levels a full chain has
+    int Levels() const;
+
+    // Free the levels above level, by making it the new level 0. Needs mipmaps.
+    void DropLevels(int level);
+
+    // Trade GPU storage with another texture, so a finished upload can replace what was drawn
+    // until then. Everything that refers to this texture picks it up.
+    void SwapStorage(Texture2D &other);
+
+    // First level still in memory, relative to the full size image
+    int ResidentLevel() const;
+
+    // GPU memory used by the resident levels
+    size_t Bytes() const;
+
+    // Sprite batches note the largest size, in screen pixels, the texture was drawn at
+    void NoteDrawn(float screen_pixels);
+    float TakeDrawnSize();
+
 private:
     Texture2D(
         unsigned int   height,
@@ -50,6 +86,12 @@ private:
         unsigned int   image_format    = GL_RGB);
 
     unsigned int ID{};
+    bool         mipmapped      = false;
+    int          resident_level = 0;
+    float        drawn_size     = 0;
+
+    // Define level 0 and point the sampler at it alone
+    void upload(unsigned int width, unsigned int height, const unsigned char *data);
 };
 
 #endif
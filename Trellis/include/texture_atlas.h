@@ -0,0 +1,86 @@
+#ifndef TEXTURE_ATLAS_H
+#define TEXTURE_ATLAS_H
+
+#include "texture.h"
+
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <memory>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+// The part of a texture a sprite is drawn from, as the offset and size of its UV rect
+class SpriteRegion {
+public:
+    std::shared_ptr<Texture2D> Texture;
+    glm::vec4                  UVRect = glm::vec4(0, 0, 1, 1);
+};
+
+// Packs small images into a few large textures, so pieces using different images still share a
+// texture and draw together. Every entry hands out its own handle to its page, which is how the
+// atlas tells which images are still in use once it runs out of room.
+class TextureAtlas {
+public:
+    static const int PageSize     = 2048;
+    static const int MaxImageSize = 512;
+    static const int MaxPages     = 4;
+
+    TextureAtlas();
+
+    ~TextureAtlas();
+
+    TextureAtlas(const TextureAtlas &) = delete;
+    TextureAtlas &operator=(const TextureAtlas &) = delete;
+
+    std::optional<SpriteRegion> Find(uint64_t uid) const;
+
+    // Add an RGBA image. Nothing if it is too big for the atlas, or there is no room for it even
+    // after unused images have been dropped and a page repacked.
+    std::optional<SpriteRegion>
+    Insert(uint64_t uid, const unsigned char *rgba, int width, int height);
+
+    // Images that were moved by a repack. Pieces using them draw from the old page until they
+    // look their sprite up again.
+    std::vector<uint64_t> TakeMoved();
+
+    // Pages changed since the last call, which need their mipmaps rebuilt
+    std::vector<std::shared_ptr<Texture2D>> TakeDirty();
+
+private:
+    // Transparent border around every image, so filtering never picks up a neighbour. Mipmaps
+    // stop at the level where it is down to a single texel.
+    static const int Padding  = 2;
+    static const int MaxLevel = 1;
+
+    class entry {
+    public:
+        size_t                     Page{};
+        int                        X{};
+        int                        Y{};
+        int                        Width{};
+        int                        Height{};
+        std::shared_ptr<Texture2D> Handle;
+    };
+
+    class page;
+
+    // Find room for an image on a page and upload it there
+    bool place(uint64_t uid, size_t page_index, const unsigned char *rgba, int width, int height);
+
+    // Forget images no piece uses any more, and start over on pages left empty
+    void drop_unused();
+
+    // Pack the images still in use on a page into a new texture, leaving the old one to the
+    // pieces that still hold it
+    void repack(size_t page_index);
+
+    SpriteRegion region(const entry &e) const;
+
+    std::vector<std::unique_ptr<page>>      pages;
+    std::unordered_map<uint64_t, entry>     entries;
+    std::vector<uint64_t>                   moved;
+    std::vector<std::shared_ptr<Texture2D>> dirty;
+};
+
+#endif
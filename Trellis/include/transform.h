@@ -11,6 +11,9 @@ public:
 
     Transform();
     Transform(const glm::vec2 &position, const glm::vec2 &scale, float rotation);
+
+    // Maps the unit quad onto the transform, rotating about its center
+    glm::mat4 Model() const;
 };
 
 #endif // TRANSFORM_H
@@ -52,6 +52,7 @@ private:
     bool scroll_to_bottom = false;
     bool chat_open        = true;
     bool http_window_open = true;
+    bool conditioner_open = false;
 
     void draw_main_node(Page::page_list_t &pages, Page::page_list_it_t &active_page);
     void draw_page_select(Page::page_list_t &pages, Page::page_list_it_t &active_page);
@@ -59,6 +60,7 @@ private:
     void draw_chat();
     void draw_client_list();
     void draw_http_window();
+    void draw_network_conditioner();
     void draw_query_response(const std::string &query_type, std::string r = "");
 
     void send_msg(Data::ChatMessage::MsgTypeEnum msg_type = Data::ChatMessage::CHAT);
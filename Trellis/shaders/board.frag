@@ -1,68 +1,40 @@
 #version 330 core
 in vec2 TexCoords;
-in mat4 inv;
 out vec4 color;
 
-uniform ivec2 num_cells;
-uniform vec2 screenRes;
 uniform vec3 bg_color;
 uniform vec3 line_color;
 uniform float line_width;
 
-float line(float a, float b) {
-    float c1 = fract(a);
-    float c2 = fract(b);
-    int f1 = int(floor(a));
-    int f2 = int(floor(b));
+// Zoomed out, every this many lines of a level are kept as the level above
+const float lod_base = 5.0;
+// Lines closer together than this many pixels start to fade into the level above, which takes
+// over completely once they are lod_base times closer
+const float min_spacing = 8.0;
 
-    bool b1 = c1 <= line_width/2 || c1 >= 1 - line_width/2;
-    bool b2 = c2 <= line_width/2 || c2 >= 1 - line_width/2;
-    float d;
-    if (f1 != f2) {
-        d = (1 - c1) + c2;
-        if (abs(f1-f2) > 1 || d > 1) {
-            return 1;
-        }
-        if (b1) {
-            if (b2) {
-                return 1;
-            }
-            float x = (1 - c1) + line_width/2;
-            return x/d;
-        }
-        if (b2) {
-            float x = line_width/2 + c2;
-            return x/d;
-        }
-        float x = line_width;
-        return x/d;
-    }
-    d = c2 - c1;
-    if (d > 1) {
-        return 1;
-    }
-    if (b1) {
-        if (b2) {
-            return 1;
-        } else {
-            float x = line_width/2 - c1;
-            return x/d;
-        }
-    }
-    if (b2) {
-        float x = c2 + line_width/2 - 1;
-        return x/d;
-    }
-    return 0;
+// Coverage of this pixel by lines of the given width at every whole coord, filtered over the
+// pixel's footprint so lines thinner than a pixel fade rather than break up into moire
+float grid(vec2 coord, vec2 deriv, float width) {
+    vec2 draw_width = clamp(vec2(width), deriv, vec2(0.5));
+    vec2 aa = deriv * 1.5;
+    vec2 dist = 1.0 - abs(fract(coord) * 2.0 - 1.0);
+    vec2 g = smoothstep(draw_width + aa, draw_width - aa, dist);
+    g *= clamp(width / draw_width, 0.0, 1.0);
+    // Many lines to a pixel average out to the share of the cell they cover
+    g = mix(g, vec2(width), clamp(deriv * 2.0 - 1.0, 0.0, 1.0));
+    return mix(g.x, 1.0, g.y);
 }
 
 void main() {
-    vec2 coord = TexCoords.xy;
-    vec2 fs = (vec2(gl_FragCoord.x + 1, gl_FragCoord.y - 1)/ screenRes) * 2 - 1;
-    vec2 mf = (inv * vec4(fs.xy, 0, 1)).xy * num_cells;
+    // Cells per pixel, measured along whichever axis is more squashed
+    vec2 deriv = fwidth(TexCoords);
+    float pixels = 1.0 / max(max(deriv.x, deriv.y), 1e-6);
+    float lod = max(log(min_spacing / pixels) / log(lod_base), 0.0);
+    float spacing = pow(lod_base, floor(lod));
+    float next = spacing * lod_base;
 
-    float lx = line(coord.x, mf.x);
-    float ly = line(coord.y, mf.y);
-    float l = max(lx, ly);
-    color = vec4(l * line_color + (1-l) * bg_color, 1);
-}
\ No newline at end of file
+    float fine = grid(TexCoords / spacing, deriv / spacing, line_width);
+    float coarse = grid(TexCoords / next, deriv / next, line_width);
+    float l = max(fine * (1.0 - fract(lod)), coarse * fract(lod));
+    color = vec4(mix(bg_color, line_color, l), 1);
+}
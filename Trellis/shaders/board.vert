@@ -2,16 +2,16 @@
 layout (location = 0) in vec4 vertex; // <vec2 position, vec2 texCoords>
 
 out vec2 TexCoords;
-out mat4 inv;
 
+layout (std140) uniform Globals {
+    mat4 projection;
+    mat4 view;
+    vec2 screenRes;
+};
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
 uniform ivec2 num_cells;
 
 void main() {
     TexCoords = vertex.zw * num_cells;
-    mat4 mat = projection * view * model;
-    inv = inverse(mat);
-    gl_Position = mat * vec4(vertex.xy, 0.0, 1.0);
-}
\ No newline at end of file
+    gl_Position = projection * view * model * vec4(vertex.xy, 0.0, 1.0);
+}
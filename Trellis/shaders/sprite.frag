@@ -1,14 +1,15 @@
 #version 330 core
 in vec2 TexCoords;
 in vec4 screen_corners;
+flat in vec3 spriteColor;
+flat in int border;
 out vec4 color;
 
 uniform sampler2D image;
-uniform vec3 spriteColor;
 uniform int border_width;
 
 void main() {
-	if (border_width == 0) {
+	if (border == 0) {
 		color = vec4(spriteColor, 1.0) * texture(image, TexCoords);
 		return;
 	}
@@ -19,6 +20,10 @@ void main() {
         color = vec4(0.0, 0.5, 0.5, 1.0);
         return;
     }
+    // An outline over a sprite that was drawn in parts
+    if (border == 2) {
+        discard;
+    }
     color = vec4(spriteColor, 1.0) * texture(image, TexCoords);
 
 }  
\ No newline at end of file
@@ -1,16 +1,25 @@
 #version 330 core
 layout (location = 0) in vec4 vertex; // <vec2 position, vec2 texCoords>
+// Per instance
+layout (location = 1) in mat4 model;
+layout (location = 5) in vec4 uv_rect; // <vec2 offset, vec2 size>
+layout (location = 6) in vec4 tint; // <vec3 color, float border>
 
 out vec2 TexCoords;
 out vec4 screen_corners;
+flat out vec3 spriteColor;
+flat out int border;
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
-uniform vec2 screenRes;
+layout (std140) uniform Globals {
+    mat4 projection;
+    mat4 view;
+    vec2 screenRes;
+};
 
 void main() {
-    TexCoords = vertex.zw;
+    TexCoords = uv_rect.xy + vertex.zw * uv_rect.zw;
+    spriteColor = tint.rgb;
+    border = int(tint.w);
     mat4 mat = projection * view * model;
     gl_Position = mat * vec4(vertex.xy, 0.0, 1.0);
     screen_corners = vec4(screenRes.xy, screenRes.xy) * (vec4(
@@ -0,0 +1,66 @@
+#include "asset_fetcher.h"
+#include "client_server.h"
+
+using std::vector, std::shared_ptr, std::chrono::steady_clock;
+
+AssetFetcher &
+AssetFetcher::GetInstance() {
+    static AssetFetcher instance; // Guaranteed to be destroyed.
+    // Instantiated on first use.
+    return instance;
+}
+
+shared_ptr<Texture2D>
+AssetFetcher::Placeholder() {
+    if (!placeholder) {
+        // A single translucent grey texel, stretched over the piece
+        unsigned char texel[] = {128, 128, 128, 160};
+        placeholder           = Texture2D::Create(1, 1, texel, 0, GL_RGBA, GL_RGBA);
+    }
+    return placeholder;
+}
+
+void
+AssetFetcher::Request(uint64_t sprite_uid, uint64_t page_uid, uint64_t piece_uid) {
+    auto [it, inserted] = in_flight.try_emplace(sprite_uid);
+    it->second.Waiting.emplace_back(page_uid, piece_uid);
+    if (inserted) { send_request(sprite_uid, it->second); }
+}
+
+vector<AssetFetcher::piece_ref>
+AssetFetcher::Arrived(uint64_t sprite_uid) {
+    auto it = in_flight.find(sprite_uid);
+    if (it == in_flight.end()) { return {}; }
+    auto waiting = std::move(it->second.Waiting);
+    in_flight.erase(it);
+    return waiting;
+}
+
+const vector<AssetFetcher::piece_ref> &
+AssetFetcher::Waiting(uint64_t sprite_uid) const {
+    static const vector<piece_ref> none;
+    auto                           it = in_flight.find(sprite_uid);
+    return it == in_flight.end() ? none : it->second.Waiting;
+}
+
+void
+AssetFetcher::Progress(uint64_t sprite_uid) {
+    auto it = in_flight.find(sprite_uid);
+    if (it != in_flight.end()) { it->second.Requested = steady_clock::now(); }
+}
+
+void
+AssetFetcher::Update() {
+    auto now = steady_clock::now();
+    for (auto &[sprite_uid, f] : in_flight) {
+        if (now - f.Requested >= RetryInterval) { send_request(sprite_uid, f); }
+    }
+}
+
+void
+AssetFetcher::send_request(uint64_t sprite_uid, fetch &f) {
+    f.Requested = steady_clock::now();
+    if (!ClientServer::Started()) { return; }
+    ClientServer &cs = ClientServer::GetInstance();
+    cs.ChannelPublish("IMAGE_REQUEST", cs.uid, sprite_uid);
+}
@@ -1,14 +1,17 @@
 #include "board.h"
+#include "asset_fetcher.h"
 #include "gui.h"
 #include "client_server.h"
 #include "data.h"
 #include "game_object.h"
 #include "glfw_handler.h"
+#include "metrics.h"
 #include "page.h"
 #include "resource_manager.h"
 #include "util.h"
 #include "state_manager.h"
 
+#include <chrono>
 #include <functional>
 #include <iostream>
 #include <utility>
@@ -16,18 +19,18 @@
 using std::unique_ptr, std::make_unique, std::make_pair, std::ref, std::move, std::string,
     std::to_string, std::find_if;
 
-using Data::ImageData, Data::NetworkData;
+using Data::ImageData, Data::ImagePreview, Data::NetworkData;
 
 void
 Board::esc_callback() {
-    static StateManager &   sm   = StateManager::GetInstance();
-    static GLFW &           glfw = GLFW::GetInstance();
-    static ResourceManager &rm   = ResourceManager::GetInstance();
+    static StateManager &sm   = StateManager::GetInstance();
+    static GLFW &        glfw = GLFW::GetInstance();
     if (ActivePage != Pages.end() && (*ActivePage)->Deselect()) { return; }
     // TODO: Check if this is a client or server, only save on server
     // TOOD: Also, move save initiation to a better location
+    auto save_start = std::chrono::steady_clock::now();
     WriteToDB(sm.getDatabase());
-    rm.WriteToDB(sm.getDatabase());
+    Metrics::GetInstance().RecordDbSave(std::chrono::steady_clock::now() - save_start);
 
     glfw.SetWindowShouldClose(1);
 }
@@ -44,8 +47,9 @@ Board::mouse_pos_callback(double x, double y) {
 }
 
 void
-Board::left_click_press() {
-    LeftClick = Board::PRESS;
+Board::left_click_press(int mods) {
+    LeftClick  = Board::PRESS;
+    ShiftClick = mods & GLFW_MOD_SHIFT;
 }
 
 void
@@ -95,6 +99,20 @@ Board::delete_press() {
     if (ActivePage != Pages.end()) { (*ActivePage)->DeleteCurrentSelection(); }
 }
 
+void
+Board::copy_press(int mods) {
+    if (ActivePage != Pages.end() && (mods & GLFW_MOD_CONTROL)) {
+        Clipboard = (*ActivePage)->CopySelection();
+    }
+}
+
+void
+Board::paste_press(int mods) {
+    if (ActivePage != Pages.end() && (mods & GLFW_MOD_CONTROL)) {
+        (*ActivePage)->Paste(Clipboard);
+    }
+}
+
 void
 Board::snap_callback(int action) {
     if (ActivePage != Pages.end()) {
@@ -119,9 +137,6 @@ Board::Board(string name, uint64_t uid, bool is_client)
     init_objects();
     // Set projection matrix
     set_projection();
-    glm::mat4        view = glm::mat4(1.0f);
-    ResourceManager &rm   = ResourceManager::GetInstance();
-    rm.SetGlobalMatrix4("view", view);
 
     register_network_callbacks();
     if (!is_client) { SendNewPage("Default"); }
@@ -168,6 +183,16 @@ Board::RegisterKeyCallbacks() {
     glfw.RegisterWindowSizeCallback(
         [this](int width, int height) { this->window_size_callback(width, height); });
     glfw.RegisterKeyPress(GLFW_KEY_ESCAPE, [this](int, int, int, int) { this->esc_callback(); });
+    glfw.RegisterMousePosCallback([this](double x, double y) { this->mouse_pos_callback(x, y); });
+    glfw.RegisterScroll([this](double, double yoffset) { this->scroll_callback(yoffset); });
+    glfw.RegisterMousePress(GLFW_MOUSE_BUTTON_MIDDLE, [this](int, int, int) {
+        this->middle_click_press();
+    });
+    glfw.RegisterMouseRelease(GLFW_MOUSE_BUTTON_MIDDLE, [this](int, int, int) {
+        this->middle_click_release();
+    });
+    // Spectators can pan and zoom, but nothing that would edit the board
+    if (ClientServer::Started() && ClientServer::GetInstance().Spectator) { return; }
     glfw.RegisterKeyPress(GLFW_KEY_RIGHT, [this](int key, int, int, int) {
         this->arrow_press(key);
     });
@@ -178,10 +203,8 @@ Board::RegisterKeyCallbacks() {
         this->arrow_press(key);
     });
     glfw.RegisterKeyPress(GLFW_KEY_UP, [this](int key, int, int, int) { this->arrow_press(key); });
-    glfw.RegisterMousePosCallback([this](double x, double y) { this->mouse_pos_callback(x, y); });
-    glfw.RegisterScroll([this](double, double yoffset) { this->scroll_callback(yoffset); });
-    glfw.RegisterMousePress(GLFW_MOUSE_BUTTON_LEFT, [this](int, int, int) {
-        this->left_click_press();
+    glfw.RegisterMousePress(GLFW_MOUSE_BUTTON_LEFT, [this](int, int, int mods) {
+        this->left_click_press(mods);
     });
     glfw.RegisterMouseRelease(GLFW_MOUSE_BUTTON_LEFT, [this](int, int, int) {
         this->left_click_release();
@@ -192,16 +215,12 @@ Board::RegisterKeyCallbacks() {
     glfw.RegisterMouseRelease(GLFW_MOUSE_BUTTON_RIGHT, [this](int, int, int) {
         this->right_click_release();
     });
-    glfw.RegisterMousePress(GLFW_MOUSE_BUTTON_MIDDLE, [this](int, int, int) {
-        this->middle_click_press();
-    });
-    glfw.RegisterMouseRelease(GLFW_MOUSE_BUTTON_MIDDLE, [this](int, int, int) {
-        this->middle_click_release();
-    });
     glfw.RegisterKey(GLFW_KEY_LEFT_ALT, [this](int, int, int action, int) {
         this->snap_callback(action);
     });
     glfw.RegisterKeyPress(GLFW_KEY_DELETE, [this](int, int, int, int) { this->delete_press(); });
+    glfw.RegisterKeyPress(GLFW_KEY_C, [this](int, int, int, int mods) { this->copy_press(mods); });
+    glfw.RegisterKeyPress(GLFW_KEY_V, [this](int, int, int, int mods) { this->paste_press(mods); });
 }
 
 void
@@ -220,6 +239,8 @@ Board::UnregisterKeyCallbacks() {
     glfw.UnregisterMouse(GLFW_MOUSE_BUTTON_MIDDLE);
     glfw.UnregisterKey(GLFW_KEY_LEFT_ALT);
     glfw.UnregisterKeyPress(GLFW_KEY_DELETE);
+    glfw.UnregisterKeyPress(GLFW_KEY_C);
+    glfw.UnregisterKeyPress(GLFW_KEY_V);
 }
 
 void
@@ -254,7 +275,8 @@ Board::set_projection() {
         0.0f,
         -1.0f,
         1.0f);
-    rm.SetGlobalMatrix4("projection", projection);
+    rm.SetProjection(projection);
+    rm.SetScreenResolution(glm::vec2(glfw.GetScreenWidth(), glfw.GetScreenHeight()));
 }
 
 void
@@ -264,7 +286,7 @@ Board::UpdateMouse() {
     Page &pg = **ActivePage;
     switch (LeftClick) {
         case PRESS:
-            pg.HandleLeftClickPress(MousePos);
+            pg.HandleLeftClickPress(MousePos, ShiftClick);
             CurrentHoverType = pg.CurrentHoverType(MousePos);
             LeftClick        = HOLD;
             break;
@@ -319,6 +341,18 @@ Board::Update() {
         pg.Update(MousePos);
     }
     UpdateMouse();
+    AssetFetcher::GetInstance().Update();
+    // Pieces whose image finished loading, or moved in the atlas, look their sprite up again
+    auto changed = ResourceManager::GetInstance().TakeChangedSprites();
+    if (!changed.empty()) {
+        for (auto &pg : Pages) { pg->SpritesChanged(changed); }
+    }
+    // Property edits from every page go out together, once per tick
+    PropertyBatch batch;
+    for (auto &pg : Pages) { pg->CollectPropertyChanges(batch); }
+    if (!batch.Entries.empty() && ClientServer::Started()) {
+        ClientServer::GetInstance().ChannelPublish("PIECE_PROPS", Uid, batch);
+    }
 }
 
 void
@@ -339,9 +373,9 @@ Board::ProcessUIEvents() {
     }
     if (UserInterface.FileDialog->HasSelected()) {
         if (ActivePage != Pages.end()) {
-            auto tex = rm.LoadTexture(UserInterface.FileDialog->GetSelected().string().c_str());
+            auto uid = rm.ImportImage(UserInterface.FileDialog->GetSelected().string().c_str());
             (**ActivePage)
-                .BeginPlacePiece(Transform(glm::vec2(0.0f, 0.0f), glm::vec2(98.0f, 98.0f), 0), tex);
+                .BeginPlacePiece(Transform(glm::vec2(0.0f, 0.0f), glm::vec2(98.0f, 98.0f), 0), uid);
             UserInterface.FileDialog->ClearSelected();
         }
     }
@@ -402,10 +436,69 @@ Board::handle_page_move_piece(NetworkData &&q) {
         if (piece_it != pg.PiecesMap.end()) {
             GameObject &piece        = (*piece_it).second;
             piece.transform.position = piece_data.Parse<glm::vec2>();
+            pg.PieceMoved(piece);
         }
     }
 }
 
+void
+Board::handle_piece_properties(NetworkData &&q) {
+    auto batch = q.Parse<PropertyBatch>();
+    for (auto &entry : batch.Entries) {
+        auto page_it = PagesMap.find(entry.PageUid);
+        if (page_it == PagesMap.end()) { continue; }
+        Page &pg       = page_it->second;
+        auto  piece_it = pg.PiecesMap.find(entry.PieceUid);
+        if (piece_it == pg.PiecesMap.end()) { continue; }
+        GameObject &piece = piece_it->second;
+        piece.Properties.ApplyFields(entry.Fields.data(), entry.Fields.size());
+    }
+}
+
+void
+Board::handle_page_add_pieces(NetworkData &&q) {
+    auto list    = q.Parse<PieceList>();
+    auto page_it = PagesMap.find(q.Uid);
+    if (page_it == PagesMap.end()) { return; }
+    Page &pg = page_it->second;
+    for (auto &piece : list.Pieces) {
+        if (pg.PiecesMap.find(piece.Uid) == pg.PiecesMap.end()) { pg.AddPiece(piece); }
+    }
+}
+
+void
+Board::handle_page_delete_pieces(NetworkData &&q) {
+    auto group   = q.Parse<Data::PieceGroup>();
+    auto page_it = PagesMap.find(q.Uid);
+    if (page_it == PagesMap.end()) { return; }
+    Page &pg = page_it->second;
+    for (auto piece_uid : group.Uids) { pg.DeletePiece(piece_uid); }
+}
+
+void
+Board::handle_page_transform_pieces(NetworkData &&q, glm::vec2 Transform::*field) {
+    auto group   = q.Parse<Data::PieceGroup>();
+    auto page_it = PagesMap.find(q.Uid);
+    if (page_it == PagesMap.end() || group.Values.size() != group.Uids.size()) { return; }
+    Page &pg = page_it->second;
+    for (size_t i = 0; i < group.Uids.size(); i++) {
+        auto piece_it = pg.PiecesMap.find(group.Uids[i]);
+        if (piece_it != pg.PiecesMap.end()) {
+            GameObject &piece      = piece_it->second;
+            piece.transform.*field = group.Values[i];
+            pg.PieceMoved(piece);
+        }
+    }
+}
+
+void
+Board::handle_page_restack_pieces(NetworkData &&q, bool to_front) {
+    auto group   = q.Parse<Data::PieceGroup>();
+    auto page_it = PagesMap.find(q.Uid);
+    if (page_it == PagesMap.end()) { return; }
+    page_it->second.get().Restack(group.Uids, to_front);
+}
+
 void
 Board::handle_page_resize_piece(NetworkData &&q) {
     auto piece_data = q.Parse<NetworkData>();
@@ -418,6 +511,7 @@ Board::handle_page_resize_piece(NetworkData &&q) {
         if (piece_it != pg.PiecesMap.end()) {
             GameObject &piece     = (*piece_it).second;
             piece.transform.scale = piece_data.Parse<glm::vec2>();
+            pg.PieceMoved(piece);
         }
     }
 }
@@ -426,9 +520,28 @@ void
 Board::handle_new_image(NetworkData &&q) {
     static ResourceManager &rm = ResourceManager::GetInstance();
     rm.Images[q.Uid]           = q.Parse<ImageData>();
-    // Check which gameobjects need this texture and apply it.
-    for (auto &pg : Pages) {
-        for (auto &go : pg->Pieces) { go->UpdateSprite(q.Uid); }
+    // Only the pieces that were waiting on this image need to be touched
+    for (auto [page_uid, piece_uid] : AssetFetcher::GetInstance().Arrived(q.Uid)) {
+        auto page_it = PagesMap.find(page_uid);
+        if (page_it == PagesMap.end()) { continue; }
+        Page &pg       = page_it->second;
+        auto  piece_it = pg.PiecesMap.find(piece_uid);
+        if (piece_it != pg.PiecesMap.end()) { piece_it->second.get().UpdateSprite(q.Uid); }
+    }
+}
+
+void
+Board::handle_image_preview(NetworkData &&q) {
+    static ResourceManager &rm = ResourceManager::GetInstance();
+    rm.LoadPreview(q.Uid, q.Parse<ImagePreview>());
+    AssetFetcher::GetInstance().Progress(q.Uid);
+    // The pieces stay with the fetcher, the full image still has to replace the preview
+    for (auto [page_uid, piece_uid] : AssetFetcher::GetInstance().Waiting(q.Uid)) {
+        auto page_it = PagesMap.find(page_uid);
+        if (page_it == PagesMap.end()) { continue; }
+        Page &pg       = page_it->second;
+        auto  piece_it = pg.PiecesMap.find(piece_uid);
+        if (piece_it != pg.PiecesMap.end()) { piece_it->second.get().PreviewSprite(q.Uid); }
     }
 }
 
@@ -482,13 +595,43 @@ Board::register_network_callbacks() {
     cs.ChannelSubscribe("RESIZE_PIECE", [this](NetworkData &&d) {
         handle_page_resize_piece(std::move(d));
     });
+    cs.ChannelSubscribe("ADD_PIECES", [this](NetworkData &&d) {
+        handle_page_add_pieces(std::move(d));
+    });
+    cs.ChannelSubscribe("DELETE_PIECES", [this](NetworkData &&d) {
+        handle_page_delete_pieces(std::move(d));
+    });
+    cs.ChannelSubscribe("MOVE_PIECES", [this](NetworkData &&d) {
+        handle_page_transform_pieces(std::move(d), &Transform::position);
+    });
+    cs.ChannelSubscribe("RESIZE_PIECES", [this](NetworkData &&d) {
+        handle_page_transform_pieces(std::move(d), &Transform::scale);
+    });
+    cs.ChannelSubscribe("PIECE_PROPS", [this](NetworkData &&d) {
+        handle_piece_properties(std::move(d));
+    });
+    cs.ChannelSubscribe("RAISE_PIECES", [this](NetworkData &&d) {
+        handle_page_restack_pieces(std::move(d), true);
+    });
+    cs.ChannelSubscribe("LOWER_PIECES", [this](NetworkData &&d) {
+        handle_page_restack_pieces(std::move(d), false);
+    });
     cs.ChannelSubscribe("NEW_IMAGE", [this](NetworkData &&d) { handle_new_image(std::move(d)); });
+    cs.ChannelSubscribe("IMAGE_PREVIEW", [this](NetworkData &&d) {
+        handle_image_preview(std::move(d));
+    });
     cs.ChannelSubscribe("JOIN", [this, &cs](NetworkData &&d) {
         cs.ChannelPublish("JOIN_ACCEPT", this->Uid, this->Name, d.Uid);
     });
     cs.ChannelSubscribe("JOIN_DONE", [this, &cs](NetworkData &&d) {
         handle_client_join(std::move(d));
     });
+    cs.ChannelSubscribe("SPECTATE", [this, &cs](NetworkData &&d) {
+        cs.ChannelPublish("JOIN_ACCEPT", this->Uid, this->Name, d.Uid);
+    });
+    cs.ChannelSubscribe("SPECTATE_DONE", [this](NetworkData &&d) {
+        handle_client_join(std::move(d));
+    });
     cs.ChannelSubscribe("ADD_PAGE", [this](NetworkData &&d) { handle_add_page(std::move(d)); });
     cs.ChannelSubscribe("PLAYER_VIEW", [this](NetworkData &&d) {
         handle_change_player_view(std::move(d));
@@ -509,6 +652,9 @@ Board::SendAllPages(uint64_t client_uid) const {
 
 void
 Board::WriteToDB(const SQLite::Database &db) const {
+    // One transaction for the whole save, instead of one per statement
+    std::string err;
+    if (db.Exec("BEGIN TRANSACTION;", err)) { std::cerr << err << std::endl; }
     auto stmt = db.Prepare("INSERT OR REPLACE INTO Games VALUES(?,?,?);");
     stmt.Bind(1, Uid);
     stmt.Bind(2, Name);
@@ -519,6 +665,9 @@ Board::WriteToDB(const SQLite::Database &db) const {
     }
     stmt.Step();
     for (auto &page : Pages) { page->WriteToDB(db, Uid); }
+    // The images go in the same transaction, or a crash mid-save leaves pieces without them
+    ResourceManager::GetInstance().WriteToDB(db);
+    if (db.Exec("COMMIT;", err)) { std::cerr << err << std::endl; }
 }
 
 void
@@ -1,7 +1,9 @@
 #include "board_renderer.h"
-#include "glfw_handler.h"
+#include "gl_state.h"
 #include "resource_manager.h"
 
+static GLState &gl = GLState::GetInstance();
+
 BoardRenderer::BoardRenderer(
     const Transform &transform,
     const glm::mat4 &view,
@@ -23,30 +25,26 @@ BoardRenderer::BoardRenderer(
     glBindBuffer(GL_ARRAY_BUFFER, VBO);
     glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
 
-    glBindVertexArray(quad_VAO);
+    gl.BindVertexArray(quad_VAO);
     glEnableVertexAttribArray(0);
     glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void *)0);
     glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glBindVertexArray(0);
 }
 
 void
 BoardRenderer::Draw() {
     shader->Use();
     glm::mat4 model = Model();
-    shader->SetMatrix4("view", view);
     shader->SetMatrix4("model", model);
-    shader->SetVector2f("screenRes", glm::vec2(GLFW::GetScreenWidth(), GLFW::GetScreenHeight()));
     shader->SetFloat("line_width", LineWidth);
     shader->SetVector3f("bg_color", Color);
     shader->SetVector3f("line_color", LineColor);
     shader->SetVector2i("num_cells", CellDims);
 
-    glBindVertexArray(quad_VAO);
+    gl.BindVertexArray(quad_VAO);
     glDrawArrays(GL_TRIANGLES, 0, 6);
-    glBindVertexArray(0);
 }
 
 BoardRenderer::~BoardRenderer() {
-    glDeleteVertexArrays(1, &quad_VAO);
+    gl.DeleteVertexArray(quad_VAO);
 }
@@ -1,10 +1,14 @@
 #include <utility>
 
 #include "state_manager.h"
+#include "asset_fetcher.h"
 #include "client_server.h"
+#include "metrics.h"
 #include "resource_manager.h"
 
-using Data::NetworkData, Data::ClientInfo, Data::ImageData;
+using Data::NetworkData, Data::ClientInfo, Data::ImageData, Data::ImageChunk, Data::PieceGroup;
+
+using std::chrono::steady_clock;
 
 bool ClientServer::started = false;
 
@@ -24,7 +28,7 @@ ClientServer::Started() {
 void
 ClientServer::Update() {
     for (auto &[key, vec] : sub_queues) {
-        for (auto &func : vec) { func(); }
+        for (auto &func : vec) { func(*this); }
     }
     PublishPageChanges();
 }
@@ -34,11 +38,25 @@ ClientServer::PublishPageChanges() {
     while (!changes.empty()) {
         auto p = changes.front();
         // Publish the data to the target uid
-        pub_queues[p.first]->Publish(p.second.first, p.second.second);
+        publish(p.first, p.second.first, p.second.second);
         changes.pop();
     }
 }
 
+bool
+ClientServer::accept(
+    [[maybe_unused]] const std::string &      channel,
+    [[maybe_unused]] const Data::NetworkData &d) {
+    return true;
+}
+
+void
+ClientServer::publish(const std::string &channel, const NetworkData &d, uint64_t target_uid) {
+    auto &queue = pub_queues[channel];
+    if (!queue) { queue = NetworkManager::NetworkQueue::Publisher(channel); }
+    queue->Publish(d, target_uid);
+}
+
 void
 ClientServer::ChannelSubscribe(const std::string &channel_name, ClientServer::queue_handler_f cb) {
     sub_queues[channel_name].push_back(NetworkQueueCallback(channel_name, std::move(cb)));
@@ -59,7 +77,7 @@ Client::Start(int port_num, std::string name, std::string hostname) {
     // Uid will get filled in from db or generated new
     uid                = Util::generate_uid();
     NetworkManager &nm = NetworkManager::GetInstance();
-    nm.StartClient(name, uid, std::move(hostname), port_num);
+    nm.StartClient(name, uid, std::move(hostname), port_num, Spectator);
     started = true;
     ChannelSubscribe("IMAGE_REQUEST", [this](NetworkData &&d) {
         handle_image_request(std::move(d));
@@ -68,11 +86,20 @@ Client::Start(int port_num, std::string name, std::string hostname) {
     ChannelSubscribe("CLIENT_DELETE", [this](NetworkData &&d) {
         handle_client_delete(std::move(d));
     });
+    ChannelSubscribe("CHUNK_REQUEST", [this](NetworkData &&d) {
+        handle_chunk_request(std::move(d));
+    });
+    ChannelSubscribe("IMAGE_CHUNK", [this](NetworkData &&d) { handle_image_chunk(std::move(d)); });
+    ChannelSubscribe("LEASE", [this](NetworkData &&d) { handle_lease(std::move(d)); });
+    ChannelSubscribe("LEASE_RELEASE", [this](NetworkData &&d) {
+        for (auto piece_uid : d.Parse<PieceGroup>().Uids) { leases.erase(piece_uid); }
+    });
     ChannelSubscribe("JOIN_ACCEPT", [this](NetworkData &&d) {
         StateManager &sm = StateManager::GetInstance();
         ClientServer &cs = ClientServer::GetInstance();
         sm.StartNewGame(Util::deserialize<std::string>(d.Data), true, d.Uid);
-        cs.ChannelPublish("JOIN_DONE", this->uid, this->Name, d.Uid);
+        const char *  done = Spectator ? "SPECTATE_DONE" : "JOIN_DONE";
+        cs.ChannelPublish(done, this->uid, this->Name, d.Uid);
     });
     Name = name;
 }
@@ -82,6 +109,34 @@ Client::Update() {
     ClientServer::Update();
 }
 
+bool
+Client::AcquireLeases(const std::vector<uint64_t> &piece_uids) {
+    // The server hands out the leases when our first update for the pieces reaches it
+    return std::all_of(piece_uids.begin(), piece_uids.end(), [this](uint64_t piece_uid) {
+        auto it = leases.find(piece_uid);
+        return it == leases.end() || it->second == uid;
+    });
+}
+
+void
+Client::ReleaseLeases(const std::vector<uint64_t> &piece_uids) {
+    PieceGroup released;
+    for (auto piece_uid : piece_uids) {
+        auto it = leases.find(piece_uid);
+        if (it != leases.end() && it->second == uid) { leases.erase(it); }
+        released.Uids.push_back(piece_uid);
+    }
+    // Sent even if the grant hasn't arrived yet, otherwise a quick drag holds the pieces until the
+    // lease times out
+    if (!released.Uids.empty()) { ChannelPublish("LEASE_RELEASE", 0, released); }
+}
+
+void
+Client::handle_lease(NetworkData &&q) {
+    // The holder is the message uid, the pieces they took are the group
+    for (auto piece_uid : q.Parse<PieceGroup>().Uids) { leases[piece_uid] = q.Uid; }
+}
+
 void
 Client::handle_image_request(NetworkData &&q) {
     static ResourceManager &rm     = ResourceManager::GetInstance();
@@ -91,6 +146,59 @@ Client::handle_image_request(NetworkData &&q) {
     }
 }
 
+void
+Client::handle_chunk_request(NetworkData &&q) {
+    static ResourceManager &rm      = ResourceManager::GetInstance();
+    auto                    request = q.Parse<ImageChunk>();
+    auto                    it      = rm.Images.find(request.ImageUid);
+    if (it != rm.Images.end() && request.Index < it->second.ChunkCount()) {
+        auto chunk = it->second.Chunk(request.ImageUid, request.Recipient, request.Index);
+        ChannelPublish("IMAGE_CHUNK", request.ImageUid, chunk);
+    }
+}
+
+void
+Client::handle_image_chunk(NetworkData &&q) {
+    static ResourceManager &rm    = ResourceManager::GetInstance();
+    static NetworkManager & nm    = NetworkManager::GetInstance();
+    auto                    chunk = q.Parse<ImageChunk>();
+    if (!chunk.Consistent() || rm.Images.find(chunk.ImageUid) != rm.Images.end()) { return; }
+    auto &img = partial_images[chunk.ImageUid];
+    // A chunk of the same image can't disagree about its size with the ones before it
+    if (!img.Received.empty() && img.Hash == chunk.Hash &&
+        (img.Data.size() != chunk.TotalSize || img.Received.size() != chunk.Count)) {
+        return;
+    }
+    if (img.Received.empty() || img.Hash != chunk.Hash) {
+        img.Hash      = chunk.Hash;
+        img.Data      = std::vector<unsigned char>(chunk.TotalSize);
+        img.Received  = std::vector<bool>(chunk.Count, false);
+        img.Remaining = chunk.Count;
+    }
+    size_t offset = chunk.Index * ImageData::ChunkSize;
+    if (chunk.Index >= img.Received.size() || img.Received[chunk.Index] ||
+        offset + chunk.Data.size() > img.Data.size()) {
+        return;
+    }
+    std::copy(chunk.Data.begin(), chunk.Data.end(), img.Data.begin() + offset);
+    img.Received[chunk.Index] = true;
+    AssetFetcher::GetInstance().Progress(chunk.ImageUid);
+    if (--img.Remaining > 0) { return; }
+
+    ImageData data(img.Data);
+    partial_images.erase(chunk.ImageUid);
+    if (data.Hash != chunk.Hash) {
+        // Something went wrong along the way, ask for the whole image again
+        ChannelPublish("IMAGE_REQUEST", uid, chunk.ImageUid);
+        return;
+    }
+    rm.Images[chunk.ImageUid] = data;
+    // Hand the finished image to the rest of the client as if it had arrived whole
+    nm.Dispatch("NEW_IMAGE", Util::serialize_vec(NetworkData(data, chunk.ImageUid)));
+    // Let the server know this client can now serve the image to other peers
+    ChannelPublish("IMAGE_HAVE", chunk.ImageUid, data.Hash);
+}
+
 void
 Client::handle_client_add(NetworkData &&q) {
     auto client = q.Parse<ClientInfo>();
@@ -115,7 +223,19 @@ Server::Start(int port, std::string name, std::string hostname) {
     NetworkManager &nm = NetworkManager::GetInstance();
     nm.StartServer(port);
     std::vector<std::string> forward_channels =
-        {"ADD_PIECE", "DELETE_PIECE", "MOVE_PIECE", "RESIZE_PIECE", "ADD_PAGE", "CHAT_MSG"};
+        {"ADD_PIECE",
+         "DELETE_PIECE",
+         "MOVE_PIECE",
+         "RESIZE_PIECE",
+         "PIECE_PROPS",
+         "ADD_PIECES",
+         "DELETE_PIECES",
+         "MOVE_PIECES",
+         "RESIZE_PIECES",
+         "RAISE_PIECES",
+         "LOWER_PIECES",
+         "ADD_PAGE",
+         "CHAT_MSG"};
     for (auto &str : forward_channels) {
         ChannelSubscribe(str, [this, str](NetworkData &&d) { handle_forward_data(str, d); });
     }
@@ -130,6 +250,14 @@ Server::Start(int port, std::string name, std::string hostname) {
         handle_image_request(std::move(d));
     });
     ChannelSubscribe("NEW_IMAGE", [this](NetworkData &&d) { handle_new_image(std::move(d)); });
+    ChannelSubscribe("IMAGE_HAVE", [this](NetworkData &&d) { handle_image_have(std::move(d)); });
+    ChannelSubscribe("IMAGE_CHUNK", [this](NetworkData &&d) { handle_image_chunk(std::move(d)); });
+    ChannelSubscribe("SPECTATE_DONE", [this](NetworkData &&d) {
+        handle_spectator_join(std::move(d));
+    });
+    ChannelSubscribe("LEASE_RELEASE", [this](NetworkData &&d) {
+        handle_lease_release(std::move(d));
+    });
     ChannelSubscribe("DISCONNECT", [this](NetworkData &&d) {
         handle_client_disconnect(std::move(d));
     });
@@ -137,16 +265,442 @@ Server::Start(int port, std::string name, std::string hostname) {
     // TODO allow hosts to set their name aswell
     Name = "Host";
     ConnectedClients.emplace_back(0, Name);
+    Metrics::GetInstance().ConnectedClients = ConnectedClients.size();
+    if (Metrics::GetInstance().Serve) { nm.StartMetrics("127.0.0.1", Metrics::DefaultPort); }
 }
 
 void
 Server::Update() {
     ClientServer::Update();
+    for (auto piece_uid : deleted_pieces) { piece_visibility.erase(piece_uid); }
+    deleted_pieces.clear();
+    resync_lease_losers();
+    expire_leases();
+    expire_chunk_assignments();
+    send_new_previews();
+}
+
+bool
+Server::AcquireLeases(const std::vector<uint64_t> &piece_uids) {
+    std::vector<uint64_t> ungranted;
+    for (auto piece_uid : piece_uids) {
+        auto it = leases.find(piece_uid);
+        if (it == leases.end()) {
+            ungranted.push_back(piece_uid);
+        } else if (it->second.Holder != uid) {
+            return false;
+        }
+    }
+    grant_leases(ungranted, uid);
+    auto expiry = std::chrono::steady_clock::now() + LeaseTimeout;
+    for (auto piece_uid : piece_uids) { leases[piece_uid].Expiry = expiry; }
+    return true;
+}
+
+void
+Server::ReleaseLeases(const std::vector<uint64_t> &piece_uids) {
+    std::vector<uint64_t> held;
+    for (auto piece_uid : piece_uids) {
+        auto it = leases.find(piece_uid);
+        if (it != leases.end() && it->second.Holder == uid) { held.push_back(piece_uid); }
+    }
+    release_leases(held);
+}
+
+bool
+Server::accept(const std::string &channel, const NetworkData &d) {
+    if (channel == "ADD_PIECE") {
+        auto piece = CoreGameObject::Deserialize(d.Data);
+        // Clients can add pieces, but can't use that to change the visibility of existing ones
+        if (piece_visibility.find(piece.Uid) == piece_visibility.end()) {
+            TrackPiece(d.Uid, piece);
+        }
+        return true;
+    }
+    if (channel == "PIECE_PROPS") {
+        auto batch = Util::deserialize<PropertyBatch>(d.Data);
+        for (auto &entry : batch.Entries) {
+            if (!can_see(d.ClientUid, entry.PieceUid)) { return false; }
+        }
+        return true;
+    }
+    if (channel == "ADD_PIECES") {
+        for (auto &piece : Util::deserialize<PieceList>(d.Data).Pieces) {
+            if (piece_visibility.find(piece.Uid) == piece_visibility.end()) {
+                TrackPiece(d.Uid, piece);
+            }
+        }
+        return true;
+    }
+    if (channel == "MOVE_PIECES" || channel == "RESIZE_PIECES" || channel == "DELETE_PIECES") {
+        return accept_group(channel, d);
+    }
+    if (channel == "RAISE_PIECES" || channel == "LOWER_PIECES") {
+        for (auto piece_uid : Util::deserialize<PieceGroup>(d.Data).Uids) {
+            if (!can_see(d.ClientUid, piece_uid)) { return false; }
+        }
+        return true;
+    }
+    bool moving = channel == "MOVE_PIECE";
+    if (!moving && channel != "RESIZE_PIECE" && channel != "DELETE_PIECE") { return true; }
+    uint64_t piece_uid = Util::deserialize<NetworkData>(d.Data).Uid;
+    // Nobody gets to touch a piece they aren't allowed to see
+    if (!can_see(d.ClientUid, piece_uid)) { return false; }
+    auto it = leases.find(piece_uid);
+    // Leases only expire in Update, so every subscriber to this message gets the same answer
+    if (it != leases.end() && it->second.Holder != d.ClientUid) {
+        lease_losers.emplace(d.ClientUid, piece_uid);
+        return false;
+    }
+    if (channel == "DELETE_PIECE") {
+        release_deleted({piece_uid});
+        return true;
+    }
+    if (it == leases.end()) {
+        grant_leases({piece_uid}, d.ClientUid);
+        it = leases.find(piece_uid);
+    }
+    it->second.Expiry = std::chrono::steady_clock::now() + LeaseTimeout;
+    if (moving) {
+        it->second.Move = d;
+    } else {
+        it->second.Resize = d;
+    }
+    return true;
+}
+
+bool
+Server::accept_group(const std::string &channel, const NetworkData &d) {
+    auto group = Util::deserialize<PieceGroup>(d.Data);
+    for (auto piece_uid : group.Uids) {
+        if (!can_see(d.ClientUid, piece_uid)) { return false; }
+    }
+    bool deleting = channel == "DELETE_PIECES";
+    if (!deleting && group.Values.size() != group.Uids.size()) { return false; }
+    // The group changes as one, so it's refused if anyone else holds any of its pieces
+    bool lost = false;
+    for (auto piece_uid : group.Uids) {
+        auto it = leases.find(piece_uid);
+        if (it != leases.end() && it->second.Holder != d.ClientUid) {
+            lease_losers.emplace(d.ClientUid, piece_uid);
+            lost = true;
+        }
+    }
+    if (lost) { return false; }
+    if (deleting) {
+        release_deleted(group.Uids);
+        return true;
+    }
+    std::vector<uint64_t> ungranted;
+    for (auto piece_uid : group.Uids) {
+        if (leases.find(piece_uid) == leases.end()) { ungranted.push_back(piece_uid); }
+    }
+    grant_leases(ungranted, d.ClientUid);
+    bool moving = channel == "MOVE_PIECES";
+    auto expiry = std::chrono::steady_clock::now() + LeaseTimeout;
+    for (size_t i = 0; i < group.Uids.size(); i++) {
+        uint64_t piece_uid = group.Uids[i];
+        auto     it        = leases.find(piece_uid);
+        it->second.Expiry  = expiry;
+        // Losers are resynced one piece at a time, so keep what the single piece update would be
+        NetworkData update(NetworkData(group.Values[i], piece_uid), d.Uid, d.ClientUid);
+        if (moving) {
+            it->second.Move = update;
+        } else {
+            it->second.Resize = update;
+        }
+    }
+    return true;
+}
+
+void
+Server::publish(const std::string &channel, const NetworkData &d, uint64_t target_uid) {
+    if (channel == "PIECE_PROPS" || channel == "ADD_PIECES" || channel == "MOVE_PIECES" ||
+        channel == "RESIZE_PIECES" || channel == "DELETE_PIECES" || channel == "RAISE_PIECES" ||
+        channel == "LOWER_PIECES" || channel == "LEASE" || channel == "LEASE_RELEASE") {
+        // Leases name their pieces too, so they only go to those who can see them
+        publish_group(channel, d, target_uid);
+        return;
+    }
+    uint64_t piece_uid = 0;
+    if (channel == "ADD_PIECE") {
+        piece_uid = CoreGameObject::Deserialize(d.Data).Uid;
+    } else if (channel == "MOVE_PIECE" || channel == "RESIZE_PIECE" || channel == "DELETE_PIECE") {
+        piece_uid = Util::deserialize<NetworkData>(d.Data).Uid;
+    }
+    auto it     = piece_visibility.find(piece_uid);
+    bool hidden = it != piece_visibility.end() &&
+                  it->second.Visible != CoreGameObject::Visibility::EVERYONE;
+    if (!hidden) {
+        ClientServer::publish(channel, d, target_uid);
+    } else if (target_uid != 0) {
+        if (can_see(target_uid, piece_uid)) { ClientServer::publish(channel, d, target_uid); }
+    } else {
+        // Spectators aren't anyone's owner, so they never see a hidden piece
+        for (auto &client : ConnectedClients) {
+            if (client.Uid != 0 && can_see(client.Uid, piece_uid)) {
+                ClientServer::publish(channel, d, client.Uid);
+            }
+        }
+    }
+    if (channel == "DELETE_PIECE" && piece_uid != 0) { release_deleted({piece_uid}); }
+}
+
+void
+Server::publish_group(const std::string &channel, const NetworkData &d, uint64_t target_uid) {
+    // Batches list their pieces in different ways, so find the uids and a way to rebuild the
+    // message from only the entries a recipient may see
+    std::vector<uint64_t>                                 piece_uids;
+    std::function<NetworkData(const std::vector<bool> &)> filter;
+    PropertyBatch                                         batch;
+    PieceList                                             list;
+    PieceGroup                                            group;
+    if (channel == "PIECE_PROPS") {
+        batch = Util::deserialize<PropertyBatch>(d.Data);
+        for (auto &entry : batch.Entries) { piece_uids.push_back(entry.PieceUid); }
+        filter = [&](const std::vector<bool> &keep) {
+            PropertyBatch visible;
+            for (size_t i = 0; i < keep.size(); i++) {
+                if (keep[i]) { visible.Entries.push_back(batch.Entries[i]); }
+            }
+            return NetworkData(visible, d.Uid, d.ClientUid);
+        };
+    } else if (channel == "ADD_PIECES") {
+        list = Util::deserialize<PieceList>(d.Data);
+        for (auto &piece : list.Pieces) { piece_uids.push_back(piece.Uid); }
+        filter = [&](const std::vector<bool> &keep) {
+            PieceList visible;
+            for (size_t i = 0; i < keep.size(); i++) {
+                if (keep[i]) { visible.Pieces.push_back(list.Pieces[i]); }
+            }
+            return NetworkData(visible, d.Uid, d.ClientUid);
+        };
+    } else {
+        group      = Util::deserialize<PieceGroup>(d.Data);
+        piece_uids = group.Uids;
+        filter     = [&](const std::vector<bool> &keep) {
+            PieceGroup visible;
+            for (size_t i = 0; i < keep.size(); i++) {
+                if (!keep[i]) { continue; }
+                visible.Uids.push_back(group.Uids[i]);
+                if (i < group.Values.size()) { visible.Values.push_back(group.Values[i]); }
+            }
+            return NetworkData(visible, d.Uid, d.ClientUid);
+        };
+    }
+    if (channel == "DELETE_PIECES") { release_deleted(piece_uids); }
+    bool hidden = std::any_of(piece_uids.begin(), piece_uids.end(), [this](uint64_t piece_uid) {
+        auto it = piece_visibility.find(piece_uid);
+        return it != piece_visibility.end() &&
+               it->second.Visible != CoreGameObject::Visibility::EVERYONE;
+    });
+    if (!hidden) {
+        ClientServer::publish(channel, d, target_uid);
+        return;
+    }
+    std::vector<uint64_t> targets;
+    if (target_uid != 0) {
+        targets.push_back(target_uid);
+    } else {
+        for (auto &client : ConnectedClients) {
+            if (client.Uid != 0) { targets.push_back(client.Uid); }
+        }
+        // Spectators still get the public part of a batch
+        targets.insert(targets.end(), spectators.begin(), spectators.end());
+    }
+    for (auto target : targets) {
+        std::vector<bool> keep(piece_uids.size());
+        bool              any = false;
+        for (size_t i = 0; i < piece_uids.size(); i++) {
+            keep[i] = can_see(target, piece_uids[i]);
+            any |= keep[i];
+        }
+        if (any) { ClientServer::publish(channel, filter(keep), target); }
+    }
+}
+
+void
+Server::TrackPiece(uint64_t page_uid, const CoreGameObject &piece) {
+    PieceVisibility &v = piece_visibility[piece.Uid];
+    v.PageUid          = page_uid;
+    v.SpriteUid        = piece.SpriteUid;
+    v.Visible          = piece.Visible;
+    v.Owners           = piece.Owners;
+    v.Viewers          = viewers_of(v);
+}
+
+void
+Server::SetPieceVisibility(uint64_t page_uid, const CoreGameObject &piece) {
+    auto it = piece_visibility.find(piece.Uid);
+    if (it == piece_visibility.end()) {
+        TrackPiece(page_uid, piece);
+        return;
+    }
+    viewer_set before        = it->second.Viewers;
+    bool       public_before = it->second.Visible == CoreGameObject::Visibility::EVERYONE;
+    TrackPiece(page_uid, piece);
+    viewer_set  after        = it->second.Viewers;
+    bool        public_after = piece.Visible == CoreGameObject::Visibility::EVERYONE;
+    NetworkData add(piece, page_uid, uid);
+    NetworkData remove(NetworkData(piece, piece.Uid), page_uid, uid);
+    // Sent straight away, queued messages are filtered by the new visibility so a removal would
+    // never reach the clients that just lost sight of the piece
+    for (auto &client : ConnectedClients) {
+        auto slot = viewer_slots.find(client.Uid);
+        if (slot == viewer_slots.end()) { continue; }
+        if (!before.test(slot->second) && after.test(slot->second)) {
+            ClientServer::publish("ADD_PIECE", add, client.Uid);
+        } else if (before.test(slot->second) && !after.test(slot->second)) {
+            ClientServer::publish("DELETE_PIECE", remove, client.Uid);
+        }
+    }
+    if (public_before == public_after) { return; }
+    for (auto spectator : spectators) {
+        if (public_after) {
+            ClientServer::publish("ADD_PIECE", add, spectator);
+        } else {
+            ClientServer::publish("DELETE_PIECE", remove, spectator);
+        }
+    }
+}
+
+bool
+Server::can_see(uint64_t client_uid, uint64_t piece_uid) const {
+    // The host sees everything, and anything not being tracked isn't hidden
+    if (client_uid == uid) { return true; }
+    auto it = piece_visibility.find(piece_uid);
+    if (it == piece_visibility.end()) { return true; }
+    auto slot = viewer_slots.find(client_uid);
+    if (slot == viewer_slots.end()) {
+        return it->second.Visible == CoreGameObject::Visibility::EVERYONE;
+    }
+    return it->second.Viewers.test(slot->second);
+}
+
+bool
+Server::can_see_image(uint64_t client_uid, uint64_t img_id) const {
+    for (auto &[piece_uid, v] : piece_visibility) {
+        if (v.SpriteUid == img_id && can_see(client_uid, piece_uid)) { return true; }
+    }
+    return false;
+}
+
+Server::viewer_set
+Server::viewers_of(const PieceVisibility &v) const {
+    viewer_set viewers;
+    switch (v.Visible) {
+        case CoreGameObject::Visibility::EVERYONE: viewers.set(); break;
+        case CoreGameObject::Visibility::OWNERS:
+            for (auto owner : v.Owners) {
+                auto slot = viewer_slots.find(owner);
+                if (slot != viewer_slots.end()) { viewers.set(slot->second); }
+            }
+            break;
+        case CoreGameObject::Visibility::GM_ONLY: break;
+    }
+    return viewers;
+}
+
+void
+Server::assign_viewer_slot(uint64_t client_uid) {
+    size_t slot = 0;
+    while (slot < MaxViewers && used_viewer_slots.test(slot)) { slot++; }
+    if (slot == MaxViewers) {
+        std::cout << "Out of viewer slots, client will only see public pieces" << std::endl;
+        return;
+    }
+    used_viewer_slots.set(slot);
+    viewer_slots[client_uid] = slot;
+    for (auto &[piece_uid, v] : piece_visibility) { v.Viewers = viewers_of(v); }
+}
+
+void
+Server::release_viewer_slot(uint64_t client_uid) {
+    auto it = viewer_slots.find(client_uid);
+    if (it == viewer_slots.end()) { return; }
+    used_viewer_slots.reset(it->second);
+    viewer_slots.erase(it);
+    // The slot could be reused by someone who doesn't own the same pieces
+    for (auto &[piece_uid, v] : piece_visibility) { v.Viewers = viewers_of(v); }
+}
+
+void
+Server::handle_lease_release(NetworkData &&q) {
+    std::vector<uint64_t> held;
+    for (auto piece_uid : q.Parse<PieceGroup>().Uids) {
+        auto it = leases.find(piece_uid);
+        if (it != leases.end() && it->second.Holder == q.ClientUid) { held.push_back(piece_uid); }
+    }
+    release_leases(held);
+}
+
+void
+Server::grant_leases(const std::vector<uint64_t> &piece_uids, uint64_t holder) {
+    if (piece_uids.empty()) { return; }
+    PieceGroup granted;
+    auto       expiry = std::chrono::steady_clock::now() + LeaseTimeout;
+    for (auto piece_uid : piece_uids) {
+        leases[piece_uid] = {holder, expiry, {}, {}};
+        granted.Uids.push_back(piece_uid);
+    }
+    ChannelPublish("LEASE", holder, granted);
+}
+
+void
+Server::release_leases(const std::vector<uint64_t> &piece_uids) {
+    if (piece_uids.empty()) { return; }
+    PieceGroup released;
+    for (auto piece_uid : piece_uids) {
+        leases.erase(piece_uid);
+        released.Uids.push_back(piece_uid);
+    }
+    ChannelPublish("LEASE_RELEASE", 0, released);
+}
+
+void
+Server::release_deleted(const std::vector<uint64_t> &piece_uids) {
+    std::vector<uint64_t> held;
+    for (auto piece_uid : piece_uids) {
+        if (leases.find(piece_uid) != leases.end()) { held.push_back(piece_uid); }
+    }
+    release_leases(held);
+    deleted_pieces.insert(deleted_pieces.end(), piece_uids.begin(), piece_uids.end());
+}
+
+void
+Server::expire_leases() {
+    auto                  now = std::chrono::steady_clock::now();
+    std::vector<uint64_t> expired;
+    for (auto &[piece_uid, lease] : leases) {
+        if (lease.Expiry <= now) { expired.push_back(piece_uid); }
+    }
+    release_leases(expired);
+}
+
+void
+Server::resync_lease_losers() {
+    // Tell them who has the pieces so they stop sending, and undo what they did to them locally
+    std::map<std::pair<uint64_t, uint64_t>, PieceGroup> held_by;
+    for (auto &[client_uid, piece_uid] : lease_losers) {
+        auto it = leases.find(piece_uid);
+        if (it == leases.end()) { continue; }
+        Lease &lease = it->second;
+        held_by[{client_uid, lease.Holder}].Uids.push_back(piece_uid);
+        if (lease.Move) {
+            ChannelPublish("MOVE_PIECE", lease.Move->Uid, lease.Move->Data, client_uid);
+        }
+        if (lease.Resize) {
+            ChannelPublish("RESIZE_PIECE", lease.Resize->Uid, lease.Resize->Data, client_uid);
+        }
+    }
+    for (auto &[who, group] : held_by) { ChannelPublish("LEASE", who.second, group, who.first); }
+    lease_losers.clear();
 }
 
 void
 Server::handle_client_join(NetworkData d) {
     auto new_client = ClientInfo(d.Uid, d.Parse<std::string>());
+    assign_viewer_slot(d.Uid);
     // Send new client out to all connected clients
     ChannelPublish("CLIENT_ADD", uid, new_client);
     // Send all clients to the client that just connected
@@ -156,6 +710,13 @@ Server::handle_client_join(NetworkData d) {
         ConnectedClients.begin(),
         ConnectedClients.end(),
         [](const ClientInfo &c1, const ClientInfo &c2) { return c1.Uid < c2.Uid; });
+    Metrics::GetInstance().ConnectedClients = ConnectedClients.size();
+}
+
+void
+Server::handle_spectator_join(NetworkData &&d) {
+    spectators.insert(d.Uid);
+    for (auto &c : ConnectedClients) { ChannelPublish("CLIENT_ADD", uid, c, d.Uid); }
 }
 
 void
@@ -165,17 +726,29 @@ Server::handle_forward_data(const std::string &channel, const NetworkData &d) {
             ChannelPublish(channel, d.Uid, d.Data, client.Uid);
         }
     }
+    // A relay counts as a single spectator, however many are watching through it
+    for (auto spectator : spectators) { ChannelPublish(channel, d.Uid, d.Data, spectator); }
 }
 
 void
 Server::handle_image_request(NetworkData &&q) {
     static ResourceManager &rm     = ResourceManager::GetInstance();
     auto                    img_id = q.Parse<uint64_t>();
+    // The host gets every image as it is added, and a transfer to uid 0 would go to everyone
+    if (q.ClientUid == uid) { return; }
+    // Don't hand out images that belong only to pieces the client can't see
+    if (!can_see_image(q.ClientUid, img_id)) { return; }
+    // A retry while the chunks are still going out would only send them all again
+    if (image_transfers.count(std::make_pair(img_id, q.ClientUid)) > 0) { return; }
     if (rm.Images.find(img_id) != rm.Images.end()) {
-        ChannelPublish("NEW_IMAGE", img_id, rm.Images[img_id], q.Uid);
+        schedule_image_transfer(img_id, q.ClientUid);
     } else {
-        // Make a pair of image uid and requesting client
-        pending_image_requests.emplace_back(img_id, q.Uid);
+        // Make a pair of image uid and requesting client, once however often the client asks
+        auto request = std::make_pair(img_id, q.ClientUid);
+        if (std::find(pending_image_requests.begin(), pending_image_requests.end(), request) ==
+            pending_image_requests.end()) {
+            pending_image_requests.push_back(request);
+        }
     }
 }
 
@@ -183,25 +756,258 @@ void
 Server::handle_new_image(NetworkData &&q) {
     static ResourceManager &rm = ResourceManager::GetInstance();
     rm.Images[q.Uid]           = q.Parse<ImageData>();
-    // Send all pending requests if they were waiting on an image
-    for (auto request : pending_image_requests) {
-        if (q.Uid == request.first) {
-            ChannelPublish("NEW_IMAGE", q.Uid, rm.Images[request.first], request.second);
+    // The uploading client holds every chunk of the image
+    auto &image = rm.Images[q.Uid];
+    auto &swarm = swarms[image.Hash];
+    swarm.ChunkHolders.resize(image.ChunkCount());
+    for (auto &holders : swarm.ChunkHolders) { holders.insert(q.ClientUid); }
+    // Send all pending requests if they were waiting on an image, they are done with after that
+    auto served = std::partition(
+        pending_image_requests.begin(),
+        pending_image_requests.end(),
+        [&q](const std::pair<uint64_t, uint64_t> &request) { return request.first != q.Uid; });
+    for (auto it = served; it != pending_image_requests.end(); it++) {
+        schedule_image_transfer(q.Uid, it->second);
+    }
+    pending_image_requests.erase(served, pending_image_requests.end());
+}
+
+void
+Server::handle_image_have(NetworkData &&q) {
+    static ResourceManager &rm   = ResourceManager::GetInstance();
+    auto                    hash = q.Parse<size_t>();
+    auto                    it   = rm.Images.find(q.Uid);
+    // Only track copies the host can vouch for
+    if (it == rm.Images.end() || it->second.Hash != hash) { return; }
+    auto &swarm = swarms[hash];
+    swarm.ChunkHolders.resize(it->second.ChunkCount());
+    for (auto &holders : swarm.ChunkHolders) { holders.insert(q.ClientUid); }
+}
+
+void
+Server::handle_image_chunk(NetworkData &&q) {
+    auto chunk = q.Parse<ImageChunk>();
+    auto it    = std::find_if(
+        chunk_assignments.begin(),
+        chunk_assignments.end(),
+        [&chunk, &q](const ChunkAssignment &a) {
+            return a.ImageUid == chunk.ImageUid && a.Index == chunk.Index &&
+                   a.Requester == chunk.Recipient && a.Peer == q.ClientUid;
+        });
+    // Late chunks have already been reassigned, so don't send them twice
+    if (it == chunk_assignments.end()) { return; }
+    auto done = *it;
+    chunk_assignments.erase(it);
+    release_chunk(done);
+    ChannelPublish("IMAGE_CHUNK", q.Uid, q.Data, chunk.Recipient);
+    fill_transfer(done.ImageUid, done.Requester);
+    refill_peer(done.Peer);
+}
+
+void
+Server::schedule_image_transfer(uint64_t img_id, uint64_t requester) {
+    static ResourceManager &rm    = ResourceManager::GetInstance();
+    static NetworkManager & nm    = NetworkManager::GetInstance();
+    auto &                  image = rm.Images[img_id];
+    // Clients on this machine get the whole image straight through shared memory
+    if (image.ChunkCount() == 0 || nm.IsLocalPeer(requester)) {
+        ChannelPublish("NEW_IMAGE", img_id, image, requester);
+        return;
+    }
+    // The preview skips ahead of the chunks, which go out on the bulk lane. If it is still being
+    // made it goes out from Update once it is ready.
+    auto &preview = rm.GetPreview(img_id);
+    if (!preview.Empty()) {
+        ChannelPublish("IMAGE_PREVIEW", img_id, preview, requester);
+    } else {
+        preview_waiters[img_id].insert(requester);
+    }
+    auto &transfer = image_transfers[std::make_pair(img_id, requester)];
+    for (uint32_t i = 0; i < image.ChunkCount(); i++) { transfer.Queued.push_back(i); }
+    fill_transfer(img_id, requester);
+}
+
+void
+Server::send_new_previews() {
+    static ResourceManager &rm = ResourceManager::GetInstance();
+    for (auto img_id : rm.TakeNewPreviews()) {
+        auto waiters = preview_waiters.find(img_id);
+        if (waiters == preview_waiters.end()) { continue; }
+        auto &preview = rm.GetPreview(img_id);
+        for (auto requester : waiters->second) {
+            if (!preview.Empty()) { ChannelPublish("IMAGE_PREVIEW", img_id, preview, requester); }
+        }
+        preview_waiters.erase(waiters);
+    }
+}
+
+void
+Server::fill_transfer(uint64_t img_id, uint64_t requester) {
+    static ResourceManager &rm       = ResourceManager::GetInstance();
+    auto                    transfer = image_transfers.find(std::make_pair(img_id, requester));
+    if (transfer == image_transfers.end()) { return; }
+    auto img = rm.Images.find(img_id);
+    if (img == rm.Images.end()) {
+        image_transfers.erase(transfer);
+        return;
+    }
+    auto                 swarm = swarms.find(img->second.Hash);
+    std::deque<uint32_t> waiting;
+    for (auto index : transfer->second.Queued) {
+        uint64_t peer = 0;
+        uint32_t load = MaxChunksPerPeer;
+        bool     held = false;
+        if (swarm != swarms.end() && index < swarm->second.ChunkHolders.size()) {
+            for (auto holder : swarm->second.ChunkHolders[index]) {
+                if (holder == requester || holder == 0) { continue; }
+                held             = true;
+                auto busy        = peer_load.find(holder);
+                auto holder_load = busy == peer_load.end() ? 0 : busy->second;
+                if (holder_load < load) {
+                    peer = holder;
+                    load = holder_load;
+                }
+            }
+        }
+        if (peer != 0) {
+            assign_chunk(img_id, index, requester, peer);
+        } else if (held) {
+            // Everyone holding it is busy, it goes to whoever finishes a chunk first
+            waiting.push_back(index);
+        } else {
+            // Nobody else has this chunk, send it from the host
+            ChannelPublish(
+                "IMAGE_CHUNK", img_id, img->second.Chunk(img_id, requester, index), requester);
+        }
+    }
+    transfer->second.Queued = std::move(waiting);
+    if (transfer->second.Queued.empty() && transfer->second.InFlight == 0) {
+        image_transfers.erase(transfer);
+    }
+}
+
+void
+Server::fill_transfers() {
+    std::vector<std::pair<uint64_t, uint64_t>> keys;
+    for (auto &[key, transfer] : image_transfers) { keys.push_back(key); }
+    for (auto &[img_id, requester] : keys) { fill_transfer(img_id, requester); }
+}
+
+void
+Server::refill_peer(uint64_t peer) {
+    static ResourceManager &rm = ResourceManager::GetInstance();
+    for (auto &[key, transfer] : image_transfers) {
+        if (peer_load[peer] >= MaxChunksPerPeer) { return; }
+        auto img = rm.Images.find(key.first);
+        if (key.second == peer || img == rm.Images.end()) { continue; }
+        auto swarm = swarms.find(img->second.Hash);
+        if (swarm == swarms.end()) { continue; }
+        auto &holders = swarm->second.ChunkHolders;
+        for (auto it = transfer.Queued.begin();
+             it != transfer.Queued.end() && peer_load[peer] < MaxChunksPerPeer;) {
+            if (*it < holders.size() && holders[*it].count(peer) > 0) {
+                auto index = *it;
+                it         = transfer.Queued.erase(it);
+                assign_chunk(key.first, index, key.second, peer);
+            } else {
+                it++;
+            }
         }
     }
 }
 
+void
+Server::assign_chunk(uint64_t img_id, uint32_t index, uint64_t requester, uint64_t peer) {
+    ChannelPublish("CHUNK_REQUEST", img_id, ImageChunk(img_id, requester, index), peer);
+    chunk_assignments.push_back(
+        ChunkAssignment{img_id, index, requester, peer, steady_clock::now() + ChunkTimeout});
+    peer_load[peer]++;
+    image_transfers[std::make_pair(img_id, requester)].InFlight++;
+}
+
+void
+Server::release_chunk(const ChunkAssignment &a) {
+    auto busy = peer_load.find(a.Peer);
+    if (busy != peer_load.end() && --busy->second == 0) { peer_load.erase(busy); }
+    auto transfer = image_transfers.find(std::make_pair(a.ImageUid, a.Requester));
+    if (transfer != image_transfers.end() && transfer->second.InFlight > 0) {
+        transfer->second.InFlight--;
+    }
+}
+
+void
+Server::expire_chunk_assignments() {
+    static ResourceManager &rm  = ResourceManager::GetInstance();
+    auto                    now = steady_clock::now();
+    auto                    it  = std::partition(
+        chunk_assignments.begin(),
+        chunk_assignments.end(),
+        [now](const ChunkAssignment &a) { return a.Deadline > now; });
+    if (it == chunk_assignments.end()) { return; }
+    std::vector<ChunkAssignment> expired(it, chunk_assignments.end());
+    chunk_assignments.erase(it, chunk_assignments.end());
+    for (auto &a : expired) {
+        release_chunk(a);
+        auto img = rm.Images.find(a.ImageUid);
+        if (img == rm.Images.end()) { continue; }
+        // The peer didn't deliver in time, stop handing it this chunk
+        auto swarm = swarms.find(img->second.Hash);
+        if (swarm != swarms.end() && a.Index < swarm->second.ChunkHolders.size()) {
+            swarm->second.ChunkHolders[a.Index].erase(a.Peer);
+        }
+        auto transfer = image_transfers.find(std::make_pair(a.ImageUid, a.Requester));
+        if (transfer != image_transfers.end()) { transfer->second.Queued.push_front(a.Index); }
+    }
+    // Chunks queued for the same peers may have nobody left to serve them
+    fill_transfers();
+}
+
 void
 Server::handle_client_disconnect(NetworkData &&q) {
     auto it = std::find_if(ConnectedClients.begin(), ConnectedClients.end(), [q](ClientInfo &c) {
         return c.Uid == q.Uid;
     });
     if (it != ConnectedClients.end()) { ConnectedClients.erase(it); }
+    Metrics::GetInstance().ConnectedClients = ConnectedClients.size();
+    if (spectators.erase(q.Uid) > 0) { return; }
     ChannelPublish("CLIENT_DELETE", q.Uid, 0);
+    release_viewer_slot(q.Uid);
+    std::vector<uint64_t> held;
+    for (auto &[piece_uid, lease] : leases) {
+        if (lease.Holder == q.Uid) { held.push_back(piece_uid); }
+    }
+    release_leases(held);
+    pending_image_requests.erase(
+        std::remove_if(
+            pending_image_requests.begin(),
+            pending_image_requests.end(),
+            [&q](const std::pair<uint64_t, uint64_t> &request) { return request.second == q.Uid; }),
+        pending_image_requests.end());
+    for (auto &[hash, swarm] : swarms) {
+        for (auto &holders : swarm.ChunkHolders) { holders.erase(q.Uid); }
+    }
+    // Hand chunks the client was serving to someone else, and drop the ones it was waiting on
+    auto gone = std::partition(
+        chunk_assignments.begin(),
+        chunk_assignments.end(),
+        [&q](const ChunkAssignment &a) { return a.Peer != q.Uid && a.Requester != q.Uid; });
+    for (auto it = gone; it != chunk_assignments.end(); it++) {
+        release_chunk(*it);
+        auto transfer = image_transfers.find(std::make_pair(it->ImageUid, it->Requester));
+        if (transfer != image_transfers.end()) { transfer->second.Queued.push_front(it->Index); }
+    }
+    chunk_assignments.erase(gone, chunk_assignments.end());
+    for (auto it = image_transfers.begin(); it != image_transfers.end();) {
+        it = it->first.second == q.Uid ? image_transfers.erase(it) : std::next(it);
+    }
+    peer_load.erase(q.Uid);
+    for (auto &[img_id, waiters] : preview_waiters) { waiters.erase(q.Uid); }
+    fill_transfers();
 }
 
 ClientServer::NetworkQueueCallback::NetworkQueueCallback(
     std::string                   channel_name,
     ClientServer::queue_handler_f cb)
-    : queue(NetworkManager::NetworkQueue::Subscribe(std::move(channel_name)))
+    : channel(channel_name)
+    , queue(NetworkManager::NetworkQueue::Subscribe(std::move(channel_name)))
     , callback(std::move(cb)) {}
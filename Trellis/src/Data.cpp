@@ -2,6 +2,8 @@
 
 #include "data.h"
 
+#include <algorithm>
+
 using std::make_unique, std::vector, std::byte, std::string;
 
 Data::NetworkData::NetworkData(std::vector<std::byte> data, uint64_t uid, uint64_t client_uid)
@@ -73,9 +75,133 @@ Data::ImageData::deserialize_impl(const vector<std::byte> &vec) {
     auto *    begin = reinterpret_cast<const unsigned char *>(vec.data());
     auto *    end   = begin + vec.size();
     d.Data          = vector<unsigned char>(begin, end);
+    d.Hash          = Util::hash_image(d.Data);
     return d;
 }
 
+uint32_t
+Data::ImageData::ChunkCount() const {
+    return static_cast<uint32_t>((Data.size() + ChunkSize - 1) / ChunkSize);
+}
+
+Data::ImageChunk
+Data::ImageData::Chunk(uint64_t image_uid, uint64_t recipient, uint32_t index) const {
+    ImageChunk c(image_uid, recipient, index);
+    c.TotalSize = Data.size();
+    c.Hash      = Hash;
+    c.Count     = ChunkCount();
+    auto begin  = Data.begin() + std::min(Data.size(), index * ChunkSize);
+    auto end    = Data.begin() + std::min(Data.size(), (index + 1) * ChunkSize);
+    c.Data      = vector<unsigned char>(begin, end);
+    return c;
+}
+
+Data::ImagePreview::ImagePreview(const unsigned char *pixels, int width, int height, int channels) {
+    if (!pixels || width <= 0 || height <= 0 || channels < 1 || channels > 4) { return; }
+    auto     w       = static_cast<uint32_t>(width);
+    auto     h       = static_cast<uint32_t>(height);
+    uint32_t longest = std::max(w, h);
+    Width            = longest > MaxSize ? std::max(1u, w * MaxSize / longest) : w;
+    Height           = longest > MaxSize ? std::max(1u, h * MaxSize / longest) : h;
+    Pixels.resize(Width * Height * 4);
+    for (uint32_t y = 0; y < Height; y++) {
+        uint32_t y0 = y * h / Height, y1 = std::max(y0 + 1, (y + 1) * h / Height);
+        for (uint32_t x = 0; x < Width; x++) {
+            uint32_t x0 = x * w / Width, x1 = std::max(x0 + 1, (x + 1) * w / Width);
+            uint32_t sum[4] = {};
+            for (uint32_t sy = y0; sy < y1; sy++) {
+                for (uint32_t sx = x0; sx < x1; sx++) {
+                    const unsigned char *p = pixels + (sy * w + sx) * channels;
+                    // Grey and grey-alpha images spread their first channel over red, green, blue
+                    bool grey = channels < 3;
+                    sum[0] += p[0];
+                    sum[1] += p[grey ? 0 : 1];
+                    sum[2] += p[grey ? 0 : 2];
+                    sum[3] += channels == 2 ? p[1] : channels == 4 ? p[3] : 255;
+                }
+            }
+            uint32_t count = (x1 - x0) * (y1 - y0);
+            for (int c = 0; c < 4; c++) {
+                Pixels[(y * Width + x) * 4 + c] = static_cast<unsigned char>(sum[c] / count);
+            }
+        }
+    }
+}
+
+bool
+Data::ImagePreview::Empty() const {
+    return Width == 0 || Height == 0 || Pixels.size() != Width * Height * 4;
+}
+
+std::vector<std::byte>
+Data::ImagePreview::Serialize() const {
+    vector<vector<byte>> bytes;
+    bytes.push_back(Util::serialize_vec(Width));
+    bytes.push_back(Util::serialize_vec(Height));
+    const byte *begin = reinterpret_cast<const byte *>(Pixels.data());
+    bytes.emplace_back(begin, begin + Pixels.size());
+    return Util::flatten(bytes);
+}
+
+Data::ImagePreview
+Data::ImagePreview::deserialize_impl(const vector<std::byte> &vec) {
+    ImagePreview p;
+    if (vec.size() < 2 * sizeof(uint32_t)) { return p; }
+    const byte *ptr = vec.data();
+    p.Width         = Util::deserialize<uint32_t>(ptr);
+    p.Height        = Util::deserialize<uint32_t>(ptr += sizeof(p.Width));
+    ptr += sizeof(p.Height);
+    auto *begin = reinterpret_cast<const unsigned char *>(ptr);
+    p.Pixels    = vector<unsigned char>(begin, begin + (vec.data() + vec.size() - ptr));
+    return p;
+}
+
+Data::ImageChunk::ImageChunk(uint64_t image_uid, uint64_t recipient, uint32_t index)
+    : ImageUid(image_uid)
+    , Recipient(recipient)
+    , Index(index) {}
+
+std::vector<std::byte>
+Data::ImageChunk::Serialize() const {
+    vector<vector<byte>> bytes;
+    bytes.push_back(Util::serialize_vec(ImageUid));
+    bytes.push_back(Util::serialize_vec(Recipient));
+    bytes.push_back(Util::serialize_vec(TotalSize));
+    bytes.push_back(Util::serialize_vec(Hash));
+    bytes.push_back(Util::serialize_vec(Index));
+    bytes.push_back(Util::serialize_vec(Count));
+    const byte *begin = reinterpret_cast<const byte *>(Data.data());
+    bytes.emplace_back(begin, begin + Data.size());
+    return Util::flatten(bytes);
+}
+
+bool
+Data::ImageChunk::Consistent() const {
+    if (TotalSize == 0 || TotalSize > ImageData::MaxSize) { return false; }
+    if (Count != (TotalSize + ImageData::ChunkSize - 1) / ImageData::ChunkSize) { return false; }
+    return Index < Count && Data.size() <= ImageData::ChunkSize &&
+           Index * ImageData::ChunkSize + Data.size() <= TotalSize;
+}
+
+Data::ImageChunk
+Data::ImageChunk::deserialize_impl(const vector<std::byte> &vec) {
+    ImageChunk  c;
+    const byte *ptr    = vec.data();
+    const byte *end    = vec.data() + vec.size();
+    size_t      header = 3 * sizeof(uint64_t) + sizeof(c.Hash) + 2 * sizeof(uint32_t);
+    if (vec.size() < header) { return c; }
+    c.ImageUid  = Util::deserialize<uint64_t>(ptr);
+    c.Recipient = Util::deserialize<uint64_t>(ptr += sizeof(c.ImageUid));
+    c.TotalSize = Util::deserialize<uint64_t>(ptr += sizeof(c.Recipient));
+    c.Hash      = Util::deserialize<size_t>(ptr += sizeof(c.TotalSize));
+    c.Index     = Util::deserialize<uint32_t>(ptr += sizeof(c.Hash));
+    c.Count     = Util::deserialize<uint32_t>(ptr += sizeof(c.Index));
+    ptr += sizeof(c.Count);
+    auto *begin = reinterpret_cast<const unsigned char *>(ptr);
+    c.Data      = vector<unsigned char>(begin, reinterpret_cast<const unsigned char *>(end));
+    return c;
+}
+
 Data::ChatMessage::ChatMessage(std::string sender_name, std::string msg, MsgTypeEnum msg_type)
     : SenderName(std::move(sender_name))
     , Msg(std::move(msg))
@@ -85,6 +211,38 @@ Data::ChatMessage::ChatMessage(std::string sender_name, std::string msg, MsgType
     TimeStamp = std::chrono::system_clock::to_time_t(t);
 }
 
+std::vector<std::byte>
+Data::PieceGroup::Serialize() const {
+    vector<vector<byte>> bytes;
+    bytes.push_back(Util::serialize_vec(static_cast<uint32_t>(Uids.size())));
+    bytes.push_back(Util::serialize_vec(static_cast<uint32_t>(Values.size())));
+    auto uids = reinterpret_cast<const byte *>(Uids.data());
+    bytes.emplace_back(uids, uids + Uids.size() * sizeof(uint64_t));
+    auto values = reinterpret_cast<const byte *>(Values.data());
+    bytes.emplace_back(values, values + Values.size() * sizeof(glm::vec2));
+    return Util::flatten(bytes);
+}
+
+Data::PieceGroup
+Data::PieceGroup::deserialize_impl(const vector<std::byte> &vec) {
+    PieceGroup  g;
+    const byte *ptr = vec.data();
+    const byte *end = vec.data() + vec.size();
+    if (vec.size() < 2 * sizeof(uint32_t)) { return g; }
+    auto uid_count   = Util::deserialize<uint32_t>(ptr);
+    auto value_count = Util::deserialize<uint32_t>(ptr += sizeof(uid_count));
+    ptr += sizeof(value_count);
+    size_t size = uid_count * sizeof(uint64_t) + value_count * sizeof(glm::vec2);
+    if (static_cast<size_t>(end - ptr) < size) { return g; }
+    g.Uids.resize(uid_count);
+    std::copy(ptr, ptr + uid_count * sizeof(uint64_t), reinterpret_cast<byte *>(g.Uids.data()));
+    ptr += uid_count * sizeof(uint64_t);
+    g.Values.resize(value_count);
+    auto values = reinterpret_cast<byte *>(g.Values.data());
+    std::copy(ptr, ptr + value_count * sizeof(glm::vec2), values);
+    return g;
+}
+
 std::vector<std::byte>
 Data::ChatMessage::Serialize() const {
     vector<vector<byte>> bytes;
@@ -0,0 +1,50 @@
+#include "frame_pacer.h"
+#include "glfw_handler.h"
+
+FramePacer &
+FramePacer::GetInstance() {
+    static FramePacer instance; // Guaranteed to be destroyed.
+    // Instantiated on first use.
+    return instance;
+}
+
+void
+FramePacer::Wake() {
+    woken = true;
+    if (waiting) { glfwPostEmptyEvent(); }
+}
+
+void
+FramePacer::WaitForNextFrame() {
+    GLFWwindow *window = GLFW::GetInstance().GetWindow();
+    // Nothing is seen while minimised, but the network still has to be kept up with
+    if (glfwGetWindowAttrib(window, GLFW_ICONIFIED)) {
+        glfwWaitEventsTimeout(MinimisedInterval);
+        last_frame = glfwGetTime();
+        return;
+    }
+    if (FrameCap > 0) {
+        double next = last_frame + 1.0 / FrameCap;
+        for (double now = glfwGetTime(); now < next; now = glfwGetTime()) {
+            glfwWaitEventsTimeout(next - now);
+        }
+    }
+    if (woken.exchange(false) || !RedrawOnDemand) {
+        settle = SettleFrames;
+        glfwPollEvents();
+    } else if (settle > 0) {
+        settle--;
+        glfwPollEvents();
+    } else {
+        // A wake after this is set posts an event, one before it is seen below
+        waiting = true;
+        double start = glfwGetTime();
+        if (!woken) { glfwWaitEventsTimeout(IdleTimeout); }
+        waiting = false;
+        // Woken early by an event none of the handlers wake for, a window refresh say
+        if (woken.exchange(false) || glfwGetTime() - start < IdleTimeout) {
+            settle = SettleFrames;
+        }
+    }
+    last_frame = glfwGetTime();
+}
@@ -1,3 +1,4 @@
+#include "frame_pacer.h"
 #include "gui.h"
 #include "glfw_handler.h"
 
@@ -27,9 +28,13 @@ GLFW::GetInstance() {
     return instance;
 }
 
+// Input always gets a frame drawn, even when the board doesn't handle it
+static FramePacer &pacer = FramePacer::GetInstance();
+
 static void
 window_size_handler(GLFWwindow *window, int width, int height) {
     (void)window;
+    pacer.Wake();
     screen_width  = width;
     screen_height = height;
     if (window_size_callback) { window_size_callback(width, height); }
@@ -38,6 +43,7 @@ window_size_handler(GLFWwindow *window, int width, int height) {
 static void
 key_handler(GLFWwindow *window, int key, int scancode, int action, int mods) {
     (void)window;
+    pacer.Wake();
     static GUI &gui = GUI::GetInstance();
     if (action == GLFW_PRESS) {
         if (gui.WantCaptureKeyboard) { return; }
@@ -54,6 +60,7 @@ key_handler(GLFWwindow *window, int key, int scancode, int action, int mods) {
 static void
 mouse_handler(GLFWwindow *window, int button, int action, int mods) {
     (void)window;
+    pacer.Wake();
     static GUI &gui = GUI::GetInstance();
     if (action == GLFW_PRESS) {
         if (gui.WantCaptureMouse) { return; }
@@ -70,6 +77,7 @@ mouse_handler(GLFWwindow *window, int button, int action, int mods) {
 static void
 scroll_handler(GLFWwindow *window, double xoffset, double yoffset) {
     (void)window;
+    pacer.Wake();
     static GUI &gui = GUI::GetInstance();
     if (gui.WantCaptureMouse) { return; }
     if (scroll_callback != nullptr) { scroll_callback(xoffset, yoffset); }
@@ -78,6 +86,7 @@ scroll_handler(GLFWwindow *window, double xoffset, double yoffset) {
 static void
 mouse_pos_handler(GLFWwindow *window, double x, double y) {
     (void)window;
+    pacer.Wake();
     if (mouse_pos_callback != nullptr) { mouse_pos_callback(x, y); }
 }
 
@@ -0,0 +1,86 @@
+#include "gl_state.h"
+
+GLState &
+GLState::GetInstance() {
+    static GLState instance; // Guaranteed to be destroyed.
+    // Instantiated on first use.
+    return instance;
+}
+
+GLState::GLState() {
+    Invalidate();
+}
+
+void
+GLState::UseProgram(GLuint value) {
+    if (change(program, value)) { glUseProgram(value); }
+}
+
+void
+GLState::ActiveTexture(GLenum unit) {
+    if (change(active_unit, unit)) { glActiveTexture(unit); }
+}
+
+void
+GLState::BindTexture(GLuint texture) {
+    size_t unit = active_unit - GL_TEXTURE0;
+    // Nothing is known about units that aren't tracked
+    if (active_unit == Unknown || unit >= textures.size()) {
+        Issued++;
+        glBindTexture(GL_TEXTURE_2D, texture);
+        return;
+    }
+    if (change(textures[unit], texture)) { glBindTexture(GL_TEXTURE_2D, texture); }
+}
+
+void
+GLState::BindVertexArray(GLuint value) {
+    if (change(vertex_array, value)) { glBindVertexArray(value); }
+}
+
+void
+GLState::SetBlend(bool enabled) {
+    if (!change(blend, static_cast<GLuint>(enabled))) { return; }
+    if (enabled) {
+        glEnable(GL_BLEND);
+    } else {
+        glDisable(GL_BLEND);
+    }
+}
+
+void
+GLState::BlendFunc(GLenum src, GLenum dst) {
+    if (change(blend_func, std::array<GLenum, 2>{src, dst})) { glBlendFunc(src, dst); }
+}
+
+void
+GLState::DeleteProgram(GLuint value) {
+    glDeleteProgram(value);
+    // A program that is in use stays in use until another replaces it, but the name may not
+    // mean the same program afterwards
+    if (program == value) { program = Unknown; }
+}
+
+void
+GLState::DeleteTexture(GLuint texture) {
+    glDeleteTextures(1, &texture);
+    for (auto &bound : textures) {
+        if (bound == texture) { bound = 0; }
+    }
+}
+
+void
+GLState::DeleteVertexArray(GLuint value) {
+    glDeleteVertexArrays(1, &value);
+    if (vertex_array == value) { vertex_array = 0; }
+}
+
+void
+GLState::Invalidate() {
+    program      = Unknown;
+    active_unit  = Unknown;
+    vertex_array = Unknown;
+    blend        = Unknown;
+    textures.fill(Unknown);
+    blend_func.fill(Unknown);
+}
@@ -1,9 +1,10 @@
-#include "client_server.h"
+#include "asset_fetcher.h"
 #include "resource_manager.h"
 #include "game_object.h"
-#include "sprite_renderer.h"
 #include "util.h"
 
+#include <cassert>
+#include <cstring>
 #include <string>
 
 using std::move, std::exchange, std::make_unique, std::vector, std::byte, std::to_string, std::stoi,
@@ -29,9 +30,43 @@ CoreGameObject::Serialize() const {
     bytes.push_back(Util::serialize_vec(Uid));
     bytes.push_back(Util::serialize_vec(Clickable));
     bytes.push_back(Util::serialize_vec(SpriteUid));
+    bytes.push_back(Util::serialize_vec(Visible));
+    bytes.push_back(Util::serialize_vec(static_cast<uint32_t>(Owners.size())));
+    for (auto owner : Owners) { bytes.push_back(Util::serialize_vec(owner)); }
+    bytes.push_back(Properties.SerializeFields());
     return Util::flatten(bytes);
 }
 
+vector<byte>
+PieceList::Serialize() const {
+    std::vector<std::vector<byte>> bytes;
+    bytes.push_back(Util::serialize_vec(static_cast<uint32_t>(Pieces.size())));
+    for (auto &piece : Pieces) {
+        auto piece_bytes = piece.Serialize();
+        bytes.push_back(Util::serialize_vec(static_cast<uint32_t>(piece_bytes.size())));
+        bytes.push_back(std::move(piece_bytes));
+    }
+    return Util::flatten(bytes);
+}
+
+PieceList
+PieceList::deserialize_impl(const vector<byte> &vec) {
+    PieceList   list;
+    const byte *ptr = vec.data();
+    const byte *end = vec.data() + vec.size();
+    if (vec.size() < sizeof(uint32_t)) { return list; }
+    auto count = Util::deserialize<uint32_t>(ptr);
+    ptr += sizeof(count);
+    for (uint32_t i = 0; i < count && static_cast<size_t>(end - ptr) >= sizeof(uint32_t); i++) {
+        auto len = Util::deserialize<uint32_t>(ptr);
+        ptr += sizeof(len);
+        if (static_cast<size_t>(end - ptr) < len) { break; }
+        list.Pieces.push_back(CoreGameObject::Deserialize(vector<byte>(ptr, ptr + len)));
+        ptr += len;
+    }
+    return list;
+}
+
 CoreGameObject
 CoreGameObject::deserialize_impl(const vector<byte> &vec) {
     CoreGameObject g;
@@ -41,28 +76,32 @@ CoreGameObject::deserialize_impl(const vector<byte> &vec) {
     g.Uid              = Util::deserialize<uint64_t>(ptr += sizeof(g.Color));
     g.Clickable        = Util::deserialize<bool>(ptr += sizeof(g.Uid));
     g.SpriteUid        = Util::deserialize<uint64_t>(ptr += sizeof(g.Clickable));
+    g.Visible          = Util::deserialize<Visibility>(ptr += sizeof(g.SpriteUid));
+    auto owner_count   = Util::deserialize<uint32_t>(ptr += sizeof(g.Visible));
+    ptr += sizeof(owner_count);
+    for (uint32_t i = 0; i < owner_count; i++, ptr += sizeof(uint64_t)) {
+        g.Owners.push_back(Util::deserialize<uint64_t>(ptr));
+    }
+    g.Properties.ApplyFields(ptr, vec.data() + vec.size() - ptr);
     return g;
 }
 
 GameObject::GameObject(const CoreGameObject &other) {
     static ResourceManager &rm = ResourceManager::GetInstance();
-    static ClientServer &   cs = ClientServer::GetInstance();
     (CoreGameObject &)*this    = other;
     if (Uid == 0) Uid = Util::generate_uid();
     if (rm.Images.find(SpriteUid) == rm.Images.end()) {
-        // Image isn't cached, need to request it
-        cs.ChannelPublish("IMAGE_REQUEST", cs.uid, SpriteUid);
+        // Image isn't cached, whoever adds the piece asks the fetcher for it
+        Sprite.Texture = rm.GetPreviewTexture(SpriteUid);
+        if (!Sprite.Texture) { Sprite.Texture = AssetFetcher::GetInstance().Placeholder(); }
+        sprite_pending = true;
     } else {
-        // Image is cached, just grab it from the resource manager
-        Sprite = rm.GetTexture(SpriteUid);
+        // Image is cached, just grab it from the resource manager. It may still be decoding.
+        Sprite = rm.GetSprite(SpriteUid);
+        if (!Sprite.Texture) { Sprite.Texture = AssetFetcher::GetInstance().Placeholder(); }
     }
 }
 
-GameObject::GameObject(const CoreGameObject &other, glm::mat4 &View)
-    : GameObject(other) {
-    renderer = make_unique<SpriteRenderer>(transform, View, Sprite);
-}
-
 GameObject &
 GameObject::operator=(const CoreGameObject &other) {
     (CoreGameObject &)*this = other;
@@ -70,18 +109,26 @@ GameObject::operator=(const CoreGameObject &other) {
 }
 
 void
-GameObject::Draw(int border_pixel_width) {
-    this->renderer->shader->SetInteger("border_width", border_pixel_width);
-    this->renderer->Draw();
+GameObject::Draw(SpriteBatch &batch, bool selected) const {
+    static ResourceManager &rm = ResourceManager::GetInstance();
+    // Huge images draw the tiles the view needs over their sprite, which is the whole image small
+    auto tiles = rm.VisibleTiles(SpriteUid, transform);
+    batch.Add(Sprite.Texture, transform, selected && tiles.empty(), glm::vec3(1), Sprite.UVRect);
+    for (auto &tile : tiles) { batch.AddPart(tile.Texture, transform, tile.Rect); }
+    if (selected && !tiles.empty()) { batch.AddOutline(transform); }
 }
 
 GameObject::GameObject(GameObject &&other) noexcept
     : Sprite(other.Sprite)
-    , renderer(exchange(other.renderer, nullptr)) {
+    , sprite_pending(other.sprite_pending) {
     transform = other.transform;
     Color     = other.Color;
     Uid       = exchange(other.Uid, -1);
+    SpriteUid = other.SpriteUid;
     Clickable = other.Clickable;
+    Visible    = other.Visible;
+    Owners     = move(other.Owners);
+    Properties = move(other.Properties);
 }
 
 GameObject &
@@ -97,13 +144,18 @@ GameObject::swap(GameObject &other) {
     swap(transform, other.transform);
     swap(Color, other.Color);
     swap(Uid, other.Uid);
+    swap(SpriteUid, other.SpriteUid);
     swap(Sprite, other.Sprite);
+    swap(sprite_pending, other.sprite_pending);
     swap(Clickable, other.Clickable);
-    swap(renderer, other.renderer);
+    swap(Visible, other.Visible);
+    swap(Owners, other.Owners);
+    swap(Properties, other.Properties);
 }
 void
 GameObject::WriteToDB(const SQLite::Database &db, uint64_t page_id) const {
-    auto stmt = db.Prepare("INSERT OR REPLACE INTO GameObjects VALUES(?,?,?,?,?,?,?,?,?,?,?,?);");
+    auto stmt =
+        db.Prepare("INSERT OR REPLACE INTO GameObjects VALUES(?,?,?,?,?,?,?,?,?,?,?,?,?);");
     stmt.Bind(1, Uid);
     stmt.Bind(2, Clickable);
     stmt.Bind(3, SpriteUid);
@@ -116,16 +168,33 @@ GameObject::WriteToDB(const SQLite::Database &db, uint64_t page_id) const {
     stmt.Bind(10, Color.x);
     stmt.Bind(11, Color.y);
     stmt.Bind(12, Color.z);
+    // Owners are session uids, so they aren't worth keeping once the game is closed
+    stmt.Bind(13, static_cast<int>(Visible));
     stmt.Step();
+    Properties.WriteToDB(db, Uid);
 }
 void
 GameObject::UpdateSprite(uint64_t sprite_uid) {
     if (SpriteUid == sprite_uid) {
         static ResourceManager &rm = ResourceManager::GetInstance();
-        Sprite                     = rm.GetTexture(sprite_uid);
+        Sprite                     = rm.GetSprite(sprite_uid);
+        sprite_pending             = false;
+        if (!Sprite.Texture) { Sprite.Texture = AssetFetcher::GetInstance().Placeholder(); }
     }
 }
 
+void
+GameObject::PreviewSprite(uint64_t sprite_uid) {
+    static ResourceManager &rm = ResourceManager::GetInstance();
+    if (SpriteUid != sprite_uid || !sprite_pending) { return; }
+    if (auto preview = rm.GetPreviewTexture(sprite_uid)) { Sprite = SpriteRegion{preview}; }
+}
+
+bool
+GameObject::SpritePending() const {
+    return sprite_pending;
+}
+
 CoreGameObject::CoreGameObject(const SQLite::Database &db, uint64_t uid) {
     static ResourceManager &rm = ResourceManager::GetInstance();
     using SQLite::from_uint64_t;
@@ -168,12 +237,16 @@ CoreGameObject::CoreGameObject(const SQLite::Database &db, uint64_t uid) {
 
         assert(!strcmp(names[11], "color_z"));
         core->Color.z = stof(values[11]);
+
+        assert(!strcmp(names[12], "visibility"));
+        core->Visible = static_cast<Visibility>(stoi(values[12]));
         return 0;
     };
     std::string err;
     int         result =
         db.Exec("SELECT * FROM GameObjects WHERE id = " + from_uint64_t(uid), err, +callback, this);
     if (result) { std::cerr << err << std::endl; }
+    Properties.ReadFromDB(db, Uid);
     rm.ReadFromDB(db, SpriteUid);
 }
 
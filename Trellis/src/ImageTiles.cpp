@@ -0,0 +1,281 @@
+#include "image_tiles.h"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+using std::vector;
+
+// QOI, see qoiformat.org. Lossless and simple enough to decode a tile in a fraction of the time
+// it takes to upload it.
+static const unsigned char QOI_OP_INDEX = 0x00;
+static const unsigned char QOI_OP_DIFF  = 0x40;
+static const unsigned char QOI_OP_LUMA  = 0x80;
+static const unsigned char QOI_OP_RUN   = 0xc0;
+static const unsigned char QOI_OP_RGB   = 0xfe;
+static const unsigned char QOI_OP_RGBA  = 0xff;
+static const unsigned char QOI_MASK     = 0xc0;
+static const size_t        QOI_HEADER   = 14;
+static const size_t        QOI_PADDING  = 8;
+
+using pixel = std::array<unsigned char, 4>;
+
+static int
+qoi_hash(const pixel &p) {
+    return (p[0] * 3 + p[1] * 5 + p[2] * 7 + p[3] * 11) % 64;
+}
+
+static void
+put_u32(vector<unsigned char> &out, uint32_t value) {
+    for (int shift = 24; shift >= 0; shift -= 8) { out.push_back((value >> shift) & 0xff); }
+}
+
+static uint32_t
+get_u32(const unsigned char *p) {
+    return uint32_t(p[0]) << 24 | uint32_t(p[1]) << 16 | uint32_t(p[2]) << 8 | p[3];
+}
+
+static vector<unsigned char>
+encode_qoi(const unsigned char *rgba, int width, int height) {
+    vector<unsigned char> out = {'q', 'o', 'i', 'f'};
+    put_u32(out, width);
+    put_u32(out, height);
+    out.push_back(4);
+    out.push_back(0);
+    std::array<pixel, 64> index{};
+    pixel                 prev  = {0, 0, 0, 255};
+    int                   run   = 0;
+    size_t                count = static_cast<size_t>(width) * height;
+    for (size_t i = 0; i < count; i++) {
+        pixel px;
+        std::memcpy(px.data(), rgba + i * 4, 4);
+        if (px == prev) {
+            if (++run == 62 || i == count - 1) {
+                out.push_back(QOI_OP_RUN | (run - 1));
+                run = 0;
+            }
+            continue;
+        }
+        if (run > 0) {
+            out.push_back(QOI_OP_RUN | (run - 1));
+            run = 0;
+        }
+        int hash = qoi_hash(px);
+        if (index[hash] == px) {
+            out.push_back(QOI_OP_INDEX | hash);
+        } else if (px[3] != prev[3]) {
+            index[hash] = px;
+            out.insert(out.end(), {QOI_OP_RGBA, px[0], px[1], px[2], px[3]});
+        } else {
+            index[hash] = px;
+            auto vr   = static_cast<signed char>(px[0] - prev[0]);
+            auto vg   = static_cast<signed char>(px[1] - prev[1]);
+            auto vb   = static_cast<signed char>(px[2] - prev[2]);
+            int  vg_r = vr - vg;
+            int  vg_b = vb - vg;
+            if (vr > -3 && vr < 2 && vg > -3 && vg < 2 && vb > -3 && vb < 2) {
+                out.push_back(QOI_OP_DIFF | (vr + 2) << 4 | (vg + 2) << 2 | (vb + 2));
+            } else if (vg_r > -9 && vg_r < 8 && vg > -33 && vg < 32 && vg_b > -9 && vg_b < 8) {
+                out.push_back(QOI_OP_LUMA | (vg + 32));
+                out.push_back((vg_r + 8) << 4 | (vg_b + 8));
+            } else {
+                out.insert(out.end(), {QOI_OP_RGB, px[0], px[1], px[2]});
+            }
+        }
+        prev = px;
+    }
+    out.insert(out.end(), {0, 0, 0, 0, 0, 0, 0, 1});
+    return out;
+}
+
+// Nothing unless the data is a complete RGBA image of the expected size
+static vector<unsigned char>
+decode_qoi(const unsigned char *data, size_t size, int width, int height) {
+    if (size < QOI_HEADER + QOI_PADDING || std::memcmp(data, "qoif", 4) != 0 ||
+        get_u32(data + 4) != static_cast<uint32_t>(width) ||
+        get_u32(data + 8) != static_cast<uint32_t>(height) || data[12] != 4) {
+        return {};
+    }
+    size_t                count = static_cast<size_t>(width) * height;
+    vector<unsigned char> rgba(count * 4);
+    std::array<pixel, 64> index{};
+    pixel                 px  = {0, 0, 0, 255};
+    int                   run = 0;
+    const unsigned char * p   = data + QOI_HEADER;
+    const unsigned char * end = data + size - QOI_PADDING;
+    for (size_t i = 0; i < count; i++) {
+        if (run > 0) {
+            run--;
+        } else {
+            if (p >= end) { return {}; }
+            unsigned char b1 = *p++;
+            if (b1 == QOI_OP_RGB) {
+                if (end - p < 3) { return {}; }
+                px = {p[0], p[1], p[2], px[3]};
+                p += 3;
+            } else if (b1 == QOI_OP_RGBA) {
+                if (end - p < 4) { return {}; }
+                px = {p[0], p[1], p[2], p[3]};
+                p += 4;
+            } else if ((b1 & QOI_MASK) == QOI_OP_INDEX) {
+                px = index[b1];
+            } else if ((b1 & QOI_MASK) == QOI_OP_DIFF) {
+                px[0] += ((b1 >> 4) & 0x03) - 2;
+                px[1] += ((b1 >> 2) & 0x03) - 2;
+                px[2] += (b1 & 0x03) - 2;
+            } else if ((b1 & QOI_MASK) == QOI_OP_LUMA) {
+                if (p >= end) { return {}; }
+                unsigned char b2 = *p++;
+                int           vg = (b1 & 0x3f) - 32;
+                px[0] += vg - 8 + ((b2 >> 4) & 0x0f);
+                px[1] += vg;
+                px[2] += vg - 8 + (b2 & 0x0f);
+            } else {
+                run = b1 & 0x3f;
+            }
+            index[qoi_hash(px)] = px;
+        }
+        std::memcpy(rgba.data() + i * 4, px.data(), 4);
+    }
+    return rgba;
+}
+
+// Half the size, every pixel the average of the up to four below it
+static vector<unsigned char>
+downsample(const unsigned char *pixels, glm::ivec2 size, glm::ivec2 half, int channels) {
+    vector<unsigned char> out(static_cast<size_t>(half.x) * half.y * channels);
+    for (int y = 0; y < half.y; y++) {
+        int y0 = 2 * y, y1 = std::min(2 * y + 1, size.y - 1);
+        for (int x = 0; x < half.x; x++) {
+            int x0 = 2 * x, x1 = std::min(2 * x + 1, size.x - 1);
+            for (int c = 0; c < channels; c++) {
+                auto at = [&](int px, int py) {
+                    return pixels[(static_cast<size_t>(py) * size.x + px) * channels + c];
+                };
+                int sum = at(x0, y0) + at(x1, y0) + at(x0, y1) + at(x1, y1);
+                out[(static_cast<size_t>(y) * half.x + x) * channels + c] =
+                    static_cast<unsigned char>((sum + 2) / 4);
+            }
+        }
+    }
+    return out;
+}
+
+// Copy part of an image out as RGBA, grey spreads over red, green and blue
+static vector<unsigned char>
+extract_rgba(const unsigned char *pixels, int stride, int channels, glm::ivec4 rect) {
+    vector<unsigned char> out(static_cast<size_t>(rect.z) * rect.w * 4);
+    unsigned char *       dst = out.data();
+    for (int y = rect.y; y < rect.y + rect.w; y++) {
+        const unsigned char *src = pixels + (static_cast<size_t>(y) * stride + rect.x) * channels;
+        for (int x = 0; x < rect.z; x++, src += channels, dst += 4) {
+            bool grey = channels < 3;
+            dst[0]    = src[0];
+            dst[1]    = src[grey ? 0 : 1];
+            dst[2]    = src[grey ? 0 : 2];
+            dst[3]    = channels == 2 ? src[1] : channels == 4 ? src[3] : 255;
+        }
+    }
+    return out;
+}
+
+ImageTiles::ImageTiles(int width, int height)
+    : Width(width)
+    , Height(height)
+    , Levels(1) {
+    for (int size = std::max(width, height); size > TileSize; size = (size + 1) / 2) { Levels++; }
+}
+
+glm::ivec2
+ImageTiles::LevelSize(int level) const {
+    int round = (1 << level) - 1;
+    return glm::ivec2((Width + round) >> level, (Height + round) >> level);
+}
+
+glm::ivec2
+ImageTiles::TileCount(int level) const {
+    return (LevelSize(level) + TileSize - 1) / TileSize;
+}
+
+glm::ivec2
+ImageTiles::TileExtent(int level, int x, int y) const {
+    auto size = LevelSize(level);
+    return glm::min(glm::ivec2(TileSize), size - glm::ivec2(x, y) * TileSize);
+}
+
+glm::vec4
+ImageTiles::TileRect(int level, int x, int y) const {
+    glm::vec2 size = LevelSize(level);
+    glm::vec2 offset(glm::ivec2(x, y) * TileSize);
+    glm::vec2 extent(TileExtent(level, x, y));
+    return glm::vec4(offset / size, extent / size);
+}
+
+uint64_t
+ImageTiles::Key(int level, int x, int y) {
+    return uint64_t(level) << 48 | uint64_t(y) << 24 | uint64_t(x);
+}
+
+void
+ImageTiles::Build(
+    const SQLite::Database &db,
+    std::mutex &            db_mtx,
+    uint64_t                hash,
+    const unsigned char *   pixels,
+    int                     channels) const {
+    // Every level is made from the one below, so only two are ever held at once
+    vector<unsigned char> level_pixels;
+    for (int level = 0; level < Levels; level++) {
+        auto size = LevelSize(level);
+        if (level > 0) {
+            level_pixels = downsample(pixels, LevelSize(level - 1), size, channels);
+            pixels       = level_pixels.data();
+        }
+        auto count = TileCount(level);
+        for (int y = 0; y < count.y; y++) {
+            vector<vector<unsigned char>> row;
+            for (int x = 0; x < count.x; x++) {
+                auto extent = TileExtent(level, x, y);
+                auto rect   = glm::ivec4(x * TileSize, y * TileSize, extent.x, extent.y);
+                auto rgba   = extract_rgba(pixels, size.x, channels, rect);
+                row.push_back(encode_qoi(rgba.data(), extent.x, extent.y));
+            }
+            const std::lock_guard<std::mutex> lock(db_mtx);
+            std::string                       err;
+            if (db.Exec("BEGIN;", err)) { throw std::runtime_error(err); }
+            try {
+                for (int x = 0; x < count.x; x++) {
+                    auto stmt = db.Prepare("INSERT OR REPLACE INTO ImageTiles VALUES(?,?,?,?,?);");
+                    stmt.Bind(1, hash);
+                    stmt.Bind(2, level);
+                    stmt.Bind(3, x);
+                    stmt.Bind(4, y);
+                    stmt.Bind(5, row[x].data(), row[x].size());
+                    stmt.Step();
+                }
+            } catch (...) {
+                db.Exec("ROLLBACK;", err);
+                throw;
+            }
+            if (db.Exec("COMMIT;", err)) { throw std::runtime_error(err); }
+        }
+    }
+}
+
+vector<unsigned char>
+ImageTiles::ReadTile(const SQLite::Database &db, uint64_t hash, int level, int x, int y) const {
+    auto stmt = db.Prepare(
+        "SELECT data FROM ImageTiles WHERE image_hash = ? AND level = ? AND x = ? AND y = ?;");
+    stmt.Bind(1, hash);
+    stmt.Bind(2, level);
+    stmt.Bind(3, x);
+    stmt.Bind(4, y);
+    if (stmt.Step()) { return {}; }
+    const void *data;
+    stmt.Column(0, data);
+    auto extent = TileExtent(level, x, y);
+    auto size   = static_cast<size_t>(stmt.ColumnSize(0));
+    return decode_qoi(static_cast<const unsigned char *>(data), size, extent.x, extent.y);
+}
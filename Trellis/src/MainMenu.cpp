@@ -122,6 +122,8 @@ MainMenu::Draw() {
             Dummy(ImVec2(0.0f, 10.0f));
             InputInt("Port", &port_buf);
             Dummy(ImVec2(0.0f, 10.0f));
+            Checkbox("Spectate", &spectate_buf);
+            Dummy(ImVec2(0.0f, 10.0f));
             if (Button("Join", glm::vec2(GetWindowSize().x, 0.0f))) { join_game(); }
             Dummy(ImVec2(0.0f, 10.0f));
             if (Button("Back", glm::vec2(GetWindowSize().x, 0.0f))) { clear_flags(); }
@@ -157,6 +159,7 @@ MainMenu::load_game(uint64_t id, const std::string &name) const {
 void
 MainMenu::join_game() const {
     ClientServer &cs = ClientServer::GetInstance(ClientServer::CLIENT);
+    cs.Spectator     = spectate_buf;
     cs.Start(port_buf, client_name_buf, host_name_buf);
 }
 
@@ -179,6 +182,7 @@ MainMenu::clear_flags() {
     joining_game      = false;
     client_name_buf   = "";
     host_name_buf     = "";
+    spectate_buf      = false;
     // TODO only for testing purposes so don't have to retype
     host_name_buf = "localhost";
 }
@@ -0,0 +1,196 @@
+#include "metrics.h"
+
+#include <sstream>
+
+using std::string, std::chrono::steady_clock, std::chrono::duration_cast,
+    std::chrono::microseconds, std::chrono::seconds;
+
+// Sampled gauges stay live for this long after the last scrape
+static const int64_t SCRAPE_WINDOW_SECONDS = 60;
+
+Metrics &
+Metrics::GetInstance() {
+    static Metrics instance; // Guaranteed to be destroyed.
+    // Instantiated on first use.
+    return instance;
+}
+
+int
+Metrics::channel_slot(const string &channel) const {
+    size_t count = channel_count.load(std::memory_order_acquire);
+    for (size_t i = 0; i < count; i++) {
+        if (channel_names[i] == channel) { return static_cast<int>(i); }
+    }
+    return -1;
+}
+
+void
+Metrics::RegisterChannel(const string &channel) {
+    const std::lock_guard<std::mutex> lock(register_mtx);
+    if (channel_slot(channel) >= 0) { return; }
+    size_t count = channel_count.load(std::memory_order_relaxed);
+    if (count == MaxChannels) { return; }
+    channel_names[count] = channel;
+    channel_count.store(count + 1, std::memory_order_release);
+}
+
+void
+Metrics::RecordMessage(const string &channel, Direction dir, size_t bytes) {
+    int slot = channel_slot(channel);
+    if (slot < 0) { return; }
+    channels[slot].Messages[dir].fetch_add(1, std::memory_order_relaxed);
+    channels[slot].Bytes[dir].fetch_add(bytes, std::memory_order_relaxed);
+}
+
+void
+Metrics::RecordDbSave(steady_clock::duration duration) {
+    auto us = duration_cast<microseconds>(duration).count();
+    DbSaves.fetch_add(1, std::memory_order_relaxed);
+    DbSaveMicrosTotal.fetch_add(us, std::memory_order_relaxed);
+    DbSaveMicrosLast.store(us, std::memory_order_relaxed);
+}
+
+bool
+Metrics::Scraping() const {
+    auto now = duration_cast<seconds>(steady_clock::now().time_since_epoch()).count();
+    return now - last_scrape.load(std::memory_order_relaxed) < SCRAPE_WINDOW_SECONDS;
+}
+
+// Label values are quoted, so backslashes, quotes and newlines in them have to be escaped
+static string
+escape_label(const string &value) {
+    string escaped;
+    for (char c : value) {
+        if (c == '\\' || c == '"') {
+            escaped += '\\';
+            escaped += c;
+        } else if (c == '\n') {
+            escaped += "\\n";
+        } else {
+            escaped += c;
+        }
+    }
+    return escaped;
+}
+
+// Counters and byte gauges stay integers so they are printed exactly, a double would round them
+// to six significant digits
+template<class T>
+static void
+write_metric(
+    std::ostringstream &out,
+    const char *        name,
+    const char *        type,
+    const char *        help,
+    T                   value) {
+    out << "# HELP " << name << " " << help << "\n";
+    out << "# TYPE " << name << " " << type << "\n";
+    out << name << " " << value << "\n";
+}
+
+string
+Metrics::Render() {
+    last_scrape.store(
+        duration_cast<seconds>(steady_clock::now().time_since_epoch()).count(),
+        std::memory_order_relaxed);
+    std::ostringstream out;
+    write_metric(
+        out,
+        "trellis_connected_clients",
+        "gauge",
+        "Clients connected to the server, including the host.",
+        ConnectedClients.load());
+    write_metric(
+        out,
+        "trellis_write_queue_depth",
+        "gauge",
+        "Messages waiting to be written to sockets.",
+        WriteQueueDepth.load());
+    write_metric(
+        out,
+        "trellis_read_queue_depth",
+        "gauge",
+        "Received messages waiting to be handled by the game loop.",
+        ReadQueueDepth.load());
+    write_metric(
+        out,
+        "trellis_image_cache_bytes",
+        "gauge",
+        "Encoded image bytes held by the resource manager.",
+        ImageCacheBytes.load());
+    write_metric(
+        out,
+        "trellis_image_cache_images",
+        "gauge",
+        "Images held by the resource manager.",
+        ImageCacheCount.load());
+    write_metric(
+        out,
+        "trellis_texture_resident_bytes",
+        "gauge",
+        "GPU memory used by image textures, outside the atlas.",
+        TextureResidentBytes.load());
+    write_metric(
+        out,
+        "trellis_texture_evicted_bytes",
+        "gauge",
+        "GPU memory image textures would use if they hadn't been evicted.",
+        TextureEvictedBytes.load());
+    write_metric(
+        out,
+        "trellis_frame_seconds",
+        "gauge",
+        "Time spent updating and drawing the last frame, without the wait for the next one.",
+        FrameMicros.load() / 1e6);
+    write_metric(
+        out,
+        "trellis_gl_state_changes_total",
+        "counter",
+        "Program, texture, vertex array and blend changes passed on to the driver.",
+        GLStateChanges.load());
+    write_metric(
+        out,
+        "trellis_gl_state_changes_skipped_total",
+        "counter",
+        "State changes skipped because the state was already set.",
+        GLStateChangesSkipped.load());
+    write_metric(
+        out,
+        "trellis_db_saves_total",
+        "counter",
+        "Number of times the game has been written to SQLite.",
+        DbSaves.load());
+    write_metric(
+        out,
+        "trellis_db_save_seconds_total",
+        "counter",
+        "Total time spent writing the game to SQLite.",
+        DbSaveMicrosTotal.load() / 1e6);
+    write_metric(
+        out,
+        "trellis_db_save_last_seconds",
+        "gauge",
+        "Duration of the last SQLite save.",
+        DbSaveMicrosLast.load() / 1e6);
+
+    const char *dirs[] = {"in", "out"};
+    size_t      count  = channel_count.load(std::memory_order_acquire);
+    out << "# HELP trellis_channel_messages_total Messages sent or received per channel.\n";
+    out << "# TYPE trellis_channel_messages_total counter\n";
+    for (size_t i = 0; i < count; i++) {
+        for (int d = IN; d <= OUT; d++) {
+            out << "trellis_channel_messages_total{channel=\"" << escape_label(channel_names[i])
+                << "\",direction=\"" << dirs[d] << "\"} " << channels[i].Messages[d].load()
+                << "\n";
+        }
+    }
+    out << "# HELP trellis_channel_bytes_total Bytes sent or received per channel.\n";
+    out << "# TYPE trellis_channel_bytes_total counter\n";
+    for (size_t i = 0; i < count; i++) {
+        for (int d = IN; d <= OUT; d++) {
+            out << "trellis_channel_bytes_total{channel=\"" << escape_label(channel_names[i])
+                << "\",direction=\"" << dirs[d] << "\"} " << channels[i].Bytes[d].load() << "\n";
+        }
+    }
+    return out.str();
+}
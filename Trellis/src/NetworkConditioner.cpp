@@ -0,0 +1,154 @@
+#include "network_conditioner.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <nlohmann/json.hpp>
+
+using nlohmann::json, std::string, std::chrono::microseconds, std::chrono::milliseconds;
+
+static json
+profile_to_json(const NetworkConditioner::Profile &p) {
+    return json{
+        {"latency_ms", p.LatencyMs},
+        {"jitter_ms", p.JitterMs},
+        {"bandwidth_kbps", p.BandwidthKbps}};
+}
+
+static NetworkConditioner::Profile
+profile_from_json(const json &j) {
+    NetworkConditioner::Profile p;
+    p.LatencyMs     = std::max(0, j.value("latency_ms", 0));
+    p.JitterMs      = std::max(0, j.value("jitter_ms", 0));
+    p.BandwidthKbps = std::max(0, j.value("bandwidth_kbps", 0));
+    return p;
+}
+
+bool
+NetworkConditioner::Profile::Active() const {
+    return LatencyMs > 0 || JitterMs > 0 || BandwidthKbps > 0;
+}
+
+NetworkConditioner &
+NetworkConditioner::GetInstance() {
+    static NetworkConditioner instance; // Guaranteed to be destroyed.
+    // Instantiated on first use.
+    return instance;
+}
+
+NetworkConditioner::NetworkConditioner()
+    : rng(std::random_device()()) {}
+
+bool
+NetworkConditioner::LoadConfig(const string &path) {
+    std::ifstream infile(path);
+    if (!infile) { return false; }
+    try {
+        json                        j = json::parse(infile);
+        std::map<uint64_t, Profile> loaded;
+        if (j.contains("default")) { loaded[DefaultProfile] = profile_from_json(j.at("default")); }
+        if (j.contains("connections")) {
+            for (auto &[uid, p] : j.at("connections").items()) {
+                loaded[std::stoull(uid)] = profile_from_json(p);
+            }
+        }
+        const std::lock_guard<std::mutex> lock(mtx);
+        profiles = loaded;
+        update_enabled();
+        std::cout << "Loaded network conditioner profiles from " << path << std::endl;
+        return true;
+    } catch (std::exception &e) {
+        std::cout << "Network conditioner config error: " << e.what() << std::endl;
+        return false;
+    }
+}
+
+bool
+NetworkConditioner::SaveConfig(const string &path) {
+    json j;
+    j["connections"] = json::object();
+    {
+        const std::lock_guard<std::mutex> lock(mtx);
+        for (auto &[uid, p] : profiles) {
+            if (uid == DefaultProfile) {
+                j["default"] = profile_to_json(p);
+            } else {
+                j["connections"][std::to_string(uid)] = profile_to_json(p);
+            }
+        }
+    }
+    std::ofstream outfile(path);
+    if (!outfile) { return false; }
+    outfile << j.dump(4);
+    return true;
+}
+
+NetworkConditioner::Profile &
+NetworkConditioner::profile_for(uint64_t uid) {
+    auto it = profiles.find(uid);
+    if (it != profiles.end()) { return it->second; }
+    return profiles[DefaultProfile];
+}
+
+void
+NetworkConditioner::update_enabled() {
+    enabled = std::any_of(profiles.begin(), profiles.end(), [](auto &kv) {
+        return kv.second.Active();
+    });
+}
+
+NetworkConditioner::Profile
+NetworkConditioner::GetProfile(uint64_t uid) {
+    const std::lock_guard<std::mutex> lock(mtx);
+    return profile_for(uid);
+}
+
+void
+NetworkConditioner::SetProfile(uint64_t uid, const Profile &profile) {
+    const std::lock_guard<std::mutex> lock(mtx);
+    profiles[uid] = profile;
+    update_enabled();
+}
+
+void
+NetworkConditioner::ClearProfile(uint64_t uid) {
+    const std::lock_guard<std::mutex> lock(mtx);
+    profiles.erase(uid);
+    update_enabled();
+}
+
+bool
+NetworkConditioner::HasProfile(uint64_t uid) {
+    const std::lock_guard<std::mutex> lock(mtx);
+    return profiles.find(uid) != profiles.end();
+}
+
+std::optional<NetworkConditioner::clock::time_point>
+NetworkConditioner::Schedule(uint64_t uid, Direction dir, size_t bytes) {
+    // Unconditioned runs never touch the lock
+    if (!enabled) { return std::nullopt; }
+    const std::lock_guard<std::mutex> lock(mtx);
+    const Profile &                   p = profile_for(uid);
+    if (!p.Active()) { return std::nullopt; }
+    auto  now  = clock::now();
+    Link &link = links[std::make_pair(uid, dir)];
+
+    // Serialise the message onto the link at the capped rate
+    auto start = std::max(now, link.BusyUntil);
+    if (p.BandwidthKbps > 0) {
+        auto us        = static_cast<int64_t>(bytes) * 8 * 1000 / p.BandwidthKbps;
+        link.BusyUntil = start + microseconds(us);
+    } else {
+        link.BusyUntil = start;
+    }
+
+    // Then delay it by the propagation latency, never releasing ahead of an earlier message
+    int delay_ms = p.LatencyMs;
+    if (p.JitterMs > 0) {
+        std::uniform_int_distribution<int> dist(-p.JitterMs, p.JitterMs);
+        delay_ms = std::max(0, delay_ms + dist(rng));
+    }
+    auto release     = std::max(link.BusyUntil + milliseconds(delay_ms), link.LastRelease);
+    link.LastRelease = release;
+    return release;
+}
@@ -1,4 +1,7 @@
 #include "data.h"
+#include "frame_pacer.h"
+#include "metrics.h"
+#include "network_conditioner.h"
 #include "network_manager.h"
 #include "util.h"
 
@@ -11,6 +14,10 @@ using Data::NetworkData;
 
 NetworkManager &NetworkManager::NetworkQueue::nm = NetworkManager::GetInstance();
 
+static Metrics &           metrics     = Metrics::GetInstance();
+static NetworkConditioner &conditioner = NetworkConditioner::GetInstance();
+static FramePacer &        pacer       = FramePacer::GetInstance();
+
 NetworkManager &
 NetworkManager::GetInstance() {
     static NetworkManager instance; // Guaranteed to be destroyed.
@@ -20,8 +27,10 @@ NetworkManager::GetInstance() {
 
 void
 NetworkManager::StartServer(int port) {
-    if (net_obj != nullptr) { return; }
+    if (net_obj != nullptr || replay) { return; }
     std::cout << "Starting server" << std::endl;
+    conditioner.LoadConfig();
+    start_recording(SessionLog::HOST);
     net_obj      = std::make_unique<NetworkManager::server>(context, port);
     net_obj->uid = 0;
 }
@@ -31,14 +40,48 @@ NetworkManager::StartClient(
     std::string client_name,
     uint64_t    client_uid,
     std::string hostname,
-    int         port) {
-    if (net_obj != nullptr) { return; }
+    int         port,
+    bool        spectator) {
+    if (net_obj != nullptr || replay) { return; }
     std::cout << "Starting client" << std::endl;
-    net_obj =
-        std::make_unique<NetworkManager::client>(client_name, client_uid, context, hostname, port);
+    conditioner.LoadConfig();
+    start_recording(SessionLog::CLIENT);
+    net_obj = std::make_unique<NetworkManager::client>(
+        client_name,
+        client_uid,
+        context,
+        hostname,
+        port,
+        spectator);
     net_obj->uid = client_uid;
 }
 
+void
+NetworkManager::StartRelay(
+    std::string relay_name,
+    std::string hostname,
+    int         port,
+    int         listen_port) {
+    if (net_obj != nullptr || replay) { return; }
+    std::cout << "Starting relay" << std::endl;
+    conditioner.LoadConfig();
+    net_obj = std::make_unique<NetworkManager::relay>(
+        relay_name,
+        context,
+        hostname,
+        port,
+        listen_port);
+}
+
+void
+NetworkManager::StartMetrics(std::string address, int port) {
+    if (net_obj == nullptr || metrics_obj != nullptr) { return; }
+    try {
+        metrics_obj = std::make_unique<NetworkManager::metrics_server>(context, address, port);
+        std::cout << "Serving metrics on " << address << ":" << port << std::endl;
+    } catch (std::exception &e) { std::cout << "Metrics Error: " << e.what() << std::endl; }
+}
+
 void
 NetworkManager::HttpGetRequest(
     std::string                      hostname,
@@ -49,8 +92,111 @@ NetworkManager::HttpGetRequest(
     });
 }
 
+void
+NetworkManager::Dispatch(const std::string &channel, const std::vector<std::byte> &data) {
+    // Conditioned messages are dispatched from timers on the io threads, so don't insert here
+    auto it = queues.find(channel);
+    if (it == queues.end()) { return; }
+    for (auto &ptr : it->second) {
+        if (auto q = ptr.lock()) { q->Push(data); }
+    }
+}
+
+bool
+NetworkManager::IsLocalPeer(uint64_t uid) {
+    return net_obj && net_obj->shm_ready(uid);
+}
+
+void
+NetworkManager::RecordSession(std::string path) {
+    record_path = std::move(path);
+}
+
+void
+NetworkManager::start_recording(SessionLog::Role role) {
+    if (record_path.empty()) { return; }
+    recorder = SessionRecorder::Create(record_path, role);
+    if (recorder) {
+        std::cout << "Recording session to " << record_path << std::endl;
+    } else {
+        std::cout << "Recording Error: couldn't create " << record_path << std::endl;
+    }
+}
+
+void
+NetworkManager::receive(const std::string &channel, const std::vector<std::byte> &data) {
+    if (recorder) { recorder->Write(SessionLog::IN, 0, channel, data); }
+    Dispatch(channel, data);
+}
+
+void
+NetworkManager::send(Message msg) {
+    if (recorder) {
+        recorder->Write(SessionLog::OUT, msg.Header.Uid, msg.Header.Channel, msg.RawMsg());
+    }
+    // Nothing goes out while a session is being replayed
+    if (net_obj) { net_obj->Write(std::move(msg)); }
+}
+
+std::optional<SessionLog::Role>
+NetworkManager::StartReplay(const std::string &path, bool fast) {
+    if (net_obj != nullptr || replay) { return std::nullopt; }
+    replay = SessionReader::Open(path);
+    if (!replay) {
+        std::cout << "Replay Error: couldn't read session log " << path << std::endl;
+        return std::nullopt;
+    }
+    std::cout << "Replaying " << path << (fast ? " as fast as possible" : " in real time")
+              << std::endl;
+    replay_fast   = fast;
+    replay_clock  = 0;
+    replay_frames = 0;
+    replay_start  = std::chrono::steady_clock::now();
+    return replay->Role();
+}
+
+void
+NetworkManager::replay_frame() {
+    using std::chrono::duration_cast, std::chrono::steady_clock;
+    const SessionLog::Record *next = replay->Peek();
+    if (!next) {
+        auto elapsed =
+            duration_cast<std::chrono::milliseconds>(steady_clock::now() - replay_start).count();
+        std::cout << "Replay finished, " << replay_frames << " frames in " << elapsed << "ms"
+                  << std::endl;
+        replay.reset();
+        return;
+    }
+    replay_frames++;
+    if (replay_fast) {
+        // Jump straight to the next message if nothing happened for a while
+        replay_clock = std::max(replay_clock + ReplayFrame.count(), next->Micros);
+    } else {
+        replay_clock =
+            duration_cast<std::chrono::microseconds>(steady_clock::now() - replay_start).count();
+    }
+    while ((next = replay->Peek()) && next->Micros <= replay_clock) {
+        auto rec = replay->Next();
+        // Sent frames are only logged for reference, the replayed session produces its own. The
+        // exception is a host's pages and pieces, which only made it into the log as it sent them
+        // out, and which everything received refers to.
+        bool board = rec->Channel == "ADD_PAGE" || rec->Channel == "ADD_PIECE" ||
+                     rec->Channel == "ADD_PIECES";
+        if (rec->Dir != SessionLog::IN && !(board && replay->Role() == SessionLog::HOST)) {
+            continue;
+        }
+        Dispatch(rec->Channel, rec->Data);
+        // Whatever follows is handled by a board that only exists once this has been processed
+        if (rec->Channel == "JOIN_ACCEPT") { break; }
+    }
+}
+
 void
 NetworkManager::Update() {
+    if (replay) {
+        replay_frame();
+        pacer.Wake();
+    }
     if (net_obj) {
         if (net_obj->http_mtx.try_lock()) {
             for (auto &kv : net_obj->http_get_response) {
@@ -88,10 +234,20 @@ NetworkManager::NetworkQueue::Subscribe(std::string cname) {
     auto ptr          = std::shared_ptr<NetworkQueue>(new NetworkQueue());
     ptr->wptr         = ptr;
     ptr->channel_name = cname;
+    metrics.RegisterChannel(cname);
     nm.queues[cname].push_back(ptr->wptr);
     return ptr;
 }
 
+std::shared_ptr<NetworkManager::NetworkQueue>
+NetworkManager::NetworkQueue::Publisher(std::string cname) {
+    auto ptr          = std::shared_ptr<NetworkQueue>(new NetworkQueue());
+    ptr->wptr         = ptr;
+    ptr->channel_name = cname;
+    metrics.RegisterChannel(cname);
+    return ptr;
+}
+
 void
 NetworkManager::NetworkQueue::Push(std::vector<std::byte> ar) {
     const std::lock_guard<std::mutex> lock(mtx);
@@ -100,6 +256,13 @@ NetworkManager::NetworkQueue::Push(std::vector<std::byte> ar) {
         should_clear = false;
     }
     byte_ars.push_back(ar);
+    metrics.ReadQueueDepth.fetch_add(1, std::memory_order_relaxed);
+    pacer.Wake();
+}
+
+void
+NetworkManager::NetworkQueue::consumed(size_t count) {
+    metrics.ReadQueueDepth.fetch_sub(count, std::memory_order_relaxed);
 }
 
 NetworkManager::network_object::~network_object() {}
@@ -114,7 +277,8 @@ NetworkManager::network_object::handle_write(
     [[maybe_unused]] size_t bytes) {
     if (!error) {
         write_msgs.pop_front();
-        if (!write_msgs.empty()) {
+        metrics.WriteQueueDepth.fetch_sub(1, std::memory_order_relaxed);
+        if (!write_msgs.empty() || promote_bulk()) {
             asio::async_write(
                 *sock,
                 asio::buffer(write_msgs.front().Data(), write_msgs.front().Length),
@@ -171,16 +335,79 @@ void
 NetworkManager::network_object::WriteSocket(
     const NetworkManager::network_object::socket_ptr &sock,
     const NetworkManager::Message &                   msg) {
+    uint64_t peer = peer_of(msg);
+    if (auto release = conditioner.Schedule(peer, NetworkConditioner::OUT, msg.Length)) {
+        hold({peer, NetworkConditioner::OUT}, *release, [this, sock, msg]() {
+            do_write(sock, msg);
+        });
+        return;
+    }
     asio::post(context, [this, sock, msg]() { do_write(sock, msg); });
 }
 
+void
+NetworkManager::network_object::deliver(
+    uint64_t                      peer,
+    const std::string &           channel,
+    const std::vector<std::byte> &data) {
+    static NetworkManager &nm    = NetworkManager::GetInstance();
+    size_t                 bytes = MessageHeader::HeaderLength + data.size();
+    auto release = conditioner.Schedule(peer, NetworkConditioner::IN, bytes);
+    if (!release) {
+        nm.receive(channel, data);
+        return;
+    }
+    hold({peer, NetworkConditioner::IN}, *release, [channel, data]() {
+        nm.receive(channel, data);
+    });
+}
+
+void
+NetworkManager::network_object::hold(
+    const link_key &                      key,
+    NetworkConditioner::clock::time_point release,
+    std::function<void()>                 action) {
+    const std::lock_guard<std::mutex> lock(conditioned_mtx);
+    auto &                            link = conditioned_links[key];
+    link.Held.emplace_back(release, std::move(action));
+    // Otherwise the timer is already waiting on an earlier message
+    if (link.Held.size() > 1) { return; }
+    if (!link.Timer) { link.Timer = std::make_unique<asio::steady_timer>(context); }
+    link.Timer->expires_at(release);
+    link.Timer->async_wait([this, key](const asio::error_code &error) {
+        if (!error) { release_held(key); }
+    });
+}
+
+void
+NetworkManager::network_object::release_held(const link_key &key) {
+    std::vector<std::function<void()>> due;
+    {
+        const std::lock_guard<std::mutex> lock(conditioned_mtx);
+        auto &                            link = conditioned_links[key];
+        auto                              now  = NetworkConditioner::clock::now();
+        while (!link.Held.empty() && link.Held.front().first <= now) {
+            due.push_back(std::move(link.Held.front().second));
+            link.Held.pop_front();
+        }
+        if (!link.Held.empty()) {
+            link.Timer->expires_at(link.Held.front().first);
+            link.Timer->async_wait([this, key](const asio::error_code &error) {
+                if (!error) { release_held(key); }
+            });
+        }
+    }
+    for (auto &action : due) { action(); }
+}
+
 void
 NetworkManager::network_object::do_write(
     const NetworkManager::network_object::socket_ptr &sock,
     const NetworkManager::Message &                   msg) {
     bool write_in_progress = !write_msgs.empty();
-    write_msgs.push_back(msg);
-    if (!write_in_progress) {
+    enqueue(shm_encode(peer_of(msg), msg));
+    metrics.RecordMessage(msg.Header.Channel, Metrics::OUT, msg.Length);
+    if (!write_in_progress && promote_bulk()) {
         asio::async_write(
             *sock,
             asio::buffer(write_msgs.front().Data(), write_msgs.front().Length),
@@ -189,6 +416,28 @@ NetworkManager::network_object::do_write(
             });
     }
 }
+
+bool
+NetworkManager::network_object::is_bulk(const Message &msg) {
+    return msg.Header.Channel == "IMAGE_CHUNK" || msg.Header.Channel == "NEW_IMAGE";
+}
+
+void
+NetworkManager::network_object::enqueue(Message &&msg) {
+    (is_bulk(msg) ? bulk_msgs : write_msgs).push_back(std::move(msg));
+    metrics.WriteQueueDepth.fetch_add(1, std::memory_order_relaxed);
+}
+
+bool
+NetworkManager::network_object::promote_bulk() {
+    if (!write_msgs.empty()) { return true; }
+    if (bulk_msgs.empty()) { return false; }
+    // One at a time, so anything queued behind it waits for at most a single image chunk
+    write_msgs.push_back(std::move(bulk_msgs.front()));
+    bulk_msgs.pop_front();
+    return true;
+}
+
 void
 NetworkManager::network_object::http_get(
     std::string                      hostname,
@@ -245,10 +494,119 @@ NetworkManager::network_object::http_get(
 
         while (asio::read(socket, response, asio::transfer_at_least(1), error)) { ss << &response; }
         http_get_response[hostname + path] = make_pair(ss.str(), callback);
+        pacer.Wake();
         if (error != asio::error::eof) { std::cout << "Bad error" << std::endl; }
     } catch (std::exception &e) { std::cout << "Botched: " << e.what() << std::endl; }
 }
 
+std::shared_ptr<NetworkManager::network_object::shm_link>
+NetworkManager::network_object::get_shm_link(uint64_t peer) {
+    const std::lock_guard<std::mutex> lock(shm_mtx);
+    auto                              it = shm_links.find(peer);
+    return it == shm_links.end() ? nullptr : it->second;
+}
+
+bool
+NetworkManager::network_object::shm_ready(uint64_t peer) {
+    auto link = get_shm_link(peer);
+    if (!link) { return false; }
+    const std::lock_guard<std::mutex> lock(link->mtx);
+    return link->OutReady;
+}
+
+void
+NetworkManager::network_object::open_shm_link(const socket_ptr &sock, uint64_t peer) {
+    std::string name = "trellis-" + std::to_string(uid) + "-" + std::to_string(peer) + "-" +
+                       std::to_string(Util::generate_uid());
+    auto ring = SharedRing::Create(name);
+    if (!ring) {
+        std::cout << "Shared memory unavailable, staying on TCP" << std::endl;
+        return;
+    }
+    {
+        const std::lock_guard<std::mutex> lock(shm_mtx);
+        auto &                            link = shm_links[peer];
+        if (!link) { link = std::make_shared<shm_link>(); }
+        const std::lock_guard<std::mutex> link_lock(link->mtx);
+        link->Out = std::move(ring);
+    }
+    WriteSocket(sock, Message(Util::serialize_vec(name), peer, "SHM_OPEN"));
+}
+
+void
+NetworkManager::network_object::close_shm_link(uint64_t peer) {
+    const std::lock_guard<std::mutex> lock(shm_mtx);
+    shm_links.erase(peer);
+}
+
+NetworkManager::Message
+NetworkManager::network_object::shm_encode(uint64_t peer, const Message &msg) {
+    if (static_cast<size_t>(msg.Length) < ShmThreshold) { return msg; }
+    auto link = get_shm_link(peer);
+    if (!link) { return msg; }
+    const std::lock_guard<std::mutex> lock(link->mtx);
+    if (!link->OutReady) { return msg; }
+    auto pos = link->Out->Write(msg.DataVec.data(), msg.Length);
+    // Ring is full, the socket still works
+    if (!pos) { return msg; }
+    auto doorbell = Util::flatten(
+        {Util::serialize_vec(*pos), Util::serialize_vec(static_cast<uint64_t>(msg.Length))});
+    return Message(doorbell, msg.Header.Uid, "SHM");
+}
+
+bool
+NetworkManager::network_object::shm_decode(
+    const socket_ptr &      sock,
+    uint64_t                peer,
+    MessageHeader &         header,
+    std::vector<std::byte> &body) {
+    if (header.Channel == "SHM_OPEN") {
+        auto name = Util::deserialize<std::string>(body);
+        auto ring = SharedRing::Open(name);
+        if (!ring) {
+            std::cout << "Could not map shared memory from peer " << peer << std::endl;
+            return false;
+        }
+        {
+            const std::lock_guard<std::mutex> lock(shm_mtx);
+            auto &                            link = shm_links[peer];
+            if (!link) { link = std::make_shared<shm_link>(); }
+            const std::lock_guard<std::mutex> link_lock(link->mtx);
+            link->In = std::move(ring);
+        }
+        WriteSocket(sock, Message(body, peer, "SHM_READY"));
+        return false;
+    }
+    if (header.Channel == "SHM_READY") {
+        auto link = get_shm_link(peer);
+        if (link) {
+            const std::lock_guard<std::mutex> lock(link->mtx);
+            if (link->Out && link->Out->Name() == Util::deserialize<std::string>(body)) {
+                link->OutReady = true;
+                std::cout << "Using shared memory for peer " << peer << std::endl;
+            }
+        }
+        return false;
+    }
+    if (header.Channel == "SHM") {
+        auto link = get_shm_link(peer);
+        if (!link || body.size() < 2 * sizeof(uint64_t)) { return false; }
+        auto pos = Util::deserialize<uint64_t>(body.data());
+        auto len = Util::deserialize<uint64_t>(body.data() + sizeof(uint64_t));
+        std::optional<std::vector<std::byte>> frame;
+        {
+            const std::lock_guard<std::mutex> lock(link->mtx);
+            if (link->In) { frame = link->In->Read(pos, len); }
+        }
+        if (!frame || frame->size() < MessageHeader::HeaderLength) { return false; }
+        std::array<std::byte, MessageHeader::HeaderLength> h;
+        std::copy_n(frame->begin(), MessageHeader::HeaderLength, h.begin());
+        header = MessageHeader::Deserialize(h);
+        body.assign(frame->begin() + MessageHeader::HeaderLength, frame->end());
+    }
+    return true;
+}
+
 NetworkManager::server::server(asio::io_context &con, int port)
     : network_object(con)
     , acceptor(con, tcp::endpoint(tcp::v4(), port))
@@ -290,13 +648,13 @@ NetworkManager::server::handle_accept(
     const asio::error_code &                   error) {
     if (!error) {
         std::cout << "Got a connection" << std::endl;
-        read_msg.DataVec = std::vector<std::byte>(MessageHeader::HeaderLength);
-        asio::async_read(
-            *new_sock,
-            asio::buffer(read_msg.Data(), MessageHeader::HeaderLength),
-            [this, new_sock](const asio::error_code &error, size_t bytes_transferred) {
-                handle_read_header_connect(new_sock, read_msg, error, bytes_transferred);
-            });
+        asio::error_code ec;
+        new_sock->set_option(tcp::no_delay(true), ec);
+        auto conn    = std::make_shared<connection>();
+        conn->Sock   = new_sock;
+        conn->Local  = new_sock->remote_endpoint(ec).address().is_loopback();
+        conn->Buffer = pool.Acquire();
+        start_read(conn);
     } else {
         std::cout << "Accept Error: " << error.message() << std::endl;
     }
@@ -304,42 +662,126 @@ NetworkManager::server::handle_accept(
 }
 
 void
-NetworkManager::server::handle_read_header_connect(
-    const socket_ptr &      sock,
-    Message &               buf,
+NetworkManager::server::start_read(const connection_ptr &conn) {
+    conn->Sock->async_read_some(
+        asio::buffer(conn->Buffer.data() + conn->Filled, conn->Buffer.size() - conn->Filled),
+        [this, conn](const asio::error_code &error, size_t bytes_transferred) {
+            handle_read(conn, error, bytes_transferred);
+        });
+}
+
+void
+NetworkManager::server::handle_read(
+    const connection_ptr &  conn,
     const asio::error_code &error,
     size_t                  bytes) {
-    if (!error && buf.DecodeHeader()) {
-        asio::async_read(
-            *sock,
-            asio::buffer(buf.Body(), static_cast<size_t>(buf.Header.MessageLength)),
-            [this, sock, &buf](const asio::error_code &error, size_t bytes_transferred) {
-                handle_read_body(sock, read_msgs[sock], error, bytes_transferred);
-            });
-    } else {
-        std::cout << "Read Header Error: " << error.message() << std::endl;
+    if (error) {
+        close_connection(conn, error);
+        return;
     }
+    conn->Filled += bytes;
+    // Handle every complete frame that arrived with this read
+    size_t offset = 0;
+    size_t needed = buffer_pool::BufferSize;
+    while (conn->Filled - offset >= MessageHeader::HeaderLength) {
+        std::array<std::byte, MessageHeader::HeaderLength> h;
+        std::copy_n(conn->Buffer.begin() + offset, MessageHeader::HeaderLength, h.begin());
+        MessageHeader header = MessageHeader::Deserialize(h);
+        size_t        frame  = MessageHeader::HeaderLength + header.MessageLength;
+        if (conn->Filled - offset < frame) {
+            needed = std::max(needed, frame);
+            break;
+        }
+        auto body = conn->Buffer.begin() + offset + MessageHeader::HeaderLength;
+        handle_frame(conn, header, std::vector<std::byte>(body, body + header.MessageLength));
+        offset += frame;
+    }
+    if (offset > 0) {
+        std::copy(
+            conn->Buffer.begin() + offset,
+            conn->Buffer.begin() + conn->Filled,
+            conn->Buffer.begin());
+        conn->Filled -= offset;
+    }
+    if (needed > conn->Buffer.size()) {
+        // Grow so the rest of a large frame fits
+        conn->Buffer.resize(needed);
+    } else if (needed == buffer_pool::BufferSize && conn->Buffer.size() > needed) {
+        // Go back to a pooled buffer once the oversized frame has been handled
+        auto buf = pool.Acquire();
+        std::copy_n(conn->Buffer.begin(), conn->Filled, buf.begin());
+        conn->Buffer = std::move(buf);
+    }
+    start_read(conn);
 }
 
 void
-NetworkManager::server::handle_header_action(const socket_ptr &sock) {
+NetworkManager::server::handle_frame(
+    const connection_ptr & conn,
+    MessageHeader          header,
+    std::vector<std::byte> body) {
     // Need to lock due to accessing nm queues
     const std::lock_guard<std::mutex> lock(mtx);
     static NetworkManager &           nm = NetworkManager::GetInstance();
+    metrics.RecordMessage(header.Channel, Metrics::IN, MessageHeader::HeaderLength + body.size());
+    // The uid a client joins with is who it is from then on, 0 is the host and can't be taken
+    bool joining = header.Channel == "JOIN" || header.Channel == "SPECTATE";
+    if (joining && (conn->Uid != 0 || header.Uid == 0 || socks.count(header.Uid) > 0)) { return; }
+    // Nothing counts until the client has joined
+    if (!joining && conn->Uid == 0) { return; }
     // Service new clients
-    if (read_msg.Header.Channel == "JOIN") {
-        uint64_t uid    = read_msg.Header.Uid;
-        socks[uid]      = sock;
-        read_msgs[sock] = Message();
-        NetworkData con(read_msg.Msg(), uid);
+    if (header.Channel == "JOIN") {
+        conn->Uid         = header.Uid;
+        socks[header.Uid] = conn->Sock;
+        NetworkData con(body, header.Uid);
         // Push this into the CLIENT_JOIN channel so new clients can be tracked
-        for (auto &ptr : nm.queues["JOIN"]) { ptr.lock()->Push(Util::serialize_vec(con)); }
-        read_msg.Clear();
-    } else {
-        for (auto &ptr : nm.queues[read_msgs[sock].Header.Channel]) {
-            ptr.lock()->Push(read_msgs[sock].Msg());
+        nm.receive("JOIN", Util::serialize_vec(con));
+        if (conn->Local) { open_shm_link(conn->Sock, conn->Uid); }
+        return;
+    }
+    if (header.Channel == "SPECTATE") {
+        conn->Uid         = header.Uid;
+        conn->Spectator   = true;
+        socks[header.Uid] = conn->Sock;
+        nm.receive("SPECTATE", Util::serialize_vec(NetworkData(body, header.Uid)));
+        return;
+    }
+    // Spectators and relays are read-only, they only get to finish joining and fetch images
+    if (conn->Spectator && header.Channel != "SPECTATE_DONE" && header.Channel != "IMAGE_REQUEST") {
+        return;
+    }
+    // Headers from clients carry the target uid, so the sender comes from the connection
+    if (!shm_decode(conn->Sock, conn->Uid, header, body)) { return; }
+    // Whatever the client wrote in as the sender is replaced by who it really is, an image request
+    // names its requester in Uid as well
+    if (body.size() < 2 * sizeof(uint64_t)) { return; }
+    auto stamp = Util::serialize(conn->Uid);
+    std::copy(stamp.begin(), stamp.end(), body.begin() + sizeof(uint64_t));
+    if (header.Channel == "IMAGE_REQUEST") { std::copy(stamp.begin(), stamp.end(), body.begin()); }
+    deliver(conn->Uid, header.Channel, body);
+}
+
+void
+NetworkManager::server::close_connection(
+    const connection_ptr &  conn,
+    const asio::error_code &error) {
+    if (error != asio::error::eof && error != asio::error::connection_reset) {
+        std::cout << "Read Error: " << error.message() << std::endl;
+    }
+    const std::lock_guard<std::mutex> lock(mtx);
+    static NetworkManager &           nm = NetworkManager::GetInstance();
+    for (auto &kv : socks) {
+        // Find the relevant client and delete it
+        if (kv.second == conn->Sock) {
+            // Send the client uid that has disconnected so it can be untracked
+            NetworkData con("", kv.first);
+            nm.receive("DISCONNECT", Util::serialize_vec(con));
+            socks.erase(kv.first);
+            close_shm_link(conn->Uid);
+            break;
         }
     }
+    if (conn->Buffer.size() == buffer_pool::BufferSize) { pool.Release(std::move(conn->Buffer)); }
 }
 
 void
@@ -347,20 +789,12 @@ NetworkManager::server::handle_write(
     const NetworkManager::network_object::socket_ptr &sock,
     const asio::error_code &                          error,
     size_t                                            bytes) {
-    if (!error) {
-        write_msgs.pop_front();
-        if (!write_msgs.empty()) {
-            Message &m = write_msgs.front();
-            asio::async_write(
-                *socks[m.Header.Uid],
-                asio::buffer(m.Data(), m.Length),
-                [this, sock](const asio::error_code &error, size_t bytes_transferred) {
-                    handle_write(sock, error, bytes_transferred);
-                });
-        }
-    } else {
-        std::cout << "Handle Write Error: " << error.message() << std::endl;
-    }
+    if (error) { std::cout << "Handle Write Error: " << error.message() << std::endl; }
+    // On error the batch is dropped so that one bad client doesn't stall everybody else
+    for (size_t i = 0; i < writes_in_flight; i++) { write_msgs.pop_front(); }
+    metrics.WriteQueueDepth.fetch_sub(writes_in_flight, std::memory_order_relaxed);
+    writes_in_flight = 0;
+    if (promote_bulk()) { start_write(sock); }
 }
 
 void
@@ -368,41 +802,51 @@ NetworkManager::server::do_write(
     const NetworkManager::network_object::socket_ptr &sock,
     const NetworkManager::Message &                   msg) {
     bool write_in_progress = !write_msgs.empty();
-    write_msgs.push_back(msg);
-    if (!write_in_progress) {
-        Message &m = write_msgs.front();
+    enqueue(shm_encode(peer_of(msg), msg));
+    metrics.RecordMessage(msg.Header.Channel, Metrics::OUT, msg.Length);
+    if (!write_in_progress && promote_bulk()) { start_write(sock); }
+}
+
+void
+NetworkManager::server::start_write(const NetworkManager::network_object::socket_ptr &sock) {
+    while (promote_bulk()) {
+        uint64_t target = write_msgs.front().Header.Uid;
+        auto     it     = socks.find(target);
+        if (it == socks.end()) {
+            // Client has gone away, nothing left to send these to
+            write_msgs.pop_front();
+            metrics.WriteQueueDepth.fetch_sub(1, std::memory_order_relaxed);
+            continue;
+        }
+        std::vector<asio::const_buffer> bufs;
+        for (auto &m : write_msgs) {
+            if (m.Header.Uid != target || bufs.size() == MaxWriteBatch) { break; }
+            bufs.push_back(asio::buffer(m.Data(), m.Length));
+        }
+        writes_in_flight = bufs.size();
         asio::async_write(
-            *socks[m.Header.Uid],
-            asio::buffer(m.Data(), m.Length),
+            *it->second,
+            bufs,
             [this, sock](const asio::error_code &error, size_t bytes_transferred) {
                 handle_write(sock, error, bytes_transferred);
             });
+        return;
     }
 }
 
+std::vector<std::byte>
+NetworkManager::buffer_pool::Acquire() {
+    const std::lock_guard<std::mutex> lock(mtx);
+    if (free_bufs.empty()) { return std::vector<std::byte>(BufferSize); }
+    auto buf = std::move(free_bufs.back());
+    free_bufs.pop_back();
+    return buf;
+}
+
 void
-NetworkManager::server::handle_error(
-    const NetworkManager::network_object::socket_ptr &sock,
-    NetworkManager::Message &                         buf,
-    const asio::error_code &                          error) {
-    if (error == asio::error::connection_reset) {
-        const std::lock_guard<std::mutex> lock(mtx);
-        static NetworkManager &           nm = NetworkManager::GetInstance();
-        for (auto &kv : socks) {
-            // Find the relevant client and delete it
-            if (kv.second == sock) {
-                // Send the client uid that has disconnected so it can be untracked
-                NetworkData con("", kv.first);
-                // Push this into the CLIENT_JOIN channel so new clients can be tracked
-                for (auto &ptr : nm.queues["DISCONNECT"]) {
-                    ptr.lock()->Push(Util::serialize_vec(con));
-                }
-                socks.erase(kv.first);
-                read_msgs.erase(sock);
-                break;
-            }
-        }
-    }
+NetworkManager::buffer_pool::Release(std::vector<std::byte> &&buf) {
+    const std::lock_guard<std::mutex> lock(mtx);
+    if (free_bufs.size() < MaxPooled) { free_bufs.push_back(std::move(buf)); }
 }
 
 NetworkManager::client::client(
@@ -410,10 +854,12 @@ NetworkManager::client::client(
     uint64_t          client_uid,
     asio::io_context &con,
     std::string       hostname,
-    int               port_num)
+    int               port_num,
+    bool              spectator)
     : network_object(con)
     , resolver(con)
-    , ClientName(client_name) {
+    , ClientName(client_name)
+    , Spectator(spectator) {
     uid                                   = client_uid;
     tcp::resolver::results_type endpoints = resolver.resolve(hostname, std::to_string(port_num));
     server_sock                           = std::make_shared<tcp::socket>(con);
@@ -440,7 +886,12 @@ void
 NetworkManager::client::handle_connect(const asio::error_code &error, const tcp::endpoint &ep) {
     if (!error) {
         std::cout << "Connection Successful" << std::endl;
-        WriteSocket(server_sock, Message(ClientName, uid, "JOIN"));
+        if (Spectator) {
+            WriteSocket(server_sock, Message(ClientName, uid, "SPECTATE"));
+        } else {
+            WriteSocket(server_sock, Message(ClientName, uid, "JOIN"));
+            if (ep.address().is_loopback()) { open_shm_link(server_sock, 0); }
+        }
         read_msg.DataVec = std::vector<std::byte>(MessageHeader::HeaderLength);
         asio::async_read(
             *server_sock,
@@ -455,8 +906,75 @@ NetworkManager::client::handle_connect(const asio::error_code &error, const tcp:
 
 void
 NetworkManager::client::handle_header_action(const socket_ptr &sock) {
-    static NetworkManager &nm = NetworkManager::GetInstance();
-    for (auto &ptr : nm.queues[read_msg.Header.Channel]) { ptr.lock()->Push(read_msg.Msg()); }
+    MessageHeader          header = read_msg.Header;
+    std::vector<std::byte> body   = read_msg.Msg();
+    metrics.RecordMessage(header.Channel, Metrics::IN, MessageHeader::HeaderLength + body.size());
+    if (shm_decode(sock, 0, header, body)) { deliver(0, header.Channel, body); }
+}
+
+NetworkManager::metrics_server::metrics_server(
+    asio::io_context & con,
+    const std::string &address,
+    int                port_num)
+    : context(con)
+    , acceptor(con, tcp::endpoint(asio::ip::make_address(address), port_num)) {
+    listen();
+}
+
+void
+NetworkManager::metrics_server::listen() {
+    socket_ptr new_sock = std::make_shared<tcp::socket>(context);
+    acceptor.async_accept(*new_sock, [this, new_sock](const asio::error_code &error) {
+        handle_accept(new_sock, error);
+    });
+}
+
+void
+NetworkManager::metrics_server::handle_accept(socket_ptr sock, const asio::error_code &error) {
+    if (!error) {
+        auto buf = std::make_shared<asio::streambuf>(4096);
+        asio::async_read_until(
+            *sock,
+            *buf,
+            "\r\n\r\n",
+            [this, sock, buf](const asio::error_code &error, size_t) {
+                handle_request(sock, buf, error);
+            });
+    } else {
+        std::cout << "Metrics Accept Error: " << error.message() << std::endl;
+    }
+    listen();
+}
+
+void
+NetworkManager::metrics_server::handle_request(
+    socket_ptr                       sock,
+    std::shared_ptr<asio::streambuf> buf,
+    const asio::error_code &         error) {
+    if (error) { return; }
+    std::istream request_stream(buf.get());
+    std::string  method, path;
+    request_stream >> method >> path;
+    std::string status = "200 OK";
+    std::string body;
+    if (method != "GET") {
+        status = "405 Method Not Allowed";
+    } else if (path != "/metrics") {
+        status = "404 Not Found";
+    } else {
+        body = Metrics::GetInstance().Render();
+    }
+    std::ostringstream response;
+    response << "HTTP/1.0 " << status << "\r\n";
+    response << "Content-Type: text/plain; version=0.0.4\r\n";
+    response << "Content-Length: " << body.size() << "\r\n";
+    response << "Connection: close\r\n\r\n";
+    response << body;
+    auto out = std::make_shared<std::string>(response.str());
+    asio::async_write(*sock, asio::buffer(*out), [sock, out](const asio::error_code &, size_t) {
+        asio::error_code ec;
+        sock->shutdown(tcp::socket::shutdown_both, ec);
+    });
 }
 
 NetworkManager::MessageHeader::MessageHeader()
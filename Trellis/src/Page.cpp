@@ -1,8 +1,10 @@
 #include <utility>
 
 #include "page.h"
+#include "asset_fetcher.h"
 #include "client_server.h"
 #include "data.h"
+#include "glfw_handler.h"
 #include "resource_manager.h"
 
 using std::make_unique, std::move, std::string, std::exchange, std::unique_ptr, std::make_pair,
@@ -30,20 +32,33 @@ Page::~Page() {}
 
 GameObject &
 Page::AddPiece(const CoreGameObject &core_piece) {
-    auto obj = make_unique<GameObject>(core_piece, View);
+    auto obj = make_unique<GameObject>(core_piece);
+    if (ClientServer::Started()) { ClientServer::GetInstance().TrackPiece(Uid, *obj); }
+    if (obj->SpritePending()) {
+        AssetFetcher::GetInstance().Request(obj->SpriteUid, Uid, obj->Uid);
+    }
     PiecesMap.insert(make_pair(obj->Uid, ref(*obj)));
+    pieces_by_sprite[obj->SpriteUid].insert(obj->Uid);
     Pieces.push_front(move(obj));
+    index.Insert(Pieces.begin());
     return *Pieces.front();
 }
 
 void
-Page::BeginPlacePiece(const Transform &transform, const shared_ptr<Texture2D> &sprite) {
-    auto  core       = CoreGameObject(transform, sprite->ImageUID, 0, true, glm::vec3(1));
+Page::PieceMoved(const GameObject &piece) {
+    index.Update(piece);
+}
+
+void
+Page::BeginPlacePiece(const Transform &transform, uint64_t sprite_uid) {
+    auto  core       = CoreGameObject(transform, sprite_uid, 0, true, glm::vec3(1));
     auto &piece      = AddPiece(core);
     mouse_hold       = MouseHoldType::PLACING;
     initialSize      = piece.transform.scale;
     initialPos       = piece.transform.position;
     CurrentSelection = Pieces.begin();
+    Selection        = {piece.Uid};
+    group.clear();
 }
 
 void
@@ -54,27 +69,91 @@ Page::Update(glm::ivec2 mouse_pos) {
 
 void
 Page::Draw() {
+    static ResourceManager &rm = ResourceManager::GetInstance();
+    rm.SetView(View);
     board_renderer.Draw();
-    // Draw sprites back-to-front, so the "top" sprite is drawn above the others
-    for (auto it = Pieces.rbegin(); it != Pieces.rend(); it++) {
-        int border_pixel_width =
-            CurrentSelection != Pieces.end() && (*it) == (*CurrentSelection) ? BorderWidth : 0;
-        (*it)->Draw(border_pixel_width);
+    // Off screen pieces aren't drawn, but their textures shouldn't be evicted while the page is up
+    for (auto &[sprite_uid, pieces] : pieces_by_sprite) { rm.KeepResident(sprite_uid); }
+    // Only what is on screen, back-to-front so the "top" sprite is drawn above the others
+    glm::ivec2 screen(GLFW::GetScreenWidth(), GLFW::GetScreenHeight());
+    auto visible = index.Query(ScreenPosToWorldPos(glm::ivec2(0)), ScreenPosToWorldPos(screen));
+    for (auto it = visible.rbegin(); it != visible.rend(); it++) {
+        (**it)->Draw(sprite_batch, Selection.count((**it)->Uid) > 0);
+    }
+    sprite_batch.Flush(View, BorderWidth);
+    if (mouse_hold == MouseHoldType::SELECTING) {
+        UserInterface->DrawSelectionBox(WorldPosToScreenPos(band_origin), band_end);
     }
     // Draw user interface
-    UserInterface->DrawPieceClickMenu();
+    GameObject *selection = CurrentSelection != Pieces.end() ? CurrentSelection->get() : nullptr;
+    UserInterface->DrawPieceClickMenu(selection);
+    UserInterface->DrawPropertiesWindow(selection);
 }
 
 void
 Page::HandleUIEvents() {
-    if (UserInterface->MoveToFront) {
-        Pieces.splice(Pieces.begin(), Pieces, CurrentSelection);
-    } else if (UserInterface->MoveToBack) {
-        Pieces.splice(Pieces.end(), Pieces, CurrentSelection);
+    if (UserInterface->MoveToFront || UserInterface->MoveToBack) {
+        Data::PieceGroup restacked;
+        for (auto &piece : Pieces) {
+            if (Selection.count(piece->Uid) > 0) { restacked.Uids.push_back(piece->Uid); }
+        }
+        Restack(restacked.Uids, UserInterface->MoveToFront);
+        if (ClientServer::Started()) {
+            ClientServer::GetInstance().ChannelPublish(
+                UserInterface->MoveToFront ? "RAISE_PIECES" : "LOWER_PIECES",
+                Uid,
+                restacked);
+        }
+    }
+    if (CurrentSelection != Pieces.end() &&
+        (UserInterface->SetVisibility || UserInterface->ToggleOwner != 0)) {
+        // The piece the menu was opened on decides whether the owner is added or removed
+        auto &owners = (*CurrentSelection)->Owners;
+        bool owned = find(owners.begin(), owners.end(), UserInterface->ToggleOwner) != owners.end();
+        for (auto piece_uid : Selection) {
+            GameObject &piece = PiecesMap.at(piece_uid);
+            if (UserInterface->SetVisibility) { piece.Visible = UserInterface->NewVisibility; }
+            if (UserInterface->ToggleOwner != 0) {
+                auto owner =
+                    find(piece.Owners.begin(), piece.Owners.end(), UserInterface->ToggleOwner);
+                if (owned && owner != piece.Owners.end()) {
+                    piece.Owners.erase(owner);
+                } else if (!owned && owner == piece.Owners.end()) {
+                    piece.Owners.push_back(UserInterface->ToggleOwner);
+                }
+            }
+            if (ClientServer::Started()) {
+                ClientServer::GetInstance().SetPieceVisibility(Uid, piece);
+            }
+        }
+    }
+    if (CurrentSelection != Pieces.end() && UserInterface->PropertiesEdited) {
+        dirty_properties.insert((*CurrentSelection)->Uid);
     }
     UserInterface->ClearFlags();
 }
 
+void
+Page::Restack(const vector<uint64_t> &uids, bool to_front) {
+    // Lift the pieces out in order and put them back together, so they keep their stacking order
+    // relative to each other
+    std::unordered_set<uint64_t>      lifting(uids.begin(), uids.end());
+    std::list<unique_ptr<GameObject>> moving;
+    for (auto it = Pieces.begin(); it != Pieces.end();) {
+        auto next = std::next(it);
+        if (lifting.count((*it)->Uid) > 0) { moving.splice(moving.end(), Pieces, it); }
+        it = next;
+    }
+    vector<uint64_t> moved;
+    for (auto &piece : moving) { moved.push_back(piece->Uid); }
+    if (to_front) {
+        index.Raise(moved);
+    } else {
+        index.Lower(moved);
+    }
+    Pieces.splice(to_front ? Pieces.begin() : Pieces.end(), moving);
+}
+
 Page::MouseHoverType
 Page::HoverType(glm::ivec2 mouse_pos, GameObject &object) {
     glm::ivec2 NW_corner_screen = WorldPosToScreenPos(object.transform.position);
@@ -120,7 +199,7 @@ Page::CurrentHoverType(glm::ivec2 mouse_pos) {
 }
 
 void
-Page::HandleLeftClickPress(glm::ivec2 mouse_pos) {
+Page::HandleLeftClickPress(glm::ivec2 mouse_pos, bool additive) {
     // Piece that is currently being placed
     if (mouse_hold == MouseHoldType::PLACING) {
         mouse_hold = MouseHoldType::NONE;
@@ -131,43 +210,149 @@ Page::HandleLeftClickPress(glm::ivec2 mouse_pos) {
             ns.ChannelPublish("ADD_PIECE", Uid, (CoreGameObject)piece);
         }
         CurrentSelection = Pieces.end();
+        Selection.clear();
         return;
     }
-    CurrentSelection = Pieces.end();
-    for (auto it = Pieces.begin(); it != Pieces.end(); it++) {
-        MouseHoverType hover = HoverType(mouse_pos, **it);
+    auto           hit   = Pieces.end();
+    MouseHoverType hover = MouseHoverType::NONE;
+    glm::vec2      world = ScreenPosToWorldPos(mouse_pos);
+    for (auto it : index.Query(world, world)) {
+        hover = HoverType(mouse_pos, **it);
         if (hover != MouseHoverType::NONE && (*it)->Clickable) {
-            CurrentSelection  = it;
-            GameObject &piece = **it;
-            ScaleEdges        = {0, 0};
-            if (hover == MouseHoverType::CENTER) {
-                mouse_hold = MouseHoldType::FOLLOWING;
-            } else {
-                mouse_hold = MouseHoldType::SCALING;
-                if (hover == MouseHoverType::N || hover == MouseHoverType::NE ||
-                    hover == MouseHoverType::NW) {
-                    ScaleEdges.second = -1;
-                }
-                if (hover == MouseHoverType::E || hover == MouseHoverType::NE ||
-                    hover == MouseHoverType::SE) {
-                    ScaleEdges.first = 1;
-                }
-                if (hover == MouseHoverType::S || hover == MouseHoverType::SE ||
-                    hover == MouseHoverType::SW) {
-                    ScaleEdges.second = 1;
-                }
-                if (hover == MouseHoverType::W || hover == MouseHoverType::SW ||
-                    hover == MouseHoverType::NW) {
-                    ScaleEdges.first = -1;
-                }
-            }
-
-            initialSize = (*it)->transform.scale;
-            initialPos  = (*it)->transform.position;
-            DragOrigin  = ScreenPosToWorldPos(mouse_pos);
+            hit = it;
             break;
         }
     }
+    // Empty space starts a selection box
+    if (hit == Pieces.end()) {
+        if (!additive) {
+            Selection.clear();
+            CurrentSelection = Pieces.end();
+        }
+        mouse_hold  = MouseHoldType::SELECTING;
+        band_origin = ScreenPosToWorldPos(mouse_pos);
+        band_end    = mouse_pos;
+        return;
+    }
+    uint64_t hit_uid = (*hit)->Uid;
+    if (additive) {
+        if (Selection.erase(hit_uid) == 0) {
+            Selection.insert(hit_uid);
+            CurrentSelection = hit;
+        } else if (CurrentSelection == hit) {
+            CurrentSelection = find_if(Pieces.begin(), Pieces.end(), [this](auto &piece) {
+                return Selection.count(piece->Uid) > 0;
+            });
+        }
+        return;
+    }
+    // Grabbing a piece that is already selected brings the rest of the selection along
+    if (Selection.count(hit_uid) == 0) { Selection = {hit_uid}; }
+    CurrentSelection = hit;
+    ScaleEdges       = {0, 0};
+    if (hover == MouseHoverType::CENTER) {
+        mouse_hold = MouseHoldType::FOLLOWING;
+    } else {
+        mouse_hold = MouseHoldType::SCALING;
+        if (hover == MouseHoverType::N || hover == MouseHoverType::NE ||
+            hover == MouseHoverType::NW) {
+            ScaleEdges.second = -1;
+        }
+        if (hover == MouseHoverType::E || hover == MouseHoverType::NE ||
+            hover == MouseHoverType::SE) {
+            ScaleEdges.first = 1;
+        }
+        if (hover == MouseHoverType::S || hover == MouseHoverType::SE ||
+            hover == MouseHoverType::SW) {
+            ScaleEdges.second = 1;
+        }
+        if (hover == MouseHoverType::W || hover == MouseHoverType::SW ||
+            hover == MouseHoverType::NW) {
+            ScaleEdges.first = -1;
+        }
+    }
+    DragOrigin = ScreenPosToWorldPos(mouse_pos);
+    begin_group_edit();
+    // Someone else is already dragging one of these pieces
+    if (ClientServer::Started() && !acquire_group()) {
+        release_group();
+        mouse_hold       = MouseHoldType::NONE;
+        CurrentSelection = Pieces.end();
+        Selection.clear();
+        group.clear();
+    }
+}
+
+void
+Page::begin_group_edit() {
+    group.clear();
+    group_positions.clear();
+    group_sizes.clear();
+    if (CurrentSelection == Pieces.end()) { return; }
+    initialPos  = (*CurrentSelection)->transform.position;
+    initialSize = (*CurrentSelection)->transform.scale;
+    for (auto piece_uid : Selection) {
+        GameObject &piece = PiecesMap.at(piece_uid);
+        if (&piece == CurrentSelection->get()) { continue; }
+        group.push_back(&piece);
+        group_positions.push_back(piece.transform.position);
+        group_sizes.push_back(piece.transform.scale);
+    }
+}
+
+void
+Page::move_group(glm::vec2 moved_by, glm::vec2 resized_by, float min_size) {
+    for (size_t i = 0; i < group.size(); i++) {
+        group[i]->transform.position = group_positions[i] + moved_by;
+        group[i]->transform.scale    = glm::max(group_sizes[i] + resized_by, glm::vec2(min_size));
+        index.Update(*group[i]);
+    }
+    if (CurrentSelection != Pieces.end()) { index.Update(**CurrentSelection); }
+}
+
+void
+Page::publish_group(const string &channel, glm::vec2 Transform::*field) {
+    Data::PieceGroup g;
+    g.Uids.reserve(group.size() + 1);
+    g.Values.reserve(group.size() + 1);
+    g.Uids.push_back((*CurrentSelection)->Uid);
+    g.Values.push_back((*CurrentSelection)->transform.*field);
+    for (auto piece : group) {
+        g.Uids.push_back(piece->Uid);
+        g.Values.push_back(piece->transform.*field);
+    }
+    ClientServer::GetInstance().ChannelPublish(channel, Uid, g);
+}
+
+bool
+Page::acquire_group() {
+    vector<uint64_t> piece_uids{(*CurrentSelection)->Uid};
+    for (auto piece : group) { piece_uids.push_back(piece->Uid); }
+    return ClientServer::GetInstance().AcquireLeases(piece_uids);
+}
+
+void
+Page::release_group() {
+    vector<uint64_t> piece_uids;
+    if (CurrentSelection != Pieces.end()) { piece_uids.push_back((*CurrentSelection)->Uid); }
+    for (auto piece : group) { piece_uids.push_back(piece->Uid); }
+    ClientServer::GetInstance().ReleaseLeases(piece_uids);
+}
+
+void
+Page::select_in_band(glm::ivec2 mouse_pos) {
+    glm::vec2 mouse = ScreenPosToWorldPos(mouse_pos);
+    glm::vec2 lo    = glm::min(band_origin, mouse);
+    glm::vec2 hi    = glm::max(band_origin, mouse);
+    for (auto it : index.Query(lo, hi)) {
+        const Transform &t = (*it)->transform;
+        if (!(*it)->Clickable || t.position.x > hi.x || t.position.y > hi.y ||
+            t.position.x + t.scale.x < lo.x || t.position.y + t.scale.y < lo.y) {
+            continue;
+        }
+        Selection.insert((*it)->Uid);
+        if (CurrentSelection == Pieces.end()) { CurrentSelection = it; }
+    }
 }
 
 void
@@ -234,15 +419,39 @@ Page::MoveCurrentSelection(glm::vec2 mouse_pos) {
                 piece.transform.position.y += mouse_pos.y;
                 break;
         }
+        float min_size = TILE_DIMENSIONS / (float)inc;
+        move_group(
+            piece.transform.position - initialPos,
+            piece.transform.scale - initialSize,
+            min_size);
         if (ClientServer::Started() && mouse_hold != MouseHoldType::PLACING) {
-            static ClientServer &cs = ClientServer::GetInstance();
-            if (piece.transform.position != prev_pos) {
+            static ClientServer &cs      = ClientServer::GetInstance();
+            bool                 moved   = piece.transform.position != prev_pos;
+            bool                 resized = piece.transform.scale != prev_size;
+            if ((moved || resized) && !acquire_group()) {
+                // Lost a piece to someone else, let go of them all without sending anything
+                piece.transform.position = prev_pos;
+                piece.transform.scale    = prev_size;
+                move_group(prev_pos - initialPos, prev_size - initialSize, min_size);
+                release_group();
+                mouse_hold       = MouseHoldType::NONE;
+                CurrentSelection = Pieces.end();
+                Selection.clear();
+                group.clear();
+                return;
+            }
+            if (!group.empty()) {
+                if (moved) { publish_group("MOVE_PIECES", &Transform::position); }
+                if (resized) { publish_group("RESIZE_PIECES", &Transform::scale); }
+                return;
+            }
+            if (moved) {
                 cs.ChannelPublish(
                     "MOVE_PIECE",
                     Uid,
                     NetworkData(piece.transform.position, piece.Uid));
             }
-            if (piece.transform.scale != prev_size) {
+            if (resized) {
                 cs.ChannelPublish(
                     "RESIZE_PIECE",
                     Uid,
@@ -254,25 +463,39 @@ Page::MoveCurrentSelection(glm::vec2 mouse_pos) {
 
 void
 Page::HandleLeftClickHold(glm::ivec2 mouse_pos) {
-    MoveCurrentSelection(mouse_pos);
+    if (mouse_hold == MouseHoldType::SELECTING) {
+        band_end = mouse_pos;
+    } else {
+        MoveCurrentSelection(mouse_pos);
+    }
 }
 
 void
 Page::HandleLeftClickRelease(glm::ivec2 mouse_pos) {
-    (void)mouse_pos;
+    if (mouse_hold == MouseHoldType::SELECTING) {
+        select_in_band(mouse_pos);
+        mouse_hold = MouseHoldType::NONE;
+        return;
+    }
     if (CurrentSelection != Pieces.end() && mouse_hold != MouseHoldType::PLACING) {
+        if (ClientServer::Started() && mouse_hold != MouseHoldType::NONE) { release_group(); }
         mouse_hold = MouseHoldType::NONE;
     }
 }
 
 void
 Page::HandleRightClick(glm::ivec2 mouse_pos) {
-    MouseHoverType hover = CurrentHoverType(mouse_pos);
-    if (hover != MouseHoverType::NONE) {
-        UserInterface->ClickMenuActive = true;
-    } else {
-        CurrentSelection = Pieces.end();
+    // The menu acts on the whole selection, from whichever selected piece it was opened on
+    glm::vec2 world = ScreenPosToWorldPos(mouse_pos);
+    for (auto it : index.Query(world, world)) {
+        if (Selection.count((*it)->Uid) > 0 && HoverType(mouse_pos, **it) != MouseHoverType::NONE) {
+            CurrentSelection               = it;
+            UserInterface->ClickMenuActive = true;
+            return;
+        }
     }
+    CurrentSelection = Pieces.end();
+    Selection.clear();
 }
 
 void
@@ -284,14 +507,14 @@ void
 Page::HandleMiddleClickHold(glm::ivec2 mouse_pos) {
     glm::vec2 v = mouse_pos - DragOrigin;
     Camera->Move(v);
-    View       = Camera->CalculateView(board_transform.scale);
+    set_view(Camera->CalculateView(board_transform.scale));
     DragOrigin = mouse_pos;
 }
 
 void
 Page::HandleScrollWheel(glm::ivec2 mouse_pos, int scroll_direction) {
     Camera->Zoom(mouse_pos, scroll_direction);
-    View = Camera->CalculateView(board_transform.scale);
+    set_view(Camera->CalculateView(board_transform.scale));
 }
 
 void
@@ -304,6 +527,7 @@ Page::HandleArrows(ArrowkeyType key) {
         case ArrowkeyType::DOWN: cardinal.y += TILE_DIMENSIONS; break;
         case ArrowkeyType::UP: cardinal.y -= TILE_DIMENSIONS; break;
     }
+    if (mouse_hold == MouseHoldType::NONE) { begin_group_edit(); }
     MoveCurrentSelection(cardinal);
 }
 
@@ -320,16 +544,35 @@ Page::SnapPieceToGrid(GameObject &piece, int increments) {
 
 glm::vec2
 Page::ScreenPosToWorldPos(glm::ivec2 pos) {
-    glm::vec4 world_pos = glm::inverse(View) * glm::vec4(pos, 0.0f, 1.0f);
+    glm::vec4 world_pos = InverseView * glm::vec4(pos, 0.0f, 1.0f);
     return glm::vec2(world_pos.x, world_pos.y);
 }
 
+void
+Page::set_view(const glm::mat4 &view) {
+    View        = view;
+    InverseView = glm::inverse(view);
+}
+
 glm::vec2
 Page::WorldPosToScreenPos(glm::ivec2 pos) {
     glm::vec4 screen_pos = View * glm::vec4(pos, 0.0f, 1.0f);
     return glm::vec2(screen_pos.x, screen_pos.y);
 }
 
+void
+Page::CollectPropertyChanges(PropertyBatch &batch) {
+    for (auto piece_uid : dirty_properties) {
+        auto it = PiecesMap.find(piece_uid);
+        if (it == PiecesMap.end()) { continue; }
+        auto &props  = it->second.get().Properties;
+        auto  fields = props.TakeReplicateDirty();
+        if (fields.none()) { continue; }
+        batch.Entries.push_back({Uid, piece_uid, props.SerializeFields(fields)});
+    }
+    dirty_properties.clear();
+}
+
 void
 Page::SendAllPieces(uint64_t target_uid) {
     if (ClientServer::Started()) {
@@ -343,13 +586,17 @@ Page::SendAllPieces(uint64_t target_uid) {
 
 bool
 Page::Deselect() {
-    if (CurrentSelection != Pieces.end()) {
+    if (CurrentSelection != Pieces.end() || !Selection.empty()) {
         if (mouse_hold == MouseHoldType::PLACING) {
+            forget_piece(**CurrentSelection);
             PiecesMap.erase((*CurrentSelection)->Uid);
+            index.Remove((*CurrentSelection)->Uid);
             Pieces.erase(CurrentSelection);
             mouse_hold = MouseHoldType::NONE;
         }
         CurrentSelection = Pieces.end();
+        Selection.clear();
+        group.clear();
         return true;
     }
     return false;
@@ -360,24 +607,95 @@ Page::DeletePiece(uint64_t uid) {
     auto piece_it = find_if(Pieces.begin(), Pieces.end(), [uid](unique_ptr<GameObject> &g) {
         return g->Uid == uid;
     });
-    if (piece_it != Pieces.end()) { Pieces.erase(piece_it); }
+    if (piece_it != Pieces.end()) {
+        // Other pieces are unaffected, the rest of a selection stays selected
+        if (piece_it == CurrentSelection) { CurrentSelection = Pieces.end(); }
+        auto grouped = std::find(group.begin(), group.end(), piece_it->get());
+        if (grouped != group.end()) {
+            auto i = grouped - group.begin();
+            group.erase(grouped);
+            group_positions.erase(group_positions.begin() + i);
+            group_sizes.erase(group_sizes.begin() + i);
+        }
+        forget_piece(**piece_it);
+        Pieces.erase(piece_it);
+    }
     PiecesMap.erase(uid);
-    CurrentSelection = Pieces.end();
+    Selection.erase(uid);
+    index.Remove(uid);
+}
+
+void
+Page::forget_piece(const GameObject &piece) {
+    auto it = pieces_by_sprite.find(piece.SpriteUid);
+    if (it == pieces_by_sprite.end()) { return; }
+    it->second.erase(piece.Uid);
+    if (it->second.empty()) { pieces_by_sprite.erase(it); }
+}
+
+void
+Page::SpritesChanged(const vector<uint64_t> &sprite_uids) {
+    for (auto sprite_uid : sprite_uids) {
+        auto it = pieces_by_sprite.find(sprite_uid);
+        if (it == pieces_by_sprite.end()) { continue; }
+        for (auto piece_uid : it->second) {
+            auto piece_it = PiecesMap.find(piece_uid);
+            if (piece_it != PiecesMap.end()) { piece_it->second.get().UpdateSprite(sprite_uid); }
+        }
+    }
 }
 
 void
 Page::DeleteCurrentSelection() {
-    if (CurrentSelection != Pieces.end()) {
-        if (mouse_hold != MouseHoldType::PLACING) {
-            static ClientServer &cs = ClientServer::GetInstance();
-            cs.ChannelPublish(
-                "DELETE_PIECE",
-                Uid,
-                NetworkData(*CurrentSelection, (*CurrentSelection)->Uid));
-            DeletePiece((*CurrentSelection)->Uid);
+    if (mouse_hold == MouseHoldType::PLACING) {
+        Deselect();
+        return;
+    }
+    if (Selection.empty()) { return; }
+    vector<uint64_t> piece_uids(Selection.begin(), Selection.end());
+    if (ClientServer::Started()) {
+        static ClientServer &cs = ClientServer::GetInstance();
+        if (!cs.AcquireLeases(piece_uids)) { return; }
+        if (piece_uids.size() == 1) {
+            auto &piece = PiecesMap.at(piece_uids[0]).get();
+            cs.ChannelPublish("DELETE_PIECE", Uid, NetworkData(piece, piece_uids[0]));
         } else {
-            Deselect();
+            Data::PieceGroup deleted;
+            deleted.Uids = piece_uids;
+            cs.ChannelPublish("DELETE_PIECES", Uid, deleted);
         }
+        // The server lets go of the leases when it takes the delete
+    }
+    for (auto piece_uid : piece_uids) { DeletePiece(piece_uid); }
+}
+
+vector<CoreGameObject>
+Page::CopySelection() const {
+    vector<CoreGameObject> copies;
+    // Back to front, so pasting them in order stacks them the same way
+    for (auto it = Pieces.rbegin(); it != Pieces.rend(); it++) {
+        if (Selection.count((*it)->Uid) > 0) { copies.push_back(**it); }
+    }
+    return copies;
+}
+
+void
+Page::Paste(const vector<CoreGameObject> &pieces) {
+    if (pieces.empty() || mouse_hold != MouseHoldType::NONE) { return; }
+    PieceList added;
+    Selection.clear();
+    for (auto &piece : pieces) {
+        CoreGameObject copy = piece;
+        copy.Uid            = Util::generate_uid();
+        copy.transform.position += glm::vec2(TILE_DIMENSIONS);
+        copy.Properties.MarkUnsaved();
+        AddPiece(copy);
+        Selection.insert(copy.Uid);
+        added.Pieces.push_back(move(copy));
+    }
+    CurrentSelection = Pieces.begin();
+    if (ClientServer::Started()) {
+        ClientServer::GetInstance().ChannelPublish("ADD_PIECES", Uid, added);
     }
 }
 
@@ -446,6 +764,9 @@ Page::WriteToDB(const SQLite::Database &db, uint64_t game_id) const {
         uint64_t piece_id;
         get_pieces.Column(0, piece_id);
         if (PiecesMap.find(piece_id) == PiecesMap.end()) {
+            auto del_props = db.Prepare("DELETE FROM PieceProperties WHERE piece_id = ?;");
+            del_props.Bind(1, piece_id);
+            del_props.Step();
             auto del_piece = db.Prepare("DELETE FROM GameObjects WHERE id = ?;");
             del_piece.Bind(1, piece_id);
             del_piece.Step();
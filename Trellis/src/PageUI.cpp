@@ -1,5 +1,7 @@
 #include "page_ui.h"
+#include "client_server.h"
 
+#include <algorithm>
 #include <memory>
 #include <utility>
 
@@ -8,7 +10,7 @@ PageUI::~PageUI() {}
 PageUI::PageUI() {}
 
 void
-PageUI::DrawPieceClickMenu() {
+PageUI::DrawPieceClickMenu(const CoreGameObject *selection) {
     if (ClickMenuActive) {
         ImGui::OpenPopup("right_click_menu");
         ClickMenuActive = false;
@@ -18,12 +20,83 @@ PageUI::DrawPieceClickMenu() {
         ImGui::Separator();
         MoveToFront = ImGui::Selectable("Move To Front");
         MoveToBack  = ImGui::Selectable("Move To Back");
+        if (selection && ImGui::Selectable("Properties")) { PropertiesOpen = true; }
+        // Only the host decides who gets to see a piece
+        bool host = !ClientServer::Started() || ClientServer::GetInstance().uid == 0;
+        if (selection && host && ImGui::BeginMenu("Visibility")) {
+            using Visibility = CoreGameObject::Visibility;
+            std::pair<Visibility, const char *> options[] = {
+                {Visibility::EVERYONE, "Everyone"},
+                {Visibility::OWNERS, "Owners"},
+                {Visibility::GM_ONLY, "GM Only"}};
+            for (auto &[visibility, label] : options) {
+                if (ImGui::MenuItem(label, nullptr, selection->Visible == visibility)) {
+                    SetVisibility = true;
+                    NewVisibility = visibility;
+                }
+            }
+            if (ClientServer::Started()) {
+                static ClientServer &cs = ClientServer::GetInstance();
+                ImGui::Separator();
+                ImGui::TextDisabled("Owners");
+                for (auto &client : cs.getConnectedClients()) {
+                    if (client.Uid == 0) { continue; }
+                    auto &owners = selection->Owners;
+                    bool  owned  = std::count(owners.begin(), owners.end(), client.Uid) > 0;
+                    if (ImGui::MenuItem(client.Name.c_str(), nullptr, owned)) {
+                        ToggleOwner = client.Uid;
+                    }
+                }
+            }
+            ImGui::EndMenu();
+        }
         ImGui::EndPopup();
     }
 }
 
+void
+PageUI::DrawPropertiesWindow(CoreGameObject *selection) {
+    if (!PropertiesOpen) { return; }
+    if (!selection) {
+        PropertiesOpen = false;
+        return;
+    }
+    auto &props = selection->Properties;
+    ImGui::Begin("Properties", &PropertiesOpen, ImGuiWindowFlags_AlwaysAutoResize);
+    int hp = props.HP(), max_hp = props.MaxHP(), initiative = props.Initiative();
+    if (ImGui::InputInt("HP", &hp)) { props.SetHP(hp); }
+    if (ImGui::InputInt("Max HP", &max_hp)) { props.SetMaxHP(max_hp); }
+    if (ImGui::InputInt("Initiative", &initiative)) { props.SetInitiative(initiative); }
+    char label[PieceProperties::MaxLabelLength + 1] = {};
+    props.Label().copy(label, PieceProperties::MaxLabelLength);
+    if (ImGui::InputText("Label", label, sizeof(label))) { props.SetLabel(label); }
+    ImGui::Separator();
+    for (int i = 0; i < PieceProperties::CONDITION_COUNT; i++) {
+        auto condition = static_cast<PieceProperties::Condition>(i);
+        bool set       = props.HasCondition(condition);
+        if (ImGui::Checkbox(PieceProperties::ConditionNames[i], &set)) {
+            props.SetCondition(condition, set);
+        }
+    }
+    ImGui::End();
+    // The page picks up the changed fields and sends them with the next batch
+    PropertiesEdited = true;
+}
+
+void
+PageUI::DrawSelectionBox(glm::vec2 corner, glm::vec2 opposite_corner) {
+    ImDrawList *draw_list = ImGui::GetForegroundDrawList();
+    ImVec2      min(std::min(corner.x, opposite_corner.x), std::min(corner.y, opposite_corner.y));
+    ImVec2      max(std::max(corner.x, opposite_corner.x), std::max(corner.y, opposite_corner.y));
+    draw_list->AddRectFilled(min, max, IM_COL32(100, 150, 255, 40));
+    draw_list->AddRect(min, max, IM_COL32(100, 150, 255, 200));
+}
+
 void
 PageUI::ClearFlags() {
-    MoveToBack  = false;
-    MoveToFront = false;
+    MoveToBack       = false;
+    MoveToFront      = false;
+    SetVisibility    = false;
+    PropertiesEdited = false;
+    ToggleOwner      = 0;
 }
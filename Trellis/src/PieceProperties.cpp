@@ -0,0 +1,230 @@
+#include "piece_properties.h"
+
+#include <cstring>
+#include <utility>
+
+using std::vector, std::byte, std::string;
+
+const std::array<const char *, PieceProperties::CONDITION_COUNT> PieceProperties::ConditionNames = {
+    "Blinded",
+    "Charmed",
+    "Deafened",
+    "Frightened",
+    "Grappled",
+    "Incapacitated",
+    "Invisible",
+    "Paralyzed",
+    "Petrified",
+    "Poisoned",
+    "Prone",
+    "Restrained",
+    "Stunned",
+    "Unconscious"};
+
+static const std::array<const char *, PieceProperties::FIELD_COUNT> COLUMNS =
+    {"hp", "max_hp", "initiative", "label", "conditions"};
+
+template<class T>
+static void
+append(vector<byte> &bytes, const T &value) {
+    auto v = Util::serialize_vec(value);
+    bytes.insert(bytes.end(), v.begin(), v.end());
+}
+
+template<class T>
+static bool
+read(const byte *&ptr, const byte *end, T &value) {
+    if (static_cast<size_t>(end - ptr) < sizeof(T)) { return false; }
+    std::memcpy(&value, ptr, sizeof(T));
+    ptr += sizeof(T);
+    return true;
+}
+
+int32_t
+PieceProperties::HP() const {
+    return hp;
+}
+
+void
+PieceProperties::SetHP(int32_t value) {
+    set(HP_FIELD, hp, value);
+}
+
+int32_t
+PieceProperties::MaxHP() const {
+    return max_hp;
+}
+
+void
+PieceProperties::SetMaxHP(int32_t value) {
+    set(MAX_HP_FIELD, max_hp, value);
+}
+
+int32_t
+PieceProperties::Initiative() const {
+    return initiative;
+}
+
+void
+PieceProperties::SetInitiative(int32_t value) {
+    set(INITIATIVE_FIELD, initiative, value);
+}
+
+const string &
+PieceProperties::Label() const {
+    return label;
+}
+
+void
+PieceProperties::SetLabel(string value) {
+    if (value.size() > MaxLabelLength) { value.resize(MaxLabelLength); }
+    set(LABEL_FIELD, label, std::move(value));
+}
+
+bool
+PieceProperties::HasCondition(Condition condition) const {
+    return conditions & (1u << condition);
+}
+
+void
+PieceProperties::SetCondition(Condition condition, bool value) {
+    uint32_t bit = 1u << condition;
+    set(CONDITIONS_FIELD, conditions, value ? conditions | bit : conditions & ~bit);
+}
+
+PieceProperties::field_mask
+PieceProperties::TakeReplicateDirty() {
+    return std::exchange(replicate_dirty, field_mask());
+}
+
+vector<byte>
+PieceProperties::SerializeFields(field_mask fields) const {
+    vector<byte> bytes;
+    append(bytes, static_cast<uint8_t>(fields.to_ulong()));
+    if (fields.test(HP_FIELD)) { append(bytes, hp); }
+    if (fields.test(MAX_HP_FIELD)) { append(bytes, max_hp); }
+    if (fields.test(INITIATIVE_FIELD)) { append(bytes, initiative); }
+    if (fields.test(LABEL_FIELD)) {
+        append(bytes, static_cast<uint8_t>(label.size()));
+        auto begin = reinterpret_cast<const byte *>(label.data());
+        bytes.insert(bytes.end(), begin, begin + label.size());
+    }
+    if (fields.test(CONDITIONS_FIELD)) { append(bytes, conditions); }
+    return bytes;
+}
+
+size_t
+PieceProperties::ApplyFields(const byte *data, size_t size) {
+    const byte *ptr = data;
+    const byte *end = data + size;
+    uint8_t     mask;
+    if (!read(ptr, end, mask)) { return 0; }
+    field_mask fields(mask);
+    // Read everything before applying anything, so a truncated message changes nothing
+    int32_t  new_hp = hp, new_max_hp = max_hp, new_initiative = initiative;
+    string   new_label = label;
+    uint32_t new_conditions = conditions;
+    if (fields.test(HP_FIELD) && !read(ptr, end, new_hp)) { return 0; }
+    if (fields.test(MAX_HP_FIELD) && !read(ptr, end, new_max_hp)) { return 0; }
+    if (fields.test(INITIATIVE_FIELD) && !read(ptr, end, new_initiative)) { return 0; }
+    if (fields.test(LABEL_FIELD)) {
+        uint8_t len;
+        if (!read(ptr, end, len) || static_cast<size_t>(end - ptr) < len) { return 0; }
+        new_label.assign(reinterpret_cast<const char *>(ptr), len);
+        ptr += len;
+    }
+    if (fields.test(CONDITIONS_FIELD) && !read(ptr, end, new_conditions)) { return 0; }
+    hp         = new_hp;
+    max_hp     = new_max_hp;
+    initiative = new_initiative;
+    label      = std::move(new_label);
+    conditions = new_conditions;
+    persist_dirty |= fields;
+    return ptr - data;
+}
+
+void
+PieceProperties::WriteToDB(const SQLite::Database &db, uint64_t piece_uid) const {
+    if (persist_dirty.none()) { return; }
+    auto insert = db.Prepare("INSERT OR IGNORE INTO PieceProperties(piece_id) VALUES(?);");
+    insert.Bind(1, piece_uid);
+    insert.Step();
+
+    string sql = "UPDATE PieceProperties SET ";
+    for (int f = 0; f < FIELD_COUNT; f++) {
+        if (!persist_dirty.test(f)) { continue; }
+        if (sql.back() == '?') { sql += ", "; }
+        sql += string(COLUMNS[f]) + " = ?";
+    }
+    sql += " WHERE piece_id = ?;";
+    auto stmt  = db.Prepare(sql);
+    int  index = 1;
+    if (persist_dirty.test(HP_FIELD)) { stmt.Bind(index++, hp); }
+    if (persist_dirty.test(MAX_HP_FIELD)) { stmt.Bind(index++, max_hp); }
+    if (persist_dirty.test(INITIATIVE_FIELD)) { stmt.Bind(index++, initiative); }
+    if (persist_dirty.test(LABEL_FIELD)) { stmt.Bind(index++, label); }
+    if (persist_dirty.test(CONDITIONS_FIELD)) { stmt.Bind(index++, conditions); }
+    stmt.Bind(index, piece_uid);
+    stmt.Step();
+    persist_dirty.reset();
+}
+
+void
+PieceProperties::ReadFromDB(const SQLite::Database &db, uint64_t piece_uid) {
+    auto stmt = db.Prepare(
+        "SELECT hp, max_hp, initiative, label, conditions FROM PieceProperties "
+        "WHERE piece_id = ?;");
+    stmt.Bind(1, piece_uid);
+    if (stmt.Step()) { return; }
+    int          value;
+    unsigned int flags;
+    stmt.Column(0, value);
+    hp = value;
+    stmt.Column(1, value);
+    max_hp = value;
+    stmt.Column(2, value);
+    initiative = value;
+    stmt.Column(3, label);
+    stmt.Column(4, flags);
+    conditions = flags;
+    persist_dirty.reset();
+}
+
+void
+PieceProperties::MarkUnsaved() {
+    persist_dirty.set();
+}
+
+vector<byte>
+PropertyBatch::Serialize() const {
+    vector<byte> bytes;
+    append(bytes, static_cast<uint32_t>(Entries.size()));
+    for (auto &entry : Entries) {
+        append(bytes, entry.PageUid);
+        append(bytes, entry.PieceUid);
+        append(bytes, static_cast<uint32_t>(entry.Fields.size()));
+        bytes.insert(bytes.end(), entry.Fields.begin(), entry.Fields.end());
+    }
+    return bytes;
+}
+
+PropertyBatch
+PropertyBatch::deserialize_impl(const vector<byte> &vec) {
+    PropertyBatch batch;
+    const byte *  ptr = vec.data();
+    const byte *  end = vec.data() + vec.size();
+    uint32_t      count;
+    if (!read(ptr, end, count)) { return batch; }
+    for (uint32_t i = 0; i < count; i++) {
+        Entry    entry;
+        uint32_t len;
+        if (!read(ptr, end, entry.PageUid) || !read(ptr, end, entry.PieceUid) ||
+            !read(ptr, end, len) || static_cast<size_t>(end - ptr) < len) {
+            break;
+        }
+        entry.Fields.assign(ptr, ptr + len);
+        ptr += len;
+        batch.Entries.push_back(std::move(entry));
+    }
+    return batch;
+}
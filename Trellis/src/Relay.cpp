@@ -0,0 +1,378 @@
+#include "data.h"
+#include "game_object.h"
+#include "metrics.h"
+#include "network_manager.h"
+
+using Data::NetworkData, Data::ClientInfo, Data::ImageChunk, Data::PieceGroup;
+
+using std::chrono::steady_clock;
+
+static Metrics &metrics = Metrics::GetInstance();
+
+bool
+NetworkManager::relay::cached_image::Complete() const {
+    return Whole || (Count > 0 && Chunks.size() == Count);
+}
+
+void
+NetworkManager::relay::ordered_frames::Set(uint64_t uid, const frame_ptr &frame) {
+    auto it = index.find(uid);
+    if (it != index.end()) {
+        it->second->second = frame;
+        return;
+    }
+    index[uid] = Entries.emplace(Entries.end(), uid, frame);
+}
+
+void
+NetworkManager::relay::ordered_frames::Erase(uint64_t uid) {
+    auto it = index.find(uid);
+    if (it == index.end()) { return; }
+    Entries.erase(it->second);
+    index.erase(it);
+}
+
+void
+NetworkManager::relay::ordered_frames::MoveToEnd(uint64_t uid) {
+    auto it = index.find(uid);
+    if (it != index.end()) { Entries.splice(Entries.end(), Entries, it->second); }
+}
+
+void
+NetworkManager::relay::ordered_frames::MoveToBegin(uint64_t uid) {
+    auto it = index.find(uid);
+    if (it != index.end()) { Entries.splice(Entries.begin(), Entries, it->second); }
+}
+
+NetworkManager::relay::relay(
+    std::string       relay_name,
+    asio::io_context &con,
+    std::string       hostname,
+    int               port_num,
+    int               listen_port)
+    : network_object(con)
+    , name(std::move(relay_name))
+    , resolver(con)
+    , acceptor(con, tcp::endpoint(tcp::v4(), listen_port)) {
+    uid                                   = Util::generate_uid();
+    tcp::resolver::results_type endpoints = resolver.resolve(hostname, std::to_string(port_num));
+    upstream                              = std::make_shared<tcp::socket>(con);
+    asio::async_connect(
+        *upstream,
+        endpoints,
+        [this](const asio::error_code &error, const tcp::endpoint &) { handle_connect(error); });
+    listen();
+    // Everything runs on this one thread, so none of the relay state needs locking
+    relay_thread = std::make_shared<asio::thread>([this]() { context.run(); });
+}
+
+NetworkManager::relay::~relay() {
+    context.stop();
+    relay_thread->join();
+}
+
+void
+NetworkManager::relay::Write(Message msg) {
+    WriteSocket(upstream, msg);
+}
+
+void
+NetworkManager::relay::handle_connect(const asio::error_code &error) {
+    if (error) {
+        std::cout << "Relay Connection Error: " << error.message() << std::endl;
+        return;
+    }
+    std::cout << "Relay connected upstream" << std::endl;
+    WriteSocket(upstream, Message(name, uid, "SPECTATE"));
+    read_msg.DataVec = std::vector<std::byte>(MessageHeader::HeaderLength);
+    asio::async_read(
+        *upstream,
+        asio::buffer(read_msg.Data(), MessageHeader::HeaderLength),
+        [this](const asio::error_code &error, size_t bytes_transferred) {
+            handle_read_header(upstream, read_msg, error, bytes_transferred);
+        });
+}
+
+void
+NetworkManager::relay::handle_header_action([[maybe_unused]] const socket_ptr &sock) {
+    const std::string &channel = read_msg.Header.Channel;
+    auto               body    = read_msg.Msg();
+    auto               frame   = std::make_shared<const std::vector<std::byte>>(read_msg.DataVec);
+    metrics.RecordMessage(channel, Metrics::IN, frame->size());
+    if (channel == "JOIN_ACCEPT") {
+        join_accept = frame;
+        WriteSocket(
+            upstream,
+            Message(Util::serialize_vec(NetworkData(name, uid, uid)), 0, "SPECTATE_DONE"));
+        // Spectators that showed up before the host accepted us have been waiting for this
+        for (auto &s : spectators) {
+            if (s->Uid != 0 && !s->Joined) { send(s, join_accept); }
+        }
+        return;
+    }
+    if (channel == "IMAGE_CHUNK" || channel == "NEW_IMAGE" || channel == "IMAGE_PREVIEW") {
+        handle_image_frame(channel, body, frame);
+        return;
+    }
+    // The relay never holds images of its own, so there is nothing to serve upstream
+    if (channel == "IMAGE_REQUEST" || channel == "CHUNK_REQUEST") { return; }
+    cache_frame(channel, body, frame);
+    for (auto &s : spectators) {
+        if (s->Joined) { send(s, frame); }
+    }
+}
+
+void
+NetworkManager::relay::cache_frame(
+    const std::string &           channel,
+    const std::vector<std::byte> &body,
+    const frame_ptr &             frame) {
+    auto nd = Util::deserialize<NetworkData>(body);
+    if (channel == "ADD_PAGE") {
+        pages.Set(nd.Uid, frame);
+    } else if (channel == "ADD_PIECE") {
+        pieces.Set(CoreGameObject::Deserialize(nd.Data).Uid, frame);
+    } else if (channel == "MOVE_PIECE") {
+        piece_moves[nd.Parse<NetworkData>().Uid] = frame;
+    } else if (channel == "RESIZE_PIECE") {
+        piece_resizes[nd.Parse<NetworkData>().Uid] = frame;
+    } else if (channel == "ADD_PIECES") {
+        // Batches are cached as their single piece messages, so later updates to any one piece
+        // replace just that piece
+        for (auto &piece : nd.Parse<PieceList>().Pieces) {
+            NetworkData add(piece, nd.Uid, nd.ClientUid);
+            pieces.Set(piece.Uid, make_frame("ADD_PIECE", add));
+        }
+    } else if (channel == "MOVE_PIECES" || channel == "RESIZE_PIECES") {
+        auto  group   = nd.Parse<PieceGroup>();
+        bool  moving  = channel == "MOVE_PIECES";
+        auto &updates = moving ? piece_moves : piece_resizes;
+        for (size_t i = 0; i < group.Uids.size() && i < group.Values.size(); i++) {
+            NetworkData update(NetworkData(group.Values[i], group.Uids[i]), nd.Uid, nd.ClientUid);
+            updates[group.Uids[i]] = make_frame(moving ? "MOVE_PIECE" : "RESIZE_PIECE", update);
+        }
+    } else if (channel == "DELETE_PIECES") {
+        for (auto piece_uid : nd.Parse<PieceGroup>().Uids) {
+            pieces.Erase(piece_uid);
+            piece_moves.erase(piece_uid);
+            piece_resizes.erase(piece_uid);
+            piece_properties.erase(piece_uid);
+        }
+    } else if (channel == "RAISE_PIECES" || channel == "LOWER_PIECES") {
+        // The uids come top first. Each piece added goes on top, so raised pieces are moved to the
+        // end of the cache bottom one first, and lowered ones to the start top one first.
+        auto uids = nd.Parse<PieceGroup>().Uids;
+        if (channel == "RAISE_PIECES") {
+            for (auto it = uids.rbegin(); it != uids.rend(); ++it) { pieces.MoveToEnd(*it); }
+        } else {
+            for (auto piece_uid : uids) { pieces.MoveToBegin(piece_uid); }
+        }
+    } else if (channel == "PIECE_PROPS") {
+        for (auto &entry : nd.Parse<PropertyBatch>().Entries) {
+            auto &[page_uid, props] = piece_properties[entry.PieceUid];
+            page_uid                = entry.PageUid;
+            props.ApplyFields(entry.Fields.data(), entry.Fields.size());
+        }
+    } else if (channel == "DELETE_PIECE") {
+        uint64_t piece_uid = nd.Parse<NetworkData>().Uid;
+        pieces.Erase(piece_uid);
+        piece_moves.erase(piece_uid);
+        piece_resizes.erase(piece_uid);
+        piece_properties.erase(piece_uid);
+    } else if (channel == "PLAYER_VIEW") {
+        player_view = frame;
+    } else if (channel == "CLIENT_ADD") {
+        clients[nd.Parse<ClientInfo>().Uid] = frame;
+    } else if (channel == "CLIENT_DELETE") {
+        clients.erase(nd.Uid);
+    } else if (channel == "CHAT_MSG") {
+        chat.push_back(frame);
+        if (chat.size() > ChatHistory) { chat.pop_front(); }
+    }
+}
+
+void
+NetworkManager::relay::handle_image_frame(
+    const std::string &           channel,
+    const std::vector<std::byte> &body,
+    const frame_ptr &             frame) {
+    auto nd = Util::deserialize<NetworkData>(body);
+    if (channel == "IMAGE_CHUNK" && !nd.Parse<ImageChunk>().Consistent()) { return; }
+    auto &image = images[nd.Uid];
+    if (channel == "IMAGE_PREVIEW") {
+        image.Preview = frame;
+    } else if (channel == "NEW_IMAGE") {
+        image.Whole = frame;
+        image.Chunks.clear();
+    } else {
+        auto chunk = nd.Parse<ImageChunk>();
+        if (image.Hash != chunk.Hash) {
+            // Image changed upstream, anything cached so far is stale
+            image.Chunks.clear();
+            image.Whole.reset();
+            image.Hash = chunk.Hash;
+        }
+        image.Count               = chunk.Count;
+        image.Chunks[chunk.Index] = frame;
+    }
+    for (auto &s : image.Waiting) { send(s, frame); }
+    if (image.Complete()) {
+        image.Waiting.clear();
+        image.Requested = {};
+    } else if (image.Requested != steady_clock::time_point{}) {
+        image.Requested = steady_clock::now();
+    }
+}
+
+void
+NetworkManager::relay::listen() {
+    socket_ptr new_sock = std::make_shared<tcp::socket>(context);
+    acceptor.async_accept(*new_sock, [this, new_sock](const asio::error_code &error) {
+        handle_accept(new_sock, error);
+    });
+}
+
+void
+NetworkManager::relay::handle_accept(socket_ptr sock, const asio::error_code &error) {
+    if (!error) {
+        auto s  = std::make_shared<spectator>();
+        s->Sock = sock;
+        spectators.insert(s);
+        read_spectator(s);
+    } else {
+        std::cout << "Relay Accept Error: " << error.message() << std::endl;
+    }
+    listen();
+}
+
+void
+NetworkManager::relay::read_spectator(const spectator_ptr &s) {
+    s->ReadMsg.DataVec = std::vector<std::byte>(MessageHeader::HeaderLength);
+    asio::async_read(
+        *s->Sock,
+        asio::buffer(s->ReadMsg.Data(), MessageHeader::HeaderLength),
+        [this, s](const asio::error_code &error, size_t) {
+            if (error || !s->ReadMsg.DecodeHeader()) {
+                drop_spectator(s);
+                return;
+            }
+            asio::async_read(
+                *s->Sock,
+                asio::buffer(
+                    s->ReadMsg.Body(),
+                    static_cast<size_t>(s->ReadMsg.Header.MessageLength)),
+                [this, s](const asio::error_code &error, size_t) {
+                    if (error) {
+                        drop_spectator(s);
+                        return;
+                    }
+                    handle_spectator_frame(s);
+                    read_spectator(s);
+                });
+        });
+}
+
+void
+NetworkManager::relay::handle_spectator_frame(const spectator_ptr &s) {
+    const std::string &channel = s->ReadMsg.Header.Channel;
+    if (channel == "SPECTATE") {
+        s->Uid = s->ReadMsg.Header.Uid;
+        if (join_accept) { send(s, join_accept); }
+    } else if (channel == "SPECTATE_DONE") {
+        send_snapshot(s);
+        s->Joined = true;
+    } else if (channel == "IMAGE_REQUEST") {
+        auto  nd     = Util::deserialize<NetworkData>(s->ReadMsg.Msg());
+        auto  img_id = nd.Parse<uint64_t>();
+        auto &image  = images[img_id];
+        if (image.Whole) {
+            send(s, image.Whole);
+        } else {
+            if (image.Preview) { send(s, image.Preview); }
+            for (auto &[index, frame] : image.Chunks) { send(s, frame); }
+        }
+        if (image.Complete()) { return; }
+        image.Waiting.insert(s);
+        // However many spectators want this image, it is only asked for again once it has stalled
+        auto now = steady_clock::now();
+        if (image.Requested == steady_clock::time_point{} ||
+            now - image.Requested >= ImageRequestTimeout) {
+            image.Requested = now;
+            WriteSocket(
+                upstream,
+                Message(Util::serialize_vec(NetworkData(img_id, uid, uid)), 0, "IMAGE_REQUEST"));
+        }
+    }
+    // Spectators are read-only, anything else they send is dropped
+}
+
+void
+NetworkManager::relay::send_snapshot(const spectator_ptr &s) {
+    for (auto &[id, frame] : clients) { send(s, frame); }
+    for (auto &[id, frame] : pages.Entries) { send(s, frame); }
+    for (auto &[id, frame] : pieces.Entries) { send(s, frame); }
+    for (auto &[id, frame] : piece_moves) { send(s, frame); }
+    for (auto &[id, frame] : piece_resizes) { send(s, frame); }
+    if (!piece_properties.empty()) {
+        PropertyBatch batch;
+        for (auto &[piece_uid, entry] : piece_properties) {
+            batch.Entries.push_back({entry.first, piece_uid, entry.second.SerializeFields()});
+        }
+        send(s, make_frame("PIECE_PROPS", NetworkData(batch, 0, uid)));
+    }
+    if (player_view) { send(s, player_view); }
+    for (auto &frame : chat) { send(s, frame); }
+}
+
+NetworkManager::relay::frame_ptr
+NetworkManager::relay::make_frame(const std::string &channel, const NetworkData &nd) const {
+    Message msg(Util::serialize_vec(nd), 0, channel);
+    return std::make_shared<const std::vector<std::byte>>(msg.DataVec);
+}
+
+void
+NetworkManager::relay::send(const spectator_ptr &s, const frame_ptr &frame) {
+    if (s->WriteQueue.size() >= MaxSpectatorBacklog) {
+        // Closing fails the pending write, whose handler then drops the spectator
+        std::cout << "Dropping spectator " << s->Uid << ", too far behind" << std::endl;
+        asio::error_code ec;
+        s->Sock->close(ec);
+        return;
+    }
+    bool write_in_progress = !s->WriteQueue.empty();
+    s->WriteQueue.push_back(frame);
+    metrics.WriteQueueDepth.fetch_add(1, std::memory_order_relaxed);
+    if (!write_in_progress) {
+        asio::async_write(
+            *s->Sock,
+            asio::buffer(*s->WriteQueue.front()),
+            [this, s](const asio::error_code &error, size_t) { handle_spectator_write(s, error); });
+    }
+}
+
+void
+NetworkManager::relay::handle_spectator_write(
+    const spectator_ptr &   s,
+    const asio::error_code &error) {
+    if (error) {
+        drop_spectator(s);
+        return;
+    }
+    s->WriteQueue.pop_front();
+    metrics.WriteQueueDepth.fetch_sub(1, std::memory_order_relaxed);
+    if (!s->WriteQueue.empty()) {
+        asio::async_write(
+            *s->Sock,
+            asio::buffer(*s->WriteQueue.front()),
+            [this, s](const asio::error_code &error, size_t) { handle_spectator_write(s, error); });
+    }
+}
+
+void
+NetworkManager::relay::drop_spectator(const spectator_ptr &s) {
+    if (spectators.erase(s) == 0) { return; }
+    asio::error_code ec;
+    s->Sock->close(ec);
+    metrics.WriteQueueDepth.fetch_sub(s->WriteQueue.size(), std::memory_order_relaxed);
+    for (auto &[id, image] : images) { image.Waiting.erase(s); }
+}
@@ -1,16 +1,23 @@
 #include "resource_manager.h"
+#include "frame_pacer.h"
 #include "stb_image.h"
 
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
 #include <fstream>
 #include <functional>
 #include <iostream>
 #include <memory>
 #include <sstream>
+#include <tuple>
 #include <unordered_map>
 #include <vector>
 
-using Data::ImageData;
-using std::make_pair, std::make_shared, std::shared_ptr, std::string;
+using Data::ImageData, Data::ImagePreview;
+using std::make_pair, std::make_shared, std::shared_ptr, std::string, std::vector,
+    std::chrono::steady_clock;
 
 ResourceManager &
 ResourceManager::GetInstance() {
@@ -25,8 +32,21 @@ ResourceManager::LoadShader(
     const char *  fShaderFile,
     const char *  gShaderFile,
     const string &name) {
-    Shaders.insert(make_pair(name, loadShaderFromFile(vShaderFile, fShaderFile, gShaderFile)));
-    return Shaders.at(name);
+    shader_files files{vShaderFile, fShaderFile, gShaderFile != nullptr ? gShaderFile : ""};
+    auto         it     = Shaders.find(name);
+    auto         loaded = shader_sources.find(name);
+    // Every board asks for its shaders, they only have to be loaded once
+    if (it != Shaders.end() && loaded != shader_sources.end() &&
+        loaded->second.Vertex == files.Vertex && loaded->second.Fragment == files.Fragment &&
+        loaded->second.Geometry == files.Geometry) {
+        return it->second;
+    }
+    files.Modified       = files.LastModified();
+    auto shader          = loadShaderFromFile(name, files);
+    shader_sources[name] = files;
+    if (it == Shaders.end()) { return Shaders[name] = shader; }
+    it->second->Swap(*shader);
+    return it->second;
 }
 
 shared_ptr<Shader>
@@ -34,103 +54,752 @@ ResourceManager::GetShader(const std::string &name) {
     return Shaders.at(name);
 }
 
-shared_ptr<Texture2D>
-ResourceManager::LoadTexture(const char *file) {
-    auto tex                = loadTextureFromFile(file);
-    Textures[tex->ImageUID] = tex;
-    return tex;
+uint64_t
+ResourceManager::ImportImage(const char *file) {
+    std::ifstream              infile(file, std::ios_base::binary);
+    std::vector<unsigned char> buffer(
+        (std::istreambuf_iterator<char>(infile)),
+        (std::istreambuf_iterator<char>()));
+    auto hash = Util::hash_image(buffer);
+    for (auto &i : Images) {
+        if (i.second.Hash == hash) { return i.first; }
+    }
+    uint64_t uid = Util::generate_uid();
+    Images[uid]  = ImageData(buffer);
+    // Decoding it right away also makes the preview that is sent ahead of it
+    decode(uid);
+    return uid;
 }
 
 shared_ptr<Texture2D>
 ResourceManager::GetTexture(uint64_t uid) {
-    return loadTextureFromUID(uid);
+    auto it = Textures.find(uid);
+    if (it != Textures.end()) {
+        // The image may have arrived since it was last asked for
+        if (loading.count(uid) != 0) { decode(uid); }
+        return it->second;
+    }
+    unsigned char clear[] = {0, 0, 0, 0};
+    auto          texture = Texture2D::Create(1, 1, clear, uid, GL_RGBA, GL_RGBA);
+    Textures[uid]         = texture;
+    loading.insert(uid);
+    decode(uid);
+    return texture;
 }
 
-ResourceManager::~ResourceManager() {}
+SpriteRegion
+ResourceManager::GetSprite(uint64_t uid) {
+    if (auto region = Atlas.Find(uid)) { return *region; }
+    if (loading.count(uid) == 0) {
+        // Too big for the atlas, or it had no room left
+        auto it = Textures.find(uid);
+        if (it != Textures.end()) { return SpriteRegion{it->second}; }
+        loading.insert(uid);
+    }
+    // The image may have arrived since it was last asked for
+    decode(uid);
+    return SpriteRegion{GetPreviewTexture(uid)};
+}
 
-std::shared_ptr<Shader>
-ResourceManager::loadShaderFromFile(
-    const char *vShaderFile,
-    const char *fShaderFile,
-    const char *gShaderFile) {
-    // 1. retrieve the vertex/fragment source code from filePath
-    std::string vertexCode;
-    std::string fragmentCode;
-    std::string geometryCode;
-    try {
-        // open files
-        std::ifstream     vertexShaderFile(vShaderFile);
-        std::ifstream     fragmentShaderFile(fShaderFile);
-        std::stringstream vShaderStream, fShaderStream;
-        // read file's buffer contents into streams
-        vShaderStream << vertexShaderFile.rdbuf();
-        fShaderStream << fragmentShaderFile.rdbuf();
-        // close file handlers
-        vertexShaderFile.close();
-        fragmentShaderFile.close();
-        // convert stream into string
-        vertexCode   = vShaderStream.str();
-        fragmentCode = fShaderStream.str();
-        // if geometry sprite_shader path is present, also load a geometry sprite_shader
-        if (gShaderFile != nullptr) {
-            std::ifstream     geometryShaderFile(gShaderFile);
-            std::stringstream gShaderStream;
-            gShaderStream << geometryShaderFile.rdbuf();
-            geometryShaderFile.close();
-            geometryCode = gShaderStream.str();
-        }
-    } catch ([[maybe_unused]] std::exception &e) {
-        std::cout << "ERROR::SHADER: Failed to read sprite_shader files" << std::endl;
+vector<uint64_t>
+ResourceManager::TakeChangedSprites() {
+    auto moved = Atlas.TakeMoved();
+    changed.insert(changed.end(), moved.begin(), moved.end());
+    return std::exchange(changed, {});
+}
+
+const ImagePreview &
+ResourceManager::GetPreview(uint64_t uid) {
+    static const ImagePreview none;
+    auto                      it = Previews.find(uid);
+    if (it != Previews.end()) { return it->second; }
+    if (Images.find(uid) == Images.end() || !previewing.insert(uid).second) { return none; }
+    // Huge images make theirs from their top tile
+    if (find_tiled(uid)) {
+        decode(uid);
+    } else {
+        decode_preview(uid);
     }
-    const char *vShaderCode = vertexCode.c_str();
-    const char *fShaderCode = fragmentCode.c_str();
-    const char *gShaderCode = geometryCode.c_str();
-    // 2. now create sprite_shader object from source code
-    return Shader::Create(vShaderCode, fShaderCode, gShaderFile != nullptr ? gShaderCode : nullptr);
+    return none;
+}
+
+vector<uint64_t>
+ResourceManager::TakeNewPreviews() {
+    return std::exchange(new_previews, {});
+}
+
+void
+ResourceManager::LoadPreview(uint64_t uid, const ImagePreview &preview) {
+    // Too late, the real thing got here first
+    if (Textures.find(uid) != Textures.end() || Images.find(uid) != Images.end()) { return; }
+    if (preview.Empty()) { return; }
+    auto pixels          = preview.Pixels;
+    PreviewTextures[uid] = Texture2D::Create(
+        preview.Width,
+        preview.Height,
+        pixels.data(),
+        uid,
+        GL_RGBA,
+        GL_RGBA);
 }
 
 shared_ptr<Texture2D>
-ResourceManager::loadTextureFromFile(const char *file) {
-    // create texture object
-    // load image
-    int width, height, nrChannels;
-    // unsigned char *data = stbi_load(file, &width, &height, &nrChannels, 0);
-    std::ifstream              infile(file, std::ios_base::binary);
-    std::vector<unsigned char> buffer(
-        (std::istreambuf_iterator<char>(infile)),
-        (std::istreambuf_iterator<char>()));
-    for (auto &i : Images) {
-        if (i.second.Hash == Util::hash_image(buffer)) { return loadTextureFromUID(i.first); }
-    }
-    unsigned char *data =
-        stbi_load_from_memory(buffer.data(), buffer.size(), &width, &height, &nrChannels, 0);
-    uint64_t              uid = Util::generate_uid();
-    shared_ptr<Texture2D> texture;
-    if (nrChannels == 4) {
-        texture = Texture2D::Create(width, height, data, uid, GL_RGBA, GL_RGBA);
+ResourceManager::GetPreviewTexture(uint64_t uid) {
+    auto it = PreviewTextures.find(uid);
+    return it == PreviewTextures.end() ? nullptr : it->second;
+}
+
+void
+ResourceManager::Update() {
+    auto start       = steady_clock::now();
+    auto out_of_time = [start]() { return steady_clock::now() - start >= FrameBudget; };
+    // Before this frame's uploads finish, so the pieces waiting on them get to pick them up
+    update_cache();
+    if (WatchShaders) { reload_changed_shaders(); }
+    {
+        const std::lock_guard<std::mutex> lock(decoded_mtx);
+        for (auto &image : decoded_images) { ready.push_back(std::move(image)); }
+        decoded_images.clear();
+        for (auto &tile : decoded_tiles) { ready_tiles.push_back(std::move(tile)); }
+        decoded_tiles.clear();
+    }
+    while (!ready.empty() && !out_of_time()) {
+        place(std::move(ready.front()));
+        ready.pop_front();
+    }
+    // Big images are streamed in over as many frames as they need
+    while (!uploads.empty() && !out_of_time()) {
+        auto &job = uploads.front();
+        if (!upload_band(job)) { continue; }
+        job.Target->SwapStorage(*job.Staging);
+        mipmap_queue.push_back(job.Target);
+        uint64_t uid = job.Image.Uid;
+        PreviewTextures.erase(uid);
+        loading.erase(uid);
+        decoding.erase(uid);
+        evicted.erase(uid);
+        changed.push_back(uid);
+        uploads.pop_front();
+    }
+    for (auto &page : Atlas.TakeDirty()) { mipmap_queue.push_back(page); }
+    while (!mipmap_queue.empty() && !out_of_time()) {
+        auto texture = mipmap_queue.front().lock();
+        mipmap_queue.pop_front();
+        if (texture) { texture->GenerateMipmaps(); }
+    }
+    while (!ready_tiles.empty() && !out_of_time()) {
+        place_tile(std::move(ready_tiles.front()));
+        ready_tiles.pop_front();
+    }
+    evict_tiles();
+    // Keep frames coming until everything that was decoded is on screen
+    if (!ready.empty() || !uploads.empty() || !mipmap_queue.empty() || !ready_tiles.empty()) {
+        FramePacer::GetInstance().Wake();
+    }
+}
+
+void
+ResourceManager::decode(uint64_t uid) {
+    auto it = Images.find(uid);
+    if (it == Images.end() || !decoding.insert(uid).second) { return; }
+    // Workers get their own copy, Images is only ever touched from this thread
+    auto bytes        = std::make_shared<const vector<unsigned char>>(it->second.Data);
+    bool make_preview = Previews.find(uid) == Previews.end();
+    // Huge images come from their tiles, which are built the first time the image is seen
+    if (auto *tiled = find_tiled(uid)) {
+        decode_tiled(uid, *tiled, bytes, make_preview);
+        return;
+    }
+    asio::post(workers, [this, uid, bytes, make_preview]() {
+        decoded image;
+        image.Uid = uid;
+        int width, height, channels;
+        if (stbi_info_from_memory(bytes->data(), bytes->size(), &width, &height, &channels)) {
+            // The atlas is RGBA, big images keep three channels if that's all they have
+            int  max    = TextureAtlas::MaxImageSize;
+            bool small  = width <= max && height <= max;
+            int  wanted = !small && channels == 3 ? 3 : 4;
+            unsigned char *data = stbi_load_from_memory(
+                bytes->data(),
+                bytes->size(),
+                &width,
+                &height,
+                &channels,
+                wanted);
+            if (data) {
+                image.Width    = width;
+                image.Height   = height;
+                image.Channels = wanted;
+                image.Pixels.assign(data, data + static_cast<size_t>(width) * height * wanted);
+                if (make_preview) { image.Preview = ImagePreview(data, width, height, wanted); }
+                stbi_image_free(data);
+            }
+        }
+        {
+            const std::lock_guard<std::mutex> lock(decoded_mtx);
+            decoded_images.push_back(std::move(image));
+        }
+        FramePacer::GetInstance().Wake();
+    });
+}
+
+void
+ResourceManager::decode_preview(uint64_t uid) {
+    auto bytes = std::make_shared<const vector<unsigned char>>(Images[uid].Data);
+    asio::post(workers, [this, uid, bytes]() {
+        decoded image;
+        image.Uid         = uid;
+        image.PreviewOnly = true;
+        int            width, height, channels;
+        unsigned char *data =
+            stbi_load_from_memory(bytes->data(), bytes->size(), &width, &height, &channels, 0);
+        if (data) { image.Preview = ImagePreview(data, width, height, channels); }
+        stbi_image_free(data);
+        {
+            const std::lock_guard<std::mutex> lock(decoded_mtx);
+            decoded_images.push_back(std::move(image));
+        }
+        FramePacer::GetInstance().Wake();
+    });
+}
+
+void
+ResourceManager::place(decoded &&image) {
+    uint64_t uid = image.Uid;
+    if (!image.Preview.Empty() && Previews.find(uid) == Previews.end()) {
+        Previews[uid] = std::move(image.Preview);
+    }
+    // Whoever asked for the preview hears about it once, whichever job made it first
+    if (Previews.find(uid) != Previews.end() && previewing.erase(uid) > 0) {
+        new_previews.push_back(uid);
+    }
+    if (image.PreviewOnly) {
+        // An image that doesn't decode gets an empty preview, which is never sent
+        if (previewing.erase(uid) > 0) {
+            Previews[uid];
+            new_previews.push_back(uid);
+        }
+        return;
+    }
+    auto texture = Textures.find(uid);
+    if (image.Pixels.empty()) {
+        decoding.erase(uid);
+        loading.erase(uid);
+        return;
+    }
+    auto tiled = tiled_images.find(uid);
+    if (tiled != tiled_images.end()) { tiled->second.Ready = true; }
+    // Nothing asked for a texture of its own, so try the atlas first
+    if (texture == Textures.end() && image.Channels == 4 &&
+        Atlas.Insert(uid, image.Pixels.data(), image.Width, image.Height)) {
+        PreviewTextures.erase(uid);
+        decoding.erase(uid);
+        loading.erase(uid);
+        changed.push_back(uid);
+        return;
+    }
+    upload job;
+    job.Target = texture != Textures.end() ? texture->second : GetTexture(uid);
+    auto format = image.Channels == 4 ? GL_RGBA : GL_RGB;
+    job.Staging = Texture2D::Create(image.Width, image.Height, nullptr, uid, format, format);
+    job.Image   = std::move(image);
+    uploads.push_back(std::move(job));
+}
+
+bool
+ResourceManager::upload_band(upload &job) {
+    auto & image  = job.Image;
+    size_t stride = static_cast<size_t>(image.Width) * image.Channels;
+    int    rows   = static_cast<int>(std::max<size_t>(1, UploadBandSize / stride));
+    rows          = std::min(rows, image.Height - job.Row);
+    size_t bytes  = stride * rows;
+    const unsigned char *band = image.Pixels.data() + stride * job.Row;
+    if (upload_PBOs[0] == 0) { glGenBuffers(2, upload_PBOs); }
+    // Alternate between two buffers, so filling one never waits on the transfer out of the other
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, upload_PBOs[next_PBO]);
+    next_PBO = (next_PBO + 1) % 2;
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, bytes, nullptr, GL_STREAM_DRAW);
+    void *mapped = glMapBufferRange(
+        GL_PIXEL_UNPACK_BUFFER,
+        0,
+        bytes,
+        GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    if (mapped) {
+        std::memcpy(mapped, band, bytes);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        // With a pixel buffer bound, the data pointer is an offset into it
+        job.Staging->Update(0, job.Row, image.Width, rows, nullptr);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
     } else {
-        texture = Texture2D::Create(width, height, data, uid);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        job.Staging->Update(0, job.Row, image.Width, rows, band);
     }
-    Images[uid] = ImageData(buffer);
-    stbi_image_free(data);
-    return texture;
+    job.Row += rows;
+    return job.Row >= image.Height;
 }
 
-shared_ptr<Texture2D>
-ResourceManager::loadTextureFromUID(uint64_t uid) {
-    if (Textures.find(uid) != Textures.end()) { return Textures[uid]; }
-    ImageData      d = Images[uid];
-    int            width, height, nrChannels;
-    unsigned char *data =
-        stbi_load_from_memory(d.Data.data(), d.Data.size(), &width, &height, &nrChannels, 0);
-    shared_ptr<Texture2D> texture;
-    if (nrChannels == 4) {
-        texture = Texture2D::Create(width, height, data, uid, GL_RGBA, GL_RGBA);
+void
+ResourceManager::KeepResident(uint64_t uid) {
+    next_active_page.insert(uid);
+}
+
+void
+ResourceManager::update_cache() {
+    auto now = steady_clock::now();
+    frame++;
+    resident_bytes = 0;
+    active_page.swap(next_active_page);
+    next_active_page.clear();
+    for (auto it = Textures.begin(); it != Textures.end();) {
+        auto &[uid, texture] = *it;
+        // Only the cache holds it, so nothing will draw it again
+        if (texture.use_count() == 1) {
+            loading.erase(uid);
+            last_drawn.erase(uid);
+            evicted.erase(uid);
+            trim_since.erase(uid);
+            it = Textures.erase(it);
+            continue;
+        }
+        float drawn = texture->TakeDrawnSize();
+        if (drawn > 0) {
+            last_drawn[uid] = frame;
+            // Back on screen, its preview is drawn until the image has been uploaded again
+            if (evicted.count(uid) != 0 && loading.insert(uid).second) { decode(uid); }
+        }
+        if (TrimLargeTextures) { update_residency(uid, *texture, drawn, now); }
+        resident_bytes += texture->Bytes();
+        ++it;
+    }
+    if (resident_bytes <= TextureBudget) { return; }
+    // Images on the active page stay even while they are off screen, and so does anything drawn
+    // last frame. Everything else goes least recently drawn first.
+    std::vector<std::pair<uint64_t, uint64_t>> candidates;
+    for (auto &[uid, texture] : Textures) {
+        auto drawn = last_drawn.find(uid);
+        auto since = drawn != last_drawn.end() ? drawn->second : 0;
+        if (since == frame || active_page.count(uid) != 0) { continue; }
+        if (evicted.count(uid) != 0 || decoding.count(uid) != 0) { continue; }
+        candidates.emplace_back(since, uid);
+    }
+    std::sort(candidates.begin(), candidates.end());
+    for (auto &candidate : candidates) {
+        if (resident_bytes <= TextureBudget) { break; }
+        evict(candidate.second, *Textures[candidate.second]);
+    }
+}
+
+void
+ResourceManager::evict(uint64_t uid, Texture2D &texture) {
+    size_t        bytes    = texture.Bytes();
+    unsigned char clear[]  = {0, 0, 0, 0};
+    auto          preview  = Previews.find(uid);
+    auto          stand_in = preview != Previews.end() && !preview->second.Empty()
+                        ? Texture2D::Create(
+                              preview->second.Width,
+                              preview->second.Height,
+                              preview->second.Pixels.data(),
+                              uid,
+                              GL_RGBA,
+                              GL_RGBA)
+                        : Texture2D::Create(1, 1, clear, uid, GL_RGBA, GL_RGBA);
+    // The old storage goes with the stand-in, pieces holding the texture draw the preview
+    texture.SwapStorage(*stand_in);
+    evicted[uid] = bytes;
+    resident_bytes -= bytes - texture.Bytes();
+    trim_since.erase(uid);
+}
+
+void
+ResourceManager::update_residency(
+    uint64_t                              uid,
+    Texture2D &                           texture,
+    float                                 drawn,
+    std::chrono::steady_clock::time_point now) {
+    unsigned size = std::max(texture.Width, texture.Height);
+    // Images that weren't drawn this frame keep whatever they have
+    if (size < LargeTextureSize || !texture.Mipmapped() || drawn <= 0) {
+        trim_since.erase(uid);
+        return;
+    }
+    // The first level with at least one texel for every pixel it covers on screen
+    int wanted   = static_cast<int>(std::floor(std::log2(size / drawn)));
+    wanted       = std::clamp(wanted, 0, texture.Levels() - 1);
+    int resident = texture.ResidentLevel();
+    if (wanted > resident) {
+        auto since = trim_since.try_emplace(uid, now).first->second;
+        if (now - since >= TrimDelay) {
+            texture.DropLevels(wanted);
+            trim_since.erase(uid);
+        }
+        return;
+    }
+    trim_since.erase(uid);
+    // Zoomed back in, the levels that were dropped have to come from the image again. The
+    // trimmed texture is drawn until the full one has been uploaded.
+    if (wanted < resident) { decode(uid); }
+}
+
+void
+ResourceManager::OpenTileStore(const string &path) {
+    const std::lock_guard<std::mutex> lock(tile_db_mtx);
+    tile_db = std::make_unique<SQLite::Database>(path);
+    // Tiles are written while the game may be saving through another connection
+    string error;
+    tile_db->Exec("PRAGMA busy_timeout = 5000;", error);
+}
+
+ResourceManager::tiled_image *
+ResourceManager::find_tiled(uint64_t uid) {
+    auto tiled = tiled_images.find(uid);
+    if (tiled != tiled_images.end()) { return &tiled->second; }
+    auto image = Images.find(uid);
+    if (!tile_db || image == Images.end()) { return nullptr; }
+    if (max_texture_size == 0) { glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_texture_size); }
+    // Only the header is read
+    auto &data = image->second.Data;
+    int   width, height, channels;
+    if (!stbi_info_from_memory(data.data(), data.size(), &width, &height, &channels) ||
+        std::max(width, height) <= std::min(ImageTiles::MinTiledSize, max_texture_size)) {
+        return nullptr;
+    }
+    auto &entry  = tiled_images[uid];
+    entry.Layout = ImageTiles(width, height);
+    entry.Hash   = image->second.Hash;
+    return &entry;
+}
+
+void
+ResourceManager::decode_tiled(
+    uint64_t                                uid,
+    const tiled_image &                     tiled,
+    shared_ptr<const vector<unsigned char>> bytes,
+    bool                                    make_preview) {
+    auto layout = tiled.Layout;
+    auto hash   = tiled.Hash;
+    asio::post(workers, [this, uid, layout, hash, bytes, make_preview]() {
+        decoded image;
+        image.Uid = uid;
+        int top   = layout.Levels - 1;
+        try {
+            vector<unsigned char> pixels;
+            {
+                const std::lock_guard<std::mutex> lock(tile_db_mtx);
+                pixels = layout.ReadTile(*tile_db, hash, top, 0, 0);
+            }
+            if (pixels.empty()) {
+                // The only time the image is ever decoded whole
+                int  width, height, channels;
+                auto data = std::unique_ptr<unsigned char, void (*)(void *)>(
+                    stbi_load_from_memory(
+                        bytes->data(),
+                        bytes->size(),
+                        &width,
+                        &height,
+                        &channels,
+                        0),
+                    stbi_image_free);
+                if (data && width == layout.Width && height == layout.Height) {
+                    layout.Build(*tile_db, tile_db_mtx, hash, data.get(), channels);
+                    data.reset();
+                    const std::lock_guard<std::mutex> lock(tile_db_mtx);
+                    pixels = layout.ReadTile(*tile_db, hash, top, 0, 0);
+                }
+            }
+            if (!pixels.empty()) {
+                auto extent    = layout.TileExtent(top, 0, 0);
+                image.Width    = extent.x;
+                image.Height   = extent.y;
+                image.Channels = 4;
+                if (make_preview) {
+                    image.Preview = ImagePreview(pixels.data(), extent.x, extent.y, 4);
+                }
+                image.Pixels = std::move(pixels);
+            }
+        } catch (std::exception &e) {
+            std::cout << "Failed to tile image " << uid << ": " << e.what() << std::endl;
+        }
+        {
+            const std::lock_guard<std::mutex> lock(decoded_mtx);
+            decoded_images.push_back(std::move(image));
+        }
+        FramePacer::GetInstance().Wake();
+    });
+}
+
+vector<TileRegion>
+ResourceManager::VisibleTiles(uint64_t uid, const Transform &transform) {
+    auto it = tiled_images.find(uid);
+    if (it == tiled_images.end() || !it->second.Ready) { return {}; }
+    auto &tiled  = it->second;
+    auto &layout = tiled.Layout;
+    // The view only ever pans and zooms, so its scale is the zoom
+    float zoom   = glm::length(glm::vec2(global_state.View[0]));
+    float pixels = std::max(transform.scale.x, transform.scale.y) * zoom;
+    if (pixels <= 0) { return {}; }
+    // The first level with at least one texel for every pixel it covers, the top one is the
+    // sprite itself
+    float texels = static_cast<float>(std::max(layout.Width, layout.Height));
+    int   level  = std::max(static_cast<int>(std::floor(std::log2(texels / pixels))), 0);
+    if (level >= layout.Levels - 1) { return {}; }
+    // The part of the piece that is on screen, in the unit quad it is drawn from
+    glm::mat4 to_quad = glm::inverse(global_state.View * transform.Model());
+    glm::vec2 res     = global_state.ScreenRes;
+    glm::vec2 lo(1), hi(0);
+    for (auto corner : {glm::vec2(0), glm::vec2(res.x, 0), glm::vec2(0, res.y), res}) {
+        glm::vec2 p = glm::vec2(to_quad * glm::vec4(corner, 0.0f, 1.0f));
+        lo          = glm::min(lo, p);
+        hi          = glm::max(hi, p);
+    }
+    lo = glm::max(lo, glm::vec2(0));
+    hi = glm::min(hi, glm::vec2(1));
+    if (lo.x >= hi.x || lo.y >= hi.y) { return {}; }
+    glm::vec2  size  = layout.LevelSize(level);
+    glm::ivec2 first = glm::ivec2(lo * size) / ImageTiles::TileSize;
+    glm::ivec2 last  = glm::min(
+        glm::ivec2(hi * size) / ImageTiles::TileSize,
+        layout.TileCount(level) - 1);
+    vector<TileRegion>           tiles, stand_ins;
+    std::unordered_set<uint64_t> standing_in;
+    for (int y = first.y; y <= last.y; y++) {
+        for (int x = first.x; x <= last.x; x++) {
+            auto resident = tiled.Resident.find(ImageTiles::Key(level, x, y));
+            if (resident != tiled.Resident.end()) {
+                resident->second.LastDrawn = frame;
+                tiles.push_back(TileRegion{resident->second.Texture, layout.TileRect(level, x, y)});
+                continue;
+            }
+            load_tile(uid, tiled, level, x, y);
+            for (int up = level + 1; up < layout.Levels - 1; up++) {
+                int  ux     = x >> (up - level), uy = y >> (up - level);
+                auto parent = tiled.Resident.find(ImageTiles::Key(up, ux, uy));
+                if (parent == tiled.Resident.end()) { continue; }
+                parent->second.LastDrawn = frame;
+                if (standing_in.insert(parent->first).second) {
+                    stand_ins.push_back(
+                        TileRegion{parent->second.Texture, layout.TileRect(up, ux, uy)});
+                }
+                break;
+            }
+        }
+    }
+    // Coarsest first, so finer tiles are drawn over them
+    std::stable_sort(stand_ins.begin(), stand_ins.end(), [](auto &a, auto &b) {
+        return a.Rect.z * a.Rect.w > b.Rect.z * b.Rect.w;
+    });
+    stand_ins.insert(stand_ins.end(), tiles.begin(), tiles.end());
+    return stand_ins;
+}
+
+void
+ResourceManager::load_tile(uint64_t uid, tiled_image &tiled, int level, int x, int y) {
+    auto key = ImageTiles::Key(level, x, y);
+    if (tile_loads >= MaxTileLoads || !tiled.Loading.insert(key).second) { return; }
+    tile_loads++;
+    asio::post(workers, [this, uid, key, level, x, y, layout = tiled.Layout, hash = tiled.Hash]() {
+        decoded_tile tile{uid, key, layout.TileExtent(level, x, y), {}};
+        try {
+            const std::lock_guard<std::mutex> lock(tile_db_mtx);
+            tile.Pixels = layout.ReadTile(*tile_db, hash, level, x, y);
+        } catch (std::exception &e) {
+            std::cout << "Failed to read tile of image " << uid << ": " << e.what() << std::endl;
+        }
+        {
+            const std::lock_guard<std::mutex> lock(decoded_mtx);
+            decoded_tiles.push_back(std::move(tile));
+        }
+        FramePacer::GetInstance().Wake();
+    });
+}
+
+void
+ResourceManager::place_tile(decoded_tile &&tile) {
+    tile_loads--;
+    auto tiled = tiled_images.find(tile.Uid);
+    if (tiled == tiled_images.end()) { return; }
+    tiled->second.Loading.erase(tile.Key);
+    // A tile that can't be read leaves the sprite to stand in for the whole image
+    if (tile.Pixels.empty()) {
+        tiled->second.Ready = false;
+        return;
+    }
+    auto texture = Texture2D::Create(
+        tile.Extent.x,
+        tile.Extent.y,
+        tile.Pixels.data(),
+        tile.Uid,
+        GL_RGBA,
+        GL_RGBA);
+    // Neighbouring tiles are separate textures, wrapping would bleed the far edge into a seam
+    texture->ClampToEdge();
+    tile_bytes += texture->Bytes();
+    tiled->second.Resident[tile.Key] = resident_tile{texture, frame};
+}
+
+void
+ResourceManager::evict_tiles() {
+    if (tile_bytes <= TileBudget) { return; }
+    // Least recently drawn first, as (last drawn, image, tile)
+    std::vector<std::tuple<uint64_t, uint64_t, uint64_t>> candidates;
+    for (auto &[uid, tiled] : tiled_images) {
+        for (auto &[key, resident] : tiled.Resident) {
+            if (resident.LastDrawn + 1 >= frame) { continue; }
+            candidates.emplace_back(resident.LastDrawn, uid, key);
+        }
+    }
+    std::sort(candidates.begin(), candidates.end());
+    for (auto &[drawn, uid, key] : candidates) {
+        if (tile_bytes <= TileBudget) { break; }
+        auto &resident = tiled_images[uid].Resident;
+        auto  it       = resident.find(key);
+        tile_bytes -= it->second.Texture->Bytes();
+        resident.erase(it);
+    }
+}
+
+size_t
+ResourceManager::ResidentTextureBytes() const {
+    return resident_bytes;
+}
+
+size_t
+ResourceManager::EvictedTextureBytes() const {
+    size_t bytes = 0;
+    for (auto &kv : evicted) { bytes += kv.second; }
+    return bytes;
+}
+
+ResourceManager::~ResourceManager() {
+    // Workers push their results into members, so they have to finish first
+    workers.stop();
+    workers.join();
+}
+
+std::filesystem::file_time_type
+ResourceManager::shader_files::LastModified() const {
+    auto modified = std::filesystem::file_time_type::min();
+    for (auto *path : {&Vertex, &Fragment, &Geometry}) {
+        std::error_code ec;
+        if (path->empty()) { continue; }
+        auto time = std::filesystem::last_write_time(*path, ec);
+        if (!ec) { modified = std::max(modified, time); }
+    }
+    return modified;
+}
+
+static string
+read_file(const string &path) {
+    std::ifstream     file(path);
+    std::stringstream stream;
+    stream << file.rdbuf();
+    return stream.str();
+}
+
+// The file starts with the key it was saved under and the binary's format
+static shared_ptr<Shader>
+read_program_binary(const std::filesystem::path &path, uint64_t key) {
+    std::ifstream in(path, std::ios::binary);
+    uint64_t      file_key;
+    uint32_t      format;
+    if (!in.read(reinterpret_cast<char *>(&file_key), sizeof(file_key)) || file_key != key ||
+        !in.read(reinterpret_cast<char *>(&format), sizeof(format))) {
+        return nullptr;
+    }
+    vector<unsigned char> binary(
+        (std::istreambuf_iterator<char>(in)),
+        (std::istreambuf_iterator<char>()));
+    return Shader::CreateFromBinary(format, binary);
+}
+
+static void
+write_program_binary(const std::filesystem::path &path, uint64_t key, const Shader &shader) {
+    unsigned int format;
+    auto         binary = shader.Binary(format);
+    if (binary.empty()) { return; }
+    std::error_code ec;
+    std::filesystem::create_directories(path.parent_path(), ec);
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    auto          file_format = static_cast<uint32_t>(format);
+    out.write(reinterpret_cast<const char *>(&key), sizeof(key));
+    out.write(reinterpret_cast<const char *>(&file_format), sizeof(file_format));
+    out.write(reinterpret_cast<const char *>(binary.data()), binary.size());
+}
+
+std::shared_ptr<Shader>
+ResourceManager::loadShaderFromFile(const string &name, const shader_files &files) {
+    string vertex   = read_file(files.Vertex);
+    string fragment = read_file(files.Fragment);
+    string geometry = files.Geometry.empty() ? "" : read_file(files.Geometry);
+    if (vertex.empty() || fragment.empty()) {
+        std::cout << "ERROR::SHADER: Failed to read sprite_shader files" << std::endl;
+    }
+    // A binary is only good for the exact source and driver it was linked from
+    string driver;
+    for (GLenum s : {GL_VENDOR, GL_RENDERER, GL_VERSION}) {
+        auto str = glGetString(s);
+        if (str != nullptr) { driver += reinterpret_cast<const char *>(str); }
+    }
+    uint64_t key = std::hash<string>{}(
+        vertex + '\0' + fragment + '\0' + geometry + '\0' + driver);
+    auto path = std::filesystem::path(ShaderCacheDir) / (name + ".bin");
+    if (auto cached = read_program_binary(path, key)) { return cached; }
+    auto shader = Shader::Create(
+        vertex.c_str(),
+        fragment.c_str(),
+        files.Geometry.empty() ? nullptr : geometry.c_str());
+    if (shader->Linked()) { write_program_binary(path, key, *shader); }
+    return shader;
+}
+
+void
+ResourceManager::reload_changed_shaders() {
+    auto now = steady_clock::now();
+    if (now - last_shader_poll < ShaderPollInterval) { return; }
+    last_shader_poll = now;
+    for (auto &[name, files] : shader_sources) {
+        auto modified = files.LastModified();
+        if (modified == files.Modified) { continue; }
+        files.Modified = modified;
+        auto shader    = loadShaderFromFile(name, files);
+        // The old program keeps being used until the file is fixed
+        if (!shader->Linked()) { continue; }
+        Shaders.at(name)->Swap(*shader);
+        std::cout << "Reloaded shader " << name << std::endl;
+    }
+}
+
+void
+ResourceManager::SetProjection(const glm::mat4 &projection) {
+    global_state.Projection = projection;
+    upload_globals(offsetof(globals, Projection), sizeof(glm::mat4));
+}
+
+void
+ResourceManager::SetView(const glm::mat4 &view) {
+    global_state.View = view;
+    upload_globals(offsetof(globals, View), sizeof(glm::mat4));
+}
+
+void
+ResourceManager::SetScreenResolution(const glm::vec2 &resolution) {
+    global_state.ScreenRes = resolution;
+    upload_globals(offsetof(globals, ScreenRes), sizeof(glm::vec2));
+}
+
+void
+ResourceManager::upload_globals(size_t offset, size_t size) {
+    auto data = reinterpret_cast<const unsigned char *>(&global_state);
+    if (globals_UBO == 0) {
+        glGenBuffers(1, &globals_UBO);
+        glBindBuffer(GL_UNIFORM_BUFFER, globals_UBO);
+        glBufferData(GL_UNIFORM_BUFFER, sizeof(globals), data, GL_DYNAMIC_DRAW);
+        // Bound for good, every shader's block points at the same binding
+        glBindBufferBase(GL_UNIFORM_BUFFER, Shader::GlobalsBinding, globals_UBO);
     } else {
-        texture = Texture2D::Create(width, height, data, uid);
+        glBindBuffer(GL_UNIFORM_BUFFER, globals_UBO);
+        glBufferSubData(GL_UNIFORM_BUFFER, offset, size, data + offset);
     }
-    stbi_image_free(data);
-    return texture;
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
 }
 
 void
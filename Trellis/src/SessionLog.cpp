@@ -0,0 +1,103 @@
+#include "session_log.h"
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+using std::string, std::vector, std::unique_ptr, std::optional;
+
+template<class T>
+static void
+write_raw(std::ofstream &out, const T &value) {
+    out.write(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+template<class T>
+static bool
+read_raw(std::ifstream &in, T &value) {
+    return static_cast<bool>(in.read(reinterpret_cast<char *>(&value), sizeof(T)));
+}
+
+unique_ptr<SessionRecorder>
+SessionRecorder::Create(const string &path, SessionLog::Role role) {
+    auto rec = unique_ptr<SessionRecorder>(new SessionRecorder());
+    rec->out.open(path, std::ios::binary | std::ios::trunc);
+    if (!rec->out) { return nullptr; }
+    rec->out.write(SessionLog::Magic, sizeof(SessionLog::Magic));
+    write_raw(rec->out, SessionLog::Version);
+    write_raw(rec->out, role);
+    rec->start = std::chrono::steady_clock::now();
+    return rec;
+}
+
+void
+SessionRecorder::Write(
+    SessionLog::Direction    dir,
+    uint64_t                 uid,
+    const string &           channel,
+    const vector<std::byte> &data) {
+    auto micros = std::chrono::duration_cast<std::chrono::microseconds>(
+                      std::chrono::steady_clock::now() - start)
+                      .count();
+    auto channel_len = static_cast<uint8_t>(std::min<size_t>(channel.size(), 255));
+    auto data_len    = static_cast<uint32_t>(data.size());
+    std::lock_guard<std::mutex> lock(mtx);
+    write_raw(out, static_cast<int64_t>(micros));
+    write_raw(out, dir);
+    write_raw(out, uid);
+    write_raw(out, channel_len);
+    out.write(channel.data(), channel_len);
+    write_raw(out, data_len);
+    out.write(reinterpret_cast<const char *>(data.data()), data_len);
+}
+
+unique_ptr<SessionReader>
+SessionReader::Open(const string &path) {
+    auto reader = unique_ptr<SessionReader>(new SessionReader());
+    reader->in.open(path, std::ios::binary);
+    if (!reader->in) { return nullptr; }
+    char     magic[sizeof(SessionLog::Magic)];
+    uint32_t version;
+    reader->in.read(magic, sizeof(magic));
+    if (!reader->in || std::memcmp(magic, SessionLog::Magic, sizeof(magic)) != 0) {
+        return nullptr;
+    }
+    if (!read_raw(reader->in, version) || version != SessionLog::Version) { return nullptr; }
+    if (!read_raw(reader->in, reader->role)) { return nullptr; }
+    return reader;
+}
+
+SessionLog::Role
+SessionReader::Role() const {
+    return role;
+}
+
+const SessionLog::Record *
+SessionReader::Peek() {
+    if (!peeked) { peeked = read_record(); }
+    return peeked ? &*peeked : nullptr;
+}
+
+optional<SessionLog::Record>
+SessionReader::Next() {
+    if (!peeked) { return read_record(); }
+    return std::exchange(peeked, std::nullopt);
+}
+
+optional<SessionLog::Record>
+SessionReader::read_record() {
+    SessionLog::Record rec;
+    uint8_t            channel_len;
+    uint32_t           data_len;
+    if (!read_raw(in, rec.Micros) || !read_raw(in, rec.Dir) || !read_raw(in, rec.Uid) ||
+        !read_raw(in, channel_len)) {
+        return std::nullopt;
+    }
+    rec.Channel.resize(channel_len);
+    if (!in.read(rec.Channel.data(), channel_len) || !read_raw(in, data_len)) {
+        return std::nullopt;
+    }
+    rec.Data.resize(data_len);
+    if (!in.read(reinterpret_cast<char *>(rec.Data.data()), data_len)) { return std::nullopt; }
+    return rec;
+}
@@ -1,12 +1,16 @@
 #include "shader.h"
+#include "gl_state.h"
 
+#include <algorithm>
 #include <iostream>
+#include <utility>
+#include <vector>
 
 using std::make_shared, std::shared_ptr;
 
 Shader &
 Shader::Use() {
-    glUseProgram(ID);
+    GLState::GetInstance().UseProgram(ID);
     return *this;
 }
 
@@ -34,72 +38,132 @@ Shader::Shader(const char *vertexSource, const char *fragmentSource, const char
     glAttachShader(ID, sVertex);
     glAttachShader(ID, sFragment);
     if (geometrySource != nullptr) glAttachShader(ID, gShader);
+    if (ProgramBinariesSupported()) {
+        glProgramParameteri(ID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
     glLinkProgram(ID);
     checkCompileErrors(ID, "PROGRAM");
     // delete the shaders as they're linked into our program now and no longer necessery
     glDeleteShader(sVertex);
     glDeleteShader(sFragment);
     if (geometrySource != nullptr) glDeleteShader(gShader);
+    reflect();
+}
+
+void
+Shader::reflect() {
+    int count, max_length;
+    glGetProgramiv(ID, GL_ACTIVE_UNIFORMS, &count);
+    glGetProgramiv(ID, GL_ACTIVE_UNIFORM_MAX_LENGTH, &max_length);
+    std::vector<char> name(std::max(max_length, 1));
+    for (int i = 0; i < count; i++) {
+        int    size, length;
+        GLenum type;
+        glGetActiveUniform(ID, i, name.size(), &length, &size, &type, name.data());
+        int loc = glGetUniformLocation(ID, name.data());
+        // Uniforms in a block have no location
+        if (loc == -1) { continue; }
+        std::string uniform(name.data(), length);
+        // Arrays are listed by their first element
+        auto bracket = uniform.find('[');
+        if (bracket != std::string::npos) { uniform.resize(bracket); }
+        uniforms[uniform] = loc;
+    }
+    unsigned int globals = glGetUniformBlockIndex(ID, "Globals");
+    if (globals != GL_INVALID_INDEX) { glUniformBlockBinding(ID, globals, GlobalsBinding); }
+}
+
+bool
+Shader::Linked() const {
+    int linked;
+    glGetProgramiv(ID, GL_LINK_STATUS, &linked);
+    return linked;
+}
+
+std::vector<unsigned char>
+Shader::Binary(unsigned int &format) const {
+    std::vector<unsigned char> binary;
+    int                        length = 0;
+    if (!ProgramBinariesSupported() || !Linked()) { return binary; }
+    glGetProgramiv(ID, GL_PROGRAM_BINARY_LENGTH, &length);
+    binary.resize(length);
+    GLenum binary_format;
+    glGetProgramBinary(ID, length, &length, &binary_format, binary.data());
+    binary.resize(length);
+    format = binary_format;
+    return binary;
+}
+
+void
+Shader::Swap(Shader &other) {
+    std::swap(ID, other.ID);
+    std::swap(uniforms, other.uniforms);
+}
+
+int
+Shader::location(const char *name) const {
+    auto it = uniforms.find(name);
+    return it != uniforms.end() ? it->second : -1;
 }
 
 void
 Shader::SetFloat(const char *name, float value) {
     Use();
-    glUniform1f(glGetUniformLocation(ID, name), value);
+    glUniform1f(location(name), value);
 }
 
 void
 Shader::SetInteger(const char *name, int value) {
     Use();
-    glUniform1i(glGetUniformLocation(ID, name), value);
+    glUniform1i(location(name), value);
 }
 
 void
 Shader::SetVector2f(const char *name, float x, float y) {
     Use();
-    glUniform2f(glGetUniformLocation(ID, name), x, y);
+    glUniform2f(location(name), x, y);
 }
 
 void
 Shader::SetVector2f(const char *name, const glm::vec2 &value) {
     Use();
-    glUniform2f(glGetUniformLocation(ID, name), value.x, value.y);
+    glUniform2f(location(name), value.x, value.y);
 }
 
 void
 Shader::SetVector2i(const char *name, const glm::ivec2 &value) {
     Use();
-    glUniform2i(glGetUniformLocation(ID, name), value.x, value.y);
+    glUniform2i(location(name), value.x, value.y);
 }
 
 void
 Shader::SetVector3f(const char *name, float x, float y, float z) {
     Use();
-    glUniform3f(glGetUniformLocation(ID, name), x, y, z);
+    glUniform3f(location(name), x, y, z);
 }
 
 void
 Shader::SetVector3f(const char *name, const glm::vec3 &value) {
     Use();
-    glUniform3f(glGetUniformLocation(ID, name), value.x, value.y, value.z);
+    glUniform3f(location(name), value.x, value.y, value.z);
 }
 
 void
 Shader::SetVector4f(const char *name, float x, float y, float z, float w) {
     Use();
-    glUniform4f(glGetUniformLocation(ID, name), x, y, z, w);
+    glUniform4f(location(name), x, y, z, w);
 }
 
 void
 Shader::SetVector4f(const char *name, const glm::vec4 &value) {
     Use();
-    glUniform4f(glGetUniformLocation(ID, name), value.x, value.y, value.z, value.w);
+    glUniform4f(location(name), value.x, value.y, value.z, value.w);
 }
 
 void
 Shader::SetMatrix4(const char *name, const glm::mat4 &matrix) {
     Use();
-    glUniformMatrix4fv(glGetUniformLocation(ID, name), 1, false, glm::value_ptr(matrix));
+    glUniformMatrix4fv(location(name), 1, false, glm::value_ptr(matrix));
 }
 
 void
@@ -126,10 +190,32 @@ Shader::checkCompileErrors(unsigned int object, std::string type) {
 }
 
 Shader::~Shader() {
-    glDeleteProgram(ID);
+    GLState::GetInstance().DeleteProgram(ID);
 }
 
 shared_ptr<Shader>
 Shader::Create(const char *vertexSource, const char *fragmentSource, const char *geometrySource) {
     return shared_ptr<Shader>(new Shader(vertexSource, fragmentSource, geometrySource));
 }
+
+shared_ptr<Shader>
+Shader::CreateFromBinary(unsigned int format, const std::vector<unsigned char> &binary) {
+    if (!ProgramBinariesSupported()) { return nullptr; }
+    auto shader = shared_ptr<Shader>(new Shader());
+    shader->ID  = glCreateProgram();
+    glProgramBinary(shader->ID, format, binary.data(), static_cast<GLsizei>(binary.size()));
+    if (!shader->Linked()) { return nullptr; }
+    shader->reflect();
+    return shader;
+}
+
+bool
+Shader::ProgramBinariesSupported() {
+    static bool supported = [] {
+        if (!glGetProgramBinary || !glProgramBinary || !glProgramParameteri) { return false; }
+        int formats = 0;
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+        return formats > 0;
+    }();
+    return supported;
+}
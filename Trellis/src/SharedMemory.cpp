@@ -0,0 +1,174 @@
+#include "shared_memory.h"
+
+#include <cstring>
+#include <new>
+
+#ifdef _WIN32
+#    define WIN32_LEAN_AND_MEAN
+#    include <windows.h>
+#else
+#    include <fcntl.h>
+#    include <sys/mman.h>
+#    include <sys/stat.h>
+#    include <unistd.h>
+#endif
+
+using std::string, std::unique_ptr, std::optional, std::vector;
+
+// Ring data starts after the control block, on its own cache line
+static const size_t CONTROL_SIZE = 64;
+
+#ifdef _WIN32
+static string
+segment_path(const string &name) {
+    return "Local\\" + name;
+}
+#else
+static string
+segment_path(const string &name) {
+    return "/" + name;
+}
+#endif
+
+SharedSegment::~SharedSegment() {
+#ifdef _WIN32
+    if (data) { UnmapViewOfFile(data); }
+    if (handle) { CloseHandle(handle); }
+#else
+    if (data) { munmap(data, size); }
+    if (owner) { shm_unlink(segment_path(name).c_str()); }
+#endif
+}
+
+unique_ptr<SharedSegment>
+SharedSegment::Create(const string &name, size_t size) {
+    auto seg   = unique_ptr<SharedSegment>(new SharedSegment());
+    seg->name  = name;
+    seg->size  = size;
+    seg->owner = true;
+#ifdef _WIN32
+    seg->handle = CreateFileMappingA(
+        INVALID_HANDLE_VALUE,
+        nullptr,
+        PAGE_READWRITE,
+        static_cast<DWORD>(static_cast<uint64_t>(size) >> 32),
+        static_cast<DWORD>(size & 0xFFFFFFFF),
+        segment_path(name).c_str());
+    if (!seg->handle) { return nullptr; }
+    seg->data =
+        static_cast<std::byte *>(MapViewOfFile(seg->handle, FILE_MAP_ALL_ACCESS, 0, 0, size));
+    if (!seg->data) { return nullptr; }
+#else
+    int fd = shm_open(segment_path(name).c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0) { return nullptr; }
+    if (ftruncate(fd, static_cast<off_t>(size)) != 0) {
+        close(fd);
+        shm_unlink(segment_path(name).c_str());
+        return nullptr;
+    }
+    void *ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (ptr == MAP_FAILED) {
+        shm_unlink(segment_path(name).c_str());
+        return nullptr;
+    }
+    seg->data = static_cast<std::byte *>(ptr);
+#endif
+    return seg;
+}
+
+unique_ptr<SharedSegment>
+SharedSegment::Open(const string &name) {
+    auto seg  = unique_ptr<SharedSegment>(new SharedSegment());
+    seg->name = name;
+#ifdef _WIN32
+    seg->handle = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, segment_path(name).c_str());
+    if (!seg->handle) { return nullptr; }
+    seg->data =
+        static_cast<std::byte *>(MapViewOfFile(seg->handle, FILE_MAP_ALL_ACCESS, 0, 0, 0));
+    if (!seg->data) { return nullptr; }
+    MEMORY_BASIC_INFORMATION info;
+    VirtualQuery(seg->data, &info, sizeof(info));
+    seg->size = info.RegionSize;
+#else
+    int fd = shm_open(segment_path(name).c_str(), O_RDWR, 0600);
+    if (fd < 0) { return nullptr; }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return nullptr;
+    }
+    seg->size = static_cast<size_t>(st.st_size);
+    void *ptr = mmap(nullptr, seg->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (ptr == MAP_FAILED) { return nullptr; }
+    seg->data = static_cast<std::byte *>(ptr);
+#endif
+    return seg;
+}
+
+std::byte *
+SharedSegment::Data() const {
+    return data;
+}
+
+size_t
+SharedSegment::Size() const {
+    return size;
+}
+
+SharedRing::SharedRing(string name, unique_ptr<SharedSegment> segment)
+    : name(std::move(name))
+    , segment(std::move(segment))
+    , control(reinterpret_cast<Control *>(this->segment->Data()))
+    , ring(this->segment->Data() + CONTROL_SIZE) {}
+
+unique_ptr<SharedRing>
+SharedRing::Create(const string &name, size_t capacity) {
+    auto segment = SharedSegment::Create(name, CONTROL_SIZE + capacity);
+    if (!segment) { return nullptr; }
+    auto ring = unique_ptr<SharedRing>(new SharedRing(name, std::move(segment)));
+    new (ring->control) Control();
+    ring->control->Tail.store(0);
+    ring->control->Capacity = capacity;
+    return ring;
+}
+
+unique_ptr<SharedRing>
+SharedRing::Open(const string &name) {
+    auto segment = SharedSegment::Open(name);
+    if (!segment || segment->Size() < CONTROL_SIZE) { return nullptr; }
+    auto ring = unique_ptr<SharedRing>(new SharedRing(name, std::move(segment)));
+    if (ring->segment->Size() < CONTROL_SIZE + ring->control->Capacity) { return nullptr; }
+    return ring;
+}
+
+optional<uint64_t>
+SharedRing::Write(const std::byte *bytes, size_t len) {
+    uint64_t capacity = control->Capacity;
+    if (len > capacity) { return std::nullopt; }
+    // Records never wrap, skip to the start of the ring if this one won't fit before the end
+    uint64_t pos  = head % capacity;
+    uint64_t skip = pos + len > capacity ? capacity - pos : 0;
+    uint64_t tail = control->Tail.load(std::memory_order_acquire);
+    if (head + skip + len - tail > capacity) { return std::nullopt; }
+    uint64_t start = head + skip;
+    std::memcpy(ring + start % capacity, bytes, len);
+    head = start + len;
+    return start;
+}
+
+optional<vector<std::byte>>
+SharedRing::Read(uint64_t pos, size_t len) {
+    uint64_t capacity = control->Capacity;
+    if (len > capacity || pos % capacity + len > capacity) { return std::nullopt; }
+    const std::byte *begin = ring + pos % capacity;
+    vector<std::byte> bytes(begin, begin + len);
+    control->Tail.store(pos + len, std::memory_order_release);
+    return bytes;
+}
+
+const string &
+SharedRing::Name() const {
+    return name;
+}
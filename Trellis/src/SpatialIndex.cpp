@@ -0,0 +1,166 @@
+#include "spatial_index.h"
+
+#include <algorithm>
+#include <cmath>
+
+using std::vector;
+
+// Axis aligned bounds, of the rotated quad if the piece is rotated
+static void
+bounds(const Transform &t, glm::vec2 &min, glm::vec2 &max) {
+    if (t.rotation == 0) {
+        min = t.position;
+        max = t.position + t.scale;
+        return;
+    }
+    float     c      = std::abs(std::cos(glm::radians(t.rotation)));
+    float     s      = std::abs(std::sin(glm::radians(t.rotation)));
+    glm::vec2 size   = glm::vec2(c * t.scale.x + s * t.scale.y, s * t.scale.x + c * t.scale.y);
+    glm::vec2 center = t.position + t.scale / 2.0f;
+    min              = center - size / 2.0f;
+    max              = center + size / 2.0f;
+}
+
+SpatialIndex::SpatialIndex(float cell_size)
+    : cell_size(cell_size) {}
+
+void
+SpatialIndex::Insert(piece_it piece) {
+    auto &e = entries[(*piece)->Uid];
+    e.Piece = piece;
+    e.Depth = ++top;
+    e.Cells = cells_of((*piece)->transform);
+    link(e);
+}
+
+void
+SpatialIndex::Update(const GameObject &piece) {
+    auto it = entries.find(piece.Uid);
+    if (it == entries.end()) { return; }
+    auto cells_now = cells_of(piece.transform);
+    // Most moves don't leave the cells the piece was already in
+    if (cells_now == it->second.Cells) { return; }
+    unlink(it->second);
+    it->second.Cells = cells_now;
+    link(it->second);
+}
+
+void
+SpatialIndex::Remove(uint64_t uid) {
+    auto it = entries.find(uid);
+    if (it == entries.end()) { return; }
+    unlink(it->second);
+    entries.erase(it);
+}
+
+void
+SpatialIndex::Raise(const vector<uint64_t> &uids) {
+    // Bottom one first, so the first ends up on top
+    for (auto uid = uids.rbegin(); uid != uids.rend(); uid++) {
+        auto it = entries.find(*uid);
+        if (it != entries.end()) { it->second.Depth = ++top; }
+    }
+}
+
+void
+SpatialIndex::Lower(const vector<uint64_t> &uids) {
+    for (auto uid : uids) {
+        auto it = entries.find(uid);
+        if (it != entries.end()) { it->second.Depth = --bottom; }
+    }
+}
+
+vector<SpatialIndex::piece_it>
+SpatialIndex::Query(glm::vec2 min, glm::vec2 max) const {
+    vector<const entry *> found;
+    stamp++;
+    auto visit = [&](const entry *e) {
+        if (e->Stamp == stamp) { return; }
+        e->Stamp = stamp;
+        // Cells are coarse, the piece itself has to overlap
+        glm::vec2 lo, hi;
+        bounds((*e->Piece)->transform, lo, hi);
+        if (lo.x <= max.x && lo.y <= max.y && hi.x >= min.x && hi.y >= min.y) {
+            found.push_back(e);
+        }
+    };
+    glm::ivec2 first = cell(min);
+    glm::ivec2 last  = cell(max);
+    auto       area  = static_cast<int64_t>(last.x - first.x + 1) * (last.y - first.y + 1);
+    if (area > static_cast<int64_t>(entries.size())) {
+        // Zoomed far out, there are fewer pieces than cells to look in
+        for (auto &kv : entries) { visit(&kv.second); }
+    } else {
+        for (int x = first.x; x <= last.x; x++) {
+            for (int y = first.y; y <= last.y; y++) {
+                auto c = cells.find(key(x, y));
+                if (c == cells.end()) { continue; }
+                for (auto e : c->second) { visit(e); }
+            }
+        }
+        for (auto e : large) { visit(e); }
+    }
+    std::sort(found.begin(), found.end(), [](const entry *a, const entry *b) {
+        return a->Depth > b->Depth;
+    });
+    vector<piece_it> pieces;
+    pieces.reserve(found.size());
+    for (auto e : found) { pieces.push_back(e->Piece); }
+    return pieces;
+}
+
+glm::ivec2
+SpatialIndex::cell(glm::vec2 pos) const {
+    return glm::ivec2(glm::floor(pos / cell_size));
+}
+
+glm::ivec4
+SpatialIndex::cells_of(const Transform &transform) const {
+    glm::vec2 min, max;
+    bounds(transform, min, max);
+    return glm::ivec4(cell(min), cell(max));
+}
+
+bool
+SpatialIndex::is_large(const glm::ivec4 &cells) {
+    auto area = static_cast<int64_t>(cells.z - cells.x + 1) * (cells.w - cells.y + 1);
+    return area > MaxCellsPerPiece;
+}
+
+uint64_t
+SpatialIndex::key(int x, int y) {
+    return static_cast<uint64_t>(static_cast<uint32_t>(x)) << 32 | static_cast<uint32_t>(y);
+}
+
+void
+SpatialIndex::link(entry &e) {
+    if (is_large(e.Cells)) {
+        large.push_back(&e);
+        return;
+    }
+    for (int x = e.Cells.x; x <= e.Cells.z; x++) {
+        for (int y = e.Cells.y; y <= e.Cells.w; y++) { cells[key(x, y)].push_back(&e); }
+    }
+}
+
+void
+SpatialIndex::unlink(entry &e) {
+    auto remove = [&e](vector<entry *> &list) {
+        auto it = std::find(list.begin(), list.end(), &e);
+        if (it == list.end()) { return; }
+        *it = list.back();
+        list.pop_back();
+    };
+    if (is_large(e.Cells)) {
+        remove(large);
+        return;
+    }
+    for (int x = e.Cells.x; x <= e.Cells.z; x++) {
+        for (int y = e.Cells.y; y <= e.Cells.w; y++) {
+            auto c = cells.find(key(x, y));
+            if (c == cells.end()) { continue; }
+            remove(c->second);
+            if (c->second.empty()) { cells.erase(c); }
+        }
+    }
+}
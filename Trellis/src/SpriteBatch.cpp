@@ -0,0 +1,148 @@
+#include "sprite_batch.h"
+#include "gl_state.h"
+#include "resource_manager.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <glm/gtc/matrix_transform.hpp>
+
+using std::shared_ptr;
+
+static GLState &gl = GLState::GetInstance();
+
+// Locations of the per instance attributes, a mat4 takes up four
+static const GLuint MODEL_LOCATION   = 1;
+static const GLuint UV_RECT_LOCATION = 5;
+static const GLuint TINT_LOCATION    = 6;
+
+SpriteBatch::SpriteBatch()
+    : shader(ResourceManager::GetInstance().GetShader("sprite")) {
+    float vertices[] = {// pos      // tex
+                        0.0f, 1.0f, 0.0f, 1.0f, 1.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f,
+
+                        0.0f, 1.0f, 0.0f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f, 0.0f, 1.0f, 0.0f};
+    glGenVertexArrays(1, &quad_VAO);
+    glGenBuffers(1, &quad_VBO);
+    glGenBuffers(1, &instance_VBO);
+
+    gl.BindVertexArray(quad_VAO);
+    glBindBuffer(GL_ARRAY_BUFFER, quad_VBO);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void *)0);
+
+    glBindBuffer(GL_ARRAY_BUFFER, instance_VBO);
+    for (GLuint i = MODEL_LOCATION; i <= TINT_LOCATION; i++) {
+        glEnableVertexAttribArray(i);
+        glVertexAttribDivisor(i, 1);
+    }
+    point_instances(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+SpriteBatch::~SpriteBatch() {
+    gl.DeleteVertexArray(quad_VAO);
+    glDeleteBuffers(1, &quad_VBO);
+    glDeleteBuffers(1, &instance_VBO);
+}
+
+void
+SpriteBatch::Add(
+    const shared_ptr<Texture2D> &texture,
+    const Transform &            transform,
+    bool                         border,
+    const glm::vec3 &            tint,
+    const glm::vec4 &            uv_rect) {
+    push(
+        texture,
+        instance{transform.Model(), uv_rect, glm::vec4(tint, border ? 1 : 0)},
+        std::max(transform.scale.x, transform.scale.y));
+}
+
+void
+SpriteBatch::AddPart(
+    const shared_ptr<Texture2D> &texture,
+    const Transform &            transform,
+    const glm::vec4 &            rect) {
+    glm::mat4 model = glm::translate(transform.Model(), glm::vec3(rect.x, rect.y, 0.0f));
+    model           = glm::scale(model, glm::vec3(rect.z, rect.w, 1.0f));
+    push(
+        texture,
+        instance{model, glm::vec4(0, 0, 1, 1), glm::vec4(1, 1, 1, 0)},
+        std::max(transform.scale.x * rect.z, transform.scale.y * rect.w));
+}
+
+void
+SpriteBatch::AddOutline(const Transform &transform) {
+    // Nothing is sampled, the inside is discarded
+    push(nullptr, instance{transform.Model(), glm::vec4(0, 0, 1, 1), glm::vec4(1, 1, 1, 2)}, 0);
+}
+
+void
+SpriteBatch::push(const shared_ptr<Texture2D> &texture, const instance &sprite, float extent) {
+    instances.push_back(sprite);
+    if (runs.empty() || runs.back().Texture != texture) { runs.push_back(run{texture, 0, 0}); }
+    runs.back().Count++;
+    runs.back().Extent = std::max(runs.back().Extent, extent);
+}
+
+void
+SpriteBatch::Flush(const glm::mat4 &view, int border_width) {
+    if (instances.empty()) { return; }
+    shader->SetInteger("border_width", border_width);
+
+    glBindBuffer(GL_ARRAY_BUFFER, instance_VBO);
+    capacity = std::max(capacity, instances.size());
+    // Orphan last frame's storage, so the driver doesn't wait for its draws to finish
+    glBufferData(GL_ARRAY_BUFFER, capacity * sizeof(instance), nullptr, GL_STREAM_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, instances.size() * sizeof(instance), instances.data());
+
+    gl.ActiveTexture(GL_TEXTURE0);
+    gl.BindVertexArray(quad_VAO);
+    // The view only ever pans and zooms, so its scale is the zoom
+    float  zoom  = glm::length(glm::vec2(view[0]));
+    size_t first = 0;
+    for (auto &r : runs) {
+        if (r.Texture != nullptr) {
+            r.Texture->Bind();
+            r.Texture->NoteDrawn(r.Extent * zoom);
+        }
+        // Base instances need GL 4.2, so the attributes are moved along to each run instead
+        if (first != 0) { point_instances(first); }
+        glDrawArraysInstanced(GL_TRIANGLES, 0, 6, static_cast<GLsizei>(r.Count));
+        first += r.Count;
+    }
+    if (runs.size() > 1) { point_instances(0); }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    instances.clear();
+    runs.clear();
+}
+
+void
+SpriteBatch::point_instances(size_t first) {
+    auto base = first * sizeof(instance);
+    for (GLuint i = 0; i < 4; i++) {
+        glVertexAttribPointer(
+            MODEL_LOCATION + i,
+            4,
+            GL_FLOAT,
+            GL_FALSE,
+            sizeof(instance),
+            (void *)(base + offsetof(instance, Model) + i * sizeof(glm::vec4)));
+    }
+    glVertexAttribPointer(
+        UV_RECT_LOCATION,
+        4,
+        GL_FLOAT,
+        GL_FALSE,
+        sizeof(instance),
+        (void *)(base + offsetof(instance, UVRect)));
+    glVertexAttribPointer(
+        TINT_LOCATION,
+        4,
+        GL_FLOAT,
+        GL_FALSE,
+        sizeof(instance),
+        (void *)(base + offsetof(instance, TintBorder)));
+}
@@ -1,10 +1,13 @@
 #include "state_manager.h"
 #include "main_menu.h"
+#include "resource_manager.h"
 
 #include <stdexcept>
 
 using std::make_unique, std::make_pair, std::string, std::runtime_error, std::unique_ptr;
 
+static const char *DatabaseFile = "database.db";
+
 StateManager &
 StateManager::GetInstance() {
     static StateManager instance; // Guaranteed to be destroyed.
@@ -15,7 +18,7 @@ StateManager::GetInstance() {
 StateManager::StateManager()
     : main_menu(make_unique<MainMenu>())
     , current_state(*main_menu)
-    , database("database.db") {
+    , database(DatabaseFile) {
     current_state.get().RegisterKeyCallbacks();
     string error;
     int    result = database.Exec(
@@ -51,15 +54,43 @@ StateManager::StateManager()
         "    color_x       REAL     NOT NULL,"
         "    color_y       REAL     NOT NULL,"
         "    color_z       REAL     NOT NULL,"
+        "    visibility    INTEGER  NOT NULL  DEFAULT 0,"
         "    FOREIGN KEY(page_id) REFERENCES Pages(id),"
         "    FOREIGN KEY(sprite)  REFERENCES Images(id)"
         ");"
+        "CREATE TABLE IF NOT EXISTS PieceProperties("
+        "    piece_id    INTEGER  UNIQUE PRIMARY KEY,"
+        "    hp          INTEGER  NOT NULL  DEFAULT 0,"
+        "    max_hp      INTEGER  NOT NULL  DEFAULT 0,"
+        "    initiative  INTEGER  NOT NULL  DEFAULT 0,"
+        "    label       STRING   NOT NULL  DEFAULT '',"
+        "    conditions  INTEGER  NOT NULL  DEFAULT 0,"
+        "    FOREIGN KEY(piece_id) REFERENCES GameObjects(id)"
+        ");"
         "CREATE TABLE IF NOT EXISTS Images("
         "    id    INTEGER  UNIQUE PRIMARY KEY,"
         "    data  BLOB     NOT NULL"
+        ");"
+        "CREATE TABLE IF NOT EXISTS ImageTiles("
+        "    image_hash  INTEGER  NOT NULL,"
+        "    level       INTEGER  NOT NULL,"
+        "    x           INTEGER  NOT NULL,"
+        "    y           INTEGER  NOT NULL,"
+        "    data        BLOB     NOT NULL,"
+        "    PRIMARY KEY(image_hash, level, x, y)"
         ");",
         error);
     if (result) { throw runtime_error(error); }
+    // Games saved before pieces had a visibility are missing the column
+    if (database.Exec("SELECT visibility FROM GameObjects LIMIT 0;", error)) {
+        result = database.Exec(
+            "ALTER TABLE GameObjects ADD COLUMN visibility INTEGER NOT NULL DEFAULT 0;",
+            error);
+        if (result) { throw runtime_error(error); }
+    }
+    // Tiles of huge images are written from another connection while the game may be saving
+    database.Exec("PRAGMA busy_timeout = 5000;", error);
+    ResourceManager::GetInstance().OpenTileStore(DatabaseFile);
 }
 
 void
@@ -1,9 +1,14 @@
 #include "texture.h"
+#include "gl_state.h"
 
+#include <algorithm>
 #include <iostream>
+#include <utility>
 
 using std::shared_ptr;
 
+static GLState &gl = GLState::GetInstance();
+
 Texture2D::Texture2D(
     unsigned int   height,
     unsigned int   width,
@@ -19,10 +24,23 @@ Texture2D::Texture2D(
     , Wrap_S(GL_REPEAT)
     , Wrap_T(GL_REPEAT)
     , Filter_Min(GL_LINEAR)
-    , Filter_Max(GL_NEAREST) {
+    , Filter_Max(GL_NEAREST)
+    , Max_Level(1000) {
     // create Texture
     glGenTextures(1, &ID);
-    glBindTexture(GL_TEXTURE_2D, ID);
+    upload(width, height, data);
+    gl.BindTexture(ID);
+    // set Texture wrap and filter modes
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, Wrap_S);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, Wrap_T);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, Filter_Min);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, Filter_Max);
+}
+
+void
+Texture2D::upload(unsigned int width, unsigned int height, const unsigned char *data) {
+    gl.BindTexture(ID);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
     glTexImage2D(
         GL_TEXTURE_2D,
         0,
@@ -33,22 +51,125 @@ Texture2D::Texture2D(
         Image_Format,
         GL_UNSIGNED_BYTE,
         data);
-    // set Texture wrap and filter modes
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    // Levels that haven't been generated yet would leave the texture incomplete
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+}
+
+void
+Texture2D::Bind() const {
+    gl.BindTexture(ID);
+}
+
+void
+Texture2D::ClampToEdge() {
+    Wrap_S = GL_CLAMP_TO_EDGE;
+    Wrap_T = GL_CLAMP_TO_EDGE;
+    gl.BindTexture(ID);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, Wrap_S);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, Wrap_T);
+}
+
+void
+Texture2D::Update(int x, int y, int width, int height, const unsigned char *data) {
+    gl.BindTexture(ID);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, width, height, Image_Format, GL_UNSIGNED_BYTE, data);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+}
+
+std::vector<unsigned char>
+Texture2D::Read() const {
+    unsigned int               width    = std::max(1u, Width >> resident_level);
+    unsigned int               height   = std::max(1u, Height >> resident_level);
+    int                        channels = Image_Format == GL_RGBA ? 4 : 3;
+    std::vector<unsigned char> pixels(static_cast<size_t>(width) * height * channels);
+    gl.BindTexture(ID);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glGetTexImage(GL_TEXTURE_2D, 0, Image_Format, GL_UNSIGNED_BYTE, pixels.data());
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    return pixels;
+}
+
+void
+Texture2D::GenerateMipmaps() {
+    gl.BindTexture(ID);
+    glGenerateMipmap(GL_TEXTURE_2D);
+    int max_level = std::min(static_cast<int>(Max_Level), Levels() - 1 - resident_level);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, max_level);
+    Filter_Min = GL_LINEAR_MIPMAP_LINEAR;
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, Filter_Min);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, Filter_Max);
-    // unbind texture
-    glBindTexture(GL_TEXTURE_2D, 0);
+    mipmapped = true;
+}
+
+bool
+Texture2D::Mipmapped() const {
+    return mipmapped;
+}
+
+int
+Texture2D::Levels() const {
+    int levels = 1;
+    for (unsigned int size = std::max(Width, Height); size > 1; size /= 2) { levels++; }
+    return levels;
 }
 
 void
-Texture2D::Bind() const {
-    glBindTexture(GL_TEXTURE_2D, ID);
+Texture2D::DropLevels(int level) {
+    level = std::min(level, Levels() - 1);
+    if (!mipmapped || level <= resident_level) { return; }
+    int          relative = level - resident_level;
+    unsigned int width    = std::max(1u, Width >> level);
+    unsigned int height   = std::max(1u, Height >> level);
+    int          channels = Image_Format == GL_RGBA ? 4 : 3;
+    std::vector<unsigned char> pixels(static_cast<size_t>(width) * height * channels);
+    gl.BindTexture(ID);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glGetTexImage(GL_TEXTURE_2D, relative, Image_Format, GL_UNSIGNED_BYTE, pixels.data());
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    resident_level = level;
+    upload(width, height, pixels.data());
+    GenerateMipmaps();
+}
+
+void
+Texture2D::SwapStorage(Texture2D &other) {
+    std::swap(ID, other.ID);
+    std::swap(Width, other.Width);
+    std::swap(Height, other.Height);
+    std::swap(Internal_Format, other.Internal_Format);
+    std::swap(Image_Format, other.Image_Format);
+    std::swap(Filter_Min, other.Filter_Min);
+    std::swap(mipmapped, other.mipmapped);
+    std::swap(resident_level, other.resident_level);
+}
+
+int
+Texture2D::ResidentLevel() const {
+    return resident_level;
+}
+
+size_t
+Texture2D::Bytes() const {
+    size_t channels = Image_Format == GL_RGBA ? 4 : 3;
+    size_t bytes    = static_cast<size_t>(std::max(1u, Width >> resident_level)) *
+                   std::max(1u, Height >> resident_level) * channels;
+    // The rest of a mip chain adds another third
+    return mipmapped ? bytes + bytes / 3 : bytes;
+}
+
+void
+Texture2D::NoteDrawn(float screen_pixels) {
+    drawn_size = std::max(drawn_size, screen_pixels);
+}
+
+float
+Texture2D::TakeDrawnSize() {
+    return std::exchange(drawn_size, 0.0f);
 }
 
 Texture2D::~Texture2D() {
-    glDeleteTextures(1, &ID);
+    gl.DeleteTexture(ID);
 }
 
 std::shared_ptr<Texture2D>
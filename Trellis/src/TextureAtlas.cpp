@@ -0,0 +1,180 @@
+#include "texture_atlas.h"
+
+// ImGui keeps its own copy of the packer static as well
+#define STBRP_STATIC
+#define STB_RECT_PACK_IMPLEMENTATION
+#include "imstb_rectpack.h"
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+using std::vector, std::shared_ptr, std::optional;
+
+class TextureAtlas::page {
+public:
+    shared_ptr<Texture2D> Texture;
+    stbrp_context         Context{};
+    vector<stbrp_node>    Nodes = vector<stbrp_node>(PageSize);
+
+    page() { Reset(); }
+
+    void Reset() {
+        auto nodes = static_cast<int>(Nodes.size());
+        stbrp_init_target(&Context, PageSize, PageSize, Nodes.data(), nodes);
+        // Dropping the old texture is up to the caller, pieces might still be drawing from it
+        if (!Texture || Texture.use_count() > 1) {
+            Texture = Texture2D::Create(PageSize, PageSize, nullptr, 0, GL_RGBA, GL_RGBA);
+            // Mipmaps stop before the padding between images is averaged away
+            Texture->Max_Level = MaxLevel;
+        }
+    }
+};
+
+TextureAtlas::TextureAtlas() = default;
+
+TextureAtlas::~TextureAtlas() = default;
+
+optional<SpriteRegion>
+TextureAtlas::Find(uint64_t uid) const {
+    auto it = entries.find(uid);
+    if (it == entries.end()) { return std::nullopt; }
+    return region(it->second);
+}
+
+optional<SpriteRegion>
+TextureAtlas::Insert(uint64_t uid, const unsigned char *rgba, int width, int height) {
+    if (width <= 0 || height <= 0 || width > MaxImageSize || height > MaxImageSize) {
+        return std::nullopt;
+    }
+    if (auto found = Find(uid)) { return found; }
+    auto try_pages = [&]() {
+        for (size_t i = 0; i < pages.size(); i++) {
+            if (place(uid, i, rgba, width, height)) { return true; }
+        }
+        return false;
+    };
+    if (try_pages()) { return Find(uid); }
+    drop_unused();
+    if (try_pages()) { return Find(uid); }
+    if (pages.size() < MaxPages) {
+        pages.push_back(std::make_unique<page>());
+        if (place(uid, pages.size() - 1, rgba, width, height)) { return Find(uid); }
+        return std::nullopt;
+    }
+    // Every page is in use, squeeze the gaps out of the one with the least left on it
+    vector<int> used(pages.size());
+    for (auto &[key, e] : entries) { used[e.Page] += e.Width * e.Height; }
+    auto emptiest = static_cast<size_t>(std::min_element(used.begin(), used.end()) - used.begin());
+    repack(emptiest);
+    if (place(uid, emptiest, rgba, width, height)) { return Find(uid); }
+    return std::nullopt;
+}
+
+vector<uint64_t>
+TextureAtlas::TakeMoved() {
+    return std::exchange(moved, {});
+}
+
+vector<shared_ptr<Texture2D>>
+TextureAtlas::TakeDirty() {
+    return std::exchange(dirty, {});
+}
+
+bool
+TextureAtlas::place(
+    uint64_t             uid,
+    size_t               page_index,
+    const unsigned char *rgba,
+    int                  width,
+    int                  height) {
+    page &     pg   = *pages[page_index];
+    stbrp_rect rect = {};
+    rect.w          = static_cast<stbrp_coord>(width + 2 * Padding);
+    rect.h          = static_cast<stbrp_coord>(height + 2 * Padding);
+    if (!stbrp_pack_rects(&pg.Context, &rect, 1)) { return false; }
+    // Upload the padding too, it may still hold an image that used to be there
+    vector<unsigned char> padded(static_cast<size_t>(rect.w) * rect.h * 4);
+    for (int row = 0; row < height; row++) {
+        std::memcpy(
+            padded.data() + ((row + Padding) * rect.w + Padding) * 4,
+            rgba + static_cast<size_t>(row) * width * 4,
+            static_cast<size_t>(width) * 4);
+    }
+    pg.Texture->Update(rect.x, rect.y, rect.w, rect.h, padded.data());
+    if (std::find(dirty.begin(), dirty.end(), pg.Texture) == dirty.end()) {
+        dirty.push_back(pg.Texture);
+    }
+
+    entry e;
+    e.Page   = page_index;
+    e.X      = rect.x + Padding;
+    e.Y      = rect.y + Padding;
+    e.Width  = width;
+    e.Height = height;
+    // A handle with a control block of its own, which keeps the page texture alive
+    auto owner   = std::make_shared<shared_ptr<Texture2D>>(pg.Texture);
+    e.Handle     = shared_ptr<Texture2D>(owner, owner->get());
+    entries[uid] = std::move(e);
+    return true;
+}
+
+void
+TextureAtlas::drop_unused() {
+    vector<bool> in_use(pages.size(), false);
+    for (auto it = entries.begin(); it != entries.end();) {
+        // The atlas holds the only handle left
+        if (it->second.Handle.use_count() == 1) {
+            it = entries.erase(it);
+        } else {
+            in_use[it->second.Page] = true;
+            it++;
+        }
+    }
+    for (size_t i = 0; i < pages.size(); i++) {
+        if (!in_use[i]) { pages[i]->Reset(); }
+    }
+}
+
+void
+TextureAtlas::repack(size_t page_index) {
+    page &pg     = *pages[page_index];
+    auto  old    = pg.Texture;
+    auto  pixels = old->Read();
+    vector<std::pair<uint64_t, entry>> live;
+    for (auto it = entries.begin(); it != entries.end();) {
+        if (it->second.Page == page_index) {
+            live.emplace_back(it->first, std::move(it->second));
+            it = entries.erase(it);
+        } else {
+            it++;
+        }
+    }
+    pg.Texture.reset();
+    pg.Reset();
+    // Tallest first packs tightest
+    std::sort(live.begin(), live.end(), [](const auto &a, const auto &b) {
+        return a.second.Height > b.second.Height;
+    });
+    vector<unsigned char> rgba;
+    for (auto &[uid, e] : live) {
+        rgba.resize(static_cast<size_t>(e.Width) * e.Height * 4);
+        for (int row = 0; row < e.Height; row++) {
+            std::memcpy(
+                rgba.data() + static_cast<size_t>(row) * e.Width * 4,
+                pixels.data() + (static_cast<size_t>(e.Y + row) * PageSize + e.X) * 4,
+                static_cast<size_t>(e.Width) * 4);
+        }
+        // Anything that doesn't fit back in is looked up again, and ends up somewhere else
+        place(uid, page_index, rgba.data(), e.Width, e.Height);
+        moved.push_back(uid);
+    }
+}
+
+SpriteRegion
+TextureAtlas::region(const entry &e) const {
+    SpriteRegion r;
+    r.Texture = e.Handle;
+    r.UVRect  = glm::vec4(e.X, e.Y, e.Width, e.Height) / static_cast<float>(PageSize);
+    return r;
+}
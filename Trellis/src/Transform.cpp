@@ -1,5 +1,7 @@
 #include "transform.h"
 
+#include <glm/gtc/matrix_transform.hpp>
+
 Transform::Transform()
     : position(0, 0)
     , scale(1, 1)
@@ -9,3 +11,17 @@ Transform::Transform(const glm::vec2 &position, const glm::vec2 &scale, float ro
     : position(position)
     , scale(scale)
     , rotation(rotation) {}
+
+glm::mat4
+Transform::Model() const {
+    glm::mat4 model = glm::mat4(1.0f);
+    // Transformations are applied in reverse order: scale happens first, then rotation, and then
+    // the final translation
+    model = glm::translate(model, glm::vec3(position, 0.0f));
+    // Move origin of rotation to center of quad, rotate, and move it back
+    model = glm::translate(model, glm::vec3(0.5f * scale.x, 0.5f * scale.y, 0.0f));
+    model = glm::rotate(model, glm::radians(rotation), glm::vec3(0.0f, 0.0f, 1.0f));
+    model = glm::translate(model, glm::vec3(-0.5f * scale.x, -0.5f * scale.y, 0.0f));
+    model = glm::scale(model, glm::vec3(scale, 1.0f));
+    return model;
+}
@@ -1,10 +1,13 @@
 #include "ui.h"
 
 #include "client_server.h"
+#include "frame_pacer.h"
 #include "glfw_handler.h"
 #include "imgui_helpers.h"
+#include "network_conditioner.h"
 #include "network_manager.h"
 #include "gui.h"
+#include "resource_manager.h"
 
 #include <iostream>
 #include <iterator>
@@ -60,6 +63,7 @@ UI::Draw(Page::page_list_t &pages, Page::page_list_it_t &active_page) {
     draw_page_select(pages, active_page);
     draw_page_settings(active_page);
     draw_http_window();
+    draw_network_conditioner();
     draw_chat();
     // ShowDemoWindow();
 }
@@ -151,6 +155,38 @@ UI::draw_main_node(Page::page_list_t &pages, Page::page_list_it_t &active_page)
             draw_client_list();
             ImGui::EndMenu();
         }
+        if (BeginMenu("Debug")) {
+            if (MenuItem("Network Conditioner", nullptr, conditioner_open, true)) {
+                conditioner_open = !conditioner_open;
+            }
+            if (IsItemHovered() && GImGui->HoveredIdTimer > 0.5f) {
+                BeginTooltip();
+                TextUnformatted("Add latency and bandwidth limits to connections");
+                EndTooltip();
+            }
+            static ResourceManager &rm = ResourceManager::GetInstance();
+            MenuItem("Trim Large Textures", nullptr, &rm.TrimLargeTextures);
+            if (IsItemHovered() && GImGui->HoveredIdTimer > 0.5f) {
+                BeginTooltip();
+                TextUnformatted("Free detail in big maps that the current zoom doesn't show");
+                EndTooltip();
+            }
+            MenuItem("Reload Shaders", nullptr, &rm.WatchShaders);
+            if (IsItemHovered() && GImGui->HoveredIdTimer > 0.5f) {
+                BeginTooltip();
+                TextUnformatted("Recompile shaders when their files in shaders/ change");
+                EndTooltip();
+            }
+            static FramePacer &pacer = FramePacer::GetInstance();
+            MenuItem("Redraw on Demand", nullptr, &pacer.RedrawOnDemand);
+            if (IsItemHovered() && GImGui->HoveredIdTimer > 0.5f) {
+                BeginTooltip();
+                TextUnformatted("Stop drawing while nothing on screen changes");
+                EndTooltip();
+            }
+            SliderInt("Frame Cap", &pacer.FrameCap, 0, 240, pacer.FrameCap ? "%d fps" : "None");
+            ImGui::EndMenu();
+        }
         EndMenuBar();
     }
     // Page name popup
@@ -681,6 +717,58 @@ UI::draw_http_window() {
     End();
 }
 
+void
+UI::draw_network_conditioner() {
+    if (!conditioner_open) { return; }
+    static NetworkConditioner &nc = NetworkConditioner::GetInstance();
+
+    SetNextWindowSize(ImVec2(350, 300), ImGuiCond_Once);
+    Begin("Network Conditioner", &conditioner_open);
+    // Connections are keyed by the uid on the other end, clients only have one to the host
+    std::vector<std::pair<uint64_t, string>> connections = {
+        {NetworkConditioner::DefaultProfile, "Default"}};
+    if (ClientServer::Started()) {
+        static ClientServer &cs = ClientServer::GetInstance();
+        if (cs.uid == 0) {
+            for (auto &inf : cs.getConnectedClients()) {
+                if (inf.Uid != 0) { connections.emplace_back(inf.Uid, inf.Name); }
+            }
+        } else {
+            connections.emplace_back(0, "Host");
+        }
+    }
+    for (auto &[uid, name] : connections) {
+        PushID(static_cast<int>(uid));
+        if (CollapsingHeader(name.c_str(), ImGuiTreeNodeFlags_DefaultOpen)) {
+            bool custom = uid == NetworkConditioner::DefaultProfile || nc.HasProfile(uid);
+            if (uid != NetworkConditioner::DefaultProfile) {
+                if (Checkbox("Override default", &custom)) {
+                    if (custom) {
+                        nc.SetProfile(uid, nc.GetProfile(uid));
+                    } else {
+                        nc.ClearProfile(uid);
+                    }
+                }
+            }
+            if (custom) {
+                auto p       = nc.GetProfile(uid);
+                bool changed = false;
+                changed |= SliderInt("Latency (ms)", &p.LatencyMs, 0, 1000);
+                changed |= SliderInt("Jitter (ms)", &p.JitterMs, 0, 500);
+                changed |= InputInt("Bandwidth (kbit/s)", &p.BandwidthKbps, 100, 1000);
+                p.BandwidthKbps = std::max(0, p.BandwidthKbps);
+                if (changed) { nc.SetProfile(uid, p); }
+            }
+        }
+        PopID();
+    }
+    Separator();
+    if (Button("Save")) { nc.SaveConfig(); }
+    SameLine();
+    if (Button("Load")) { nc.LoadConfig(); }
+    End();
+}
+
 void
 TextWrappedF(ImFont *font, const char *fmt, ...) {
     auto    f = ImFontResource(font);
@@ -1,13 +1,45 @@
+#include "client_server.h"
+#include "frame_pacer.h"
+#include "gl_state.h"
 #include "glfw_handler.h"
 #include "gui.h"
+#include "metrics.h"
+#include "resource_manager.h"
 #include "stb_image.h"
 #include "state_manager.h"
 #include "network_manager.h"
 
+#include <chrono>
 #include <iostream>
+#include <string>
+#include <thread>
 
 int
-main() {
+main(int argc, char *argv[]) {
+    // Relays are headless, they only pass a game along to spectators
+    if (argc == 5 && std::string(argv[1]) == "--relay") {
+        NetworkManager &nm = NetworkManager::GetInstance();
+        nm.StartRelay("Relay", argv[2], std::stoi(argv[3]), std::stoi(argv[4]));
+        while (true) { std::this_thread::sleep_for(std::chrono::seconds(1)); }
+    }
+    // --record <file> logs the session that is started from the menu, --replay <file> [--fast]
+    // plays one back without connecting to anything, --metrics serves Prometheus metrics on
+    // localhost while hosting
+    std::string record_path, replay_path;
+    bool        replay_fast = false;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--record" && i + 1 < argc) {
+            record_path = argv[++i];
+        } else if (arg == "--replay" && i + 1 < argc) {
+            replay_path = argv[++i];
+        } else if (arg == "--fast") {
+            replay_fast = true;
+        } else if (arg == "--metrics") {
+            Metrics::GetInstance().Serve = true;
+        }
+    }
+
     GLFW &glfw = GLFW::GetInstance();
 
     // glad: load all OpenGL function pointersmode->height
@@ -19,8 +51,9 @@ main() {
 
     GUI &gui = GUI::GetInstance();
 
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    GLState &gl = GLState::GetInstance();
+    gl.SetBlend(true);
+    gl.BlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
     // Set window icon
     int            width, height;
@@ -34,8 +67,25 @@ main() {
     float deltaTime = 0.0f;
     float lastFrame = 0.0f;
 
-    StateManager &  sm = StateManager::GetInstance();
-    NetworkManager &nm = NetworkManager::GetInstance();
+    StateManager &   sm      = StateManager::GetInstance();
+    NetworkManager & nm      = NetworkManager::GetInstance();
+    ResourceManager &rm      = ResourceManager::GetInstance();
+    Metrics &        metrics = Metrics::GetInstance();
+    FramePacer &     pacer   = FramePacer::GetInstance();
+
+    if (!record_path.empty()) { nm.RecordSession(record_path); }
+    if (!replay_path.empty()) {
+        auto role = nm.StartReplay(replay_path, replay_fast);
+        if (!role) { return -1; }
+        // A client log brings its own game with the JOIN_ACCEPT, the host's board starts empty and
+        // is filled in from the pages and pieces it sent
+        if (*role == SessionLog::HOST) {
+            ClientServer::GetInstance(ClientServer::SERVER).Start(0);
+            sm.StartNewGame("Replay", false);
+        } else {
+            ClientServer::GetInstance(ClientServer::CLIENT).Start(0, "Replay");
+        }
+    }
 
     while (!glfw.WindowShouldClose()) {
         // calculate delta time
@@ -43,7 +93,22 @@ main() {
         auto currentFrame = (float)glfwGetTime();
         deltaTime         = currentFrame - lastFrame;
         lastFrame         = currentFrame;
-        glfwPollEvents();
+        // Walking the image cache isn't free, so only do it while someone is watching
+        if (metrics.Scraping()) {
+            int64_t bytes = 0;
+            for (auto &kv : rm.Images) { bytes += kv.second.Data.size(); }
+            metrics.ImageCacheBytes.store(bytes, std::memory_order_relaxed);
+            metrics.ImageCacheCount.store(rm.Images.size(), std::memory_order_relaxed);
+            metrics.TextureResidentBytes.store(
+                rm.ResidentTextureBytes(),
+                std::memory_order_relaxed);
+            metrics.TextureEvictedBytes.store(rm.EvictedTextureBytes(), std::memory_order_relaxed);
+            metrics.GLStateChanges.store(gl.Issued, std::memory_order_relaxed);
+            metrics.GLStateChangesSkipped.store(gl.Skipped, std::memory_order_relaxed);
+        }
+        pacer.WaitForNextFrame();
+        // The frame time only counts the update and draw, not waiting for events or vsync
+        double work_start = glfwGetTime();
 
         // Start the Dear ImGui frame
         gui.NewFrame();
@@ -54,6 +119,7 @@ main() {
         // update game state
         // -----------------
         sm.Update();
+        rm.Update();
 
         glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT);
@@ -69,6 +135,9 @@ main() {
             ImGui::RenderPlatformWindowsDefault();
             glfwMakeContextCurrent(backup_current_context);
         }*/
+        metrics.FrameMicros.store(
+            static_cast<int64_t>((glfwGetTime() - work_start) * 1e6),
+            std::memory_order_relaxed);
         glfw.SwapBuffers();
     }
 